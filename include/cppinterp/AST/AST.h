@@ -1,6 +1,7 @@
 #ifndef CPPINTERP_AST_AST_H
 #define CPPINTERP_AST_AST_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/StringRef.h"
@@ -53,6 +54,12 @@ clang::Expr* GetOrCreateLastExpr(clang::FunctionDecl* fd,
                                  bool omit_decl_stmts = true,
                                  clang::Sema* sema = nullptr);
 
+/// 检查decls能否被transform::RemoveDecls()一起移除。
+/// 重新声明了集合之外的声明的声明不能移除：clang的查找表只保存重新声明链
+/// 中最新的声明，移除它会让之前的声明也无法被找到。
+///\returns 第一个不能移除的声明，全部可以移除时返回nullptr。
+const clang::Decl* FindUnremovableDecl(llvm::ArrayRef<clang::Decl*> decls);
+
 }  // namespace analyze
 
 /// 包括一些整合ASTNodes或者types的静态工具函数。
@@ -62,8 +69,25 @@ extern const char* const UniquePrefix;
 
 }
 
+/// 包括一些在AST中查找声明的静态工具函数。
+namespace lookup {
+
+/// 在翻译单元作用域中按名称查找命名空间，不产生诊断。
+///\returns 没有找到或者名称不是命名空间时返回nullptr。
+const clang::NamespaceDecl* Namespace(clang::Sema* sema, llvm::StringRef name);
+
+}  // namespace lookup
+
 /// 包括一些转换ASTNodes或者types的静态工具函数。
-namespace transform {}
+namespace transform {
+
+/// 在一次遍历中把decls从AST中移除：从词法上下文、查找表、TU作用域和
+/// 标识符解析链中删除。decls必须是顶层声明，按声明顺序排列，并且已经通过
+/// analyze::FindUnremovableDecl()的检查。链接规范(extern "C")中的声明
+/// 同样被移除。
+void RemoveDecls(clang::Sema& sema, llvm::ArrayRef<clang::Decl*> decls);
+
+}  // namespace transform
 }  // namespace ast
 }  // namespace cppinterp
 
@@ -4,6 +4,7 @@
 #include "clang/AST/Decl.h"
 #include "clang/AST/DeclGroup.h"
 #include "cppinterp/Interpreter/Transaction.h"
+#include "cppinterp/Interpreter/TransactionProfiler.h"
 #include "llvm/ADT/PointerIntPair.h"
 
 namespace clang {
@@ -54,6 +55,7 @@ class ASTTransformer {
   void Emit(clang::Decl* decl) { Emit(clang::DeclGroupRef(decl)); }
 
   Result Transform(clang::Decl* decl, Transaction* transaction) {
+    TransactionProfiler::PhaseRAII phase(TransactionProfiler::kTransformers);
     transaction_ = transaction;
     return Transform(decl);
   }
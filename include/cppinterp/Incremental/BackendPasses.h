@@ -4,19 +4,17 @@
 #include <array>
 #include <memory>
 
-#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/CodeGen.h"
 
 namespace llvm {
 class Function;
 class LLVMContext;
 class Module;
-class PassManagerBuilder;
+class PassBuilder;
 class TargetMachine;
-
-namespace legacy {
-class FunctionPassManager;
-class PassManager;
-}  // namespace legacy
 }  // namespace llvm
 
 namespace clang {
@@ -27,25 +25,60 @@ class TargetOptions;
 
 namespace cppinterp {
 class IncrementalJIT;
+class TieredCompiler;
 
 /// 在IR上运行pass。
 /// 一旦我们可以从ModuleBuilder迁移到clang的CodeGen/BackendUtil中，就删除它。
 class BackendPasses {
-  std::array<std::unique_ptr<llvm::legacy::PassManager>, 4> pm_;
-  std::array<std::unique_ptr<llvm::legacy::FunctionPassManager>, 4> fpm_;
+  /// 构建每个优化级别的流水线的PassBuilder，调优选项与该级别一致。
+  /// 在流水线之前声明，因此比流水线活得更久。
+  std::array<std::unique_ptr<llvm::PassBuilder>, 4> pb_levels_;
+
+  /// 每个优化级别的流水线，第一次使用时构建。
+  std::array<std::unique_ptr<llvm::ModulePassManager>, 4> mpm_;
+
+  /// 注册分析的PassBuilder，已经注册了目标的回调。
+  /// 注册的分析工厂引用它，必须比分析管理器活得更久。
+  std::unique_ptr<llvm::PassBuilder> pb_;
+
+  /// 所有流水线共享的分析管理器，跨事务复用。
+  /// 声明顺序与clang一致：外层管理器持有内层的代理，必须先被销毁。
+  llvm::LoopAnalysisManager lam_;
+  llvm::FunctionAnalysisManager fam_;
+  llvm::CGSCCAnalysisManager cgam_;
+  llvm::ModuleAnalysisManager mam_;
 
   llvm::TargetMachine& tm_;
   IncrementalJIT& jit_;
   const clang::CodeGenOptions& cgopts_;
 
-  void CreatePasses(llvm::Module& module, int opt_level);
+  /// 非空时启用分层编译：模块总是以O0优化并插入入口计数器。
+  /// 初始值为jit_拥有的TieredCompiler。
+  TieredCompiler* tiered_;
+
+  /// 创建调优选项与旧的流水线的opt_level一致的PassBuilder，
+  /// 并注册目标的回调。
+  std::unique_ptr<llvm::PassBuilder> createPassBuilder(int opt_level);
+  void CreatePasses(int opt_level);
 
  public:
+  /// 记录模块优化级别的module flag，并发编译时用来为模块选择codegen优化级别。
+  static constexpr const char* kOptLevelFlag = "cppinterp.opt-level";
+
+  /// 返回runOnModule()记录在模块中的优化级别，没有记录时返回-1。
+  static int getModuleOptLevel(const llvm::Module& module);
+
+  /// 返回优化级别(0到3)对应的codegen优化级别。
+  static llvm::CodeGenOpt::Level getCodeGenOptLevel(int opt_level);
+
   BackendPasses(const clang::CodeGenOptions& cgopts, IncrementalJIT& jit,
                 llvm::TargetMachine& tm);
   ~BackendPasses();
 
   void runOnModule(llvm::Module& module, int opt_level);
+
+  void setTieredCompiler(TieredCompiler* tiered) { tiered_ = tiered; }
+  TieredCompiler* getTieredCompiler() const { return tiered_; }
 };
 }  // namespace cppinterp
 
@@ -0,0 +1,42 @@
+#ifndef CPPINTERP_INCREMENTAL_INCREMENTAL_EXECUTOR_H
+#define CPPINTERP_INCREMENTAL_INCREMENTAL_EXECUTOR_H
+
+#include <memory>
+
+#include "llvm/Support/Error.h"
+
+namespace clang {
+class CompilerInstance;
+}  // namespace clang
+
+namespace cppinterp {
+
+class IncrementalJIT;
+class InvocationOptions;
+class Transaction;
+
+/// 运行增量编译的代码：拥有IncrementalJIT，负责事务的静态析构函数。
+/// 解释器在-fsyntax-only模式下没有执行器。
+class IncrementalExecutor {
+  std::unique_ptr<IncrementalJIT> jit_;
+
+ public:
+  /// 在当前进程中创建IncrementalJIT。失败时设置err。
+  IncrementalExecutor(const clang::CompilerInstance& ci,
+                      const InvocationOptions& opts, llvm::Error& err,
+                      void* extra_lib_handle, bool verbose);
+  ~IncrementalExecutor();
+
+  IncrementalJIT& getJIT() { return *jit_; }
+  const IncrementalJIT& getJIT() const { return *jit_; }
+
+  /// 把事务的模块交给JIT，见IncrementalJIT::addModule()。
+  void addModule(Transaction& transaction);
+
+  /// 运行并移除事务注册的静态析构函数，不包括它的嵌套事务。
+  void runAndRemoveStaticDestructors(const Transaction* transaction);
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INCREMENTAL_INCREMENTAL_EXECUTOR_H
@@ -3,15 +3,21 @@
 
 #include <atomic>
 #include <cstdint>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "cppinterp/Incremental/SymbolIndex.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/FunctionExtras.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/LLJIT.h"
 #include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/Module.h"
@@ -19,12 +25,16 @@
 #include "llvm/Target/TargetMachine.h"
 
 namespace clang {
+class CodeGenOptions;
 class CompilerInstance;
-}
+}  // namespace clang
 
 namespace cppinterp {
 
 class IncrementalExecutor;
+class IncrementalObjectCache;
+class InvocationOptions;
+class TieredCompiler;
 class Transaction;
 
 class SharedAtomicFlag {
@@ -45,10 +55,33 @@ class SharedAtomicFlag {
 
 class IncrementalJIT {
  public:
+  /// 开启记录时保存的一个模块的编译结果，用于InterpreterCheckpoint。
+  struct RecordedObject {
+    /// 模块没有任何可以链接的定义时为nullptr。
+    std::unique_ptr<llvm::MemoryBuffer> object;
+    /// 模块的llvm.global_ctors中的函数名，按优先级排序。
+    std::vector<std::string> ctors;
+    /// 编译顺序，恢复时按该顺序运行静态初始化函数。
+    uint64_t sequence = 0;
+  };
+
+  /// 编译过的模块的IR占用的内存。字节数按IR对象的个数估算，
+  /// 不包括常量和元数据，是一个下界。
+  struct IRMemoryStatistics {
+    uint64_t modules_retained = 0;
+    uint64_t bytes_retained = 0;
+    uint64_t modules_released = 0;
+    uint64_t bytes_released = 0;
+  };
+
+  /// 为宿主创建tm_，然后通过createJIT()按opts创建jit_，再加入宿主进程和
+  /// extra_lib_handle的符号查找。失败时设置err。
   IncrementalJIT(IncrementalExecutor& executor,
                  const clang::CompilerInstance& ci,
+                 const InvocationOptions& opts,
                  std::unique_ptr<llvm::orc::ExecutorProcessControl> epc,
                  llvm::Error& err, void* extra_lib_handle, bool verbose);
+  ~IncrementalJIT();
 
   /// 注册一个DefinitionGenerator来动态地为进程中不可用的生成代码提供符号。
   void addGenerator(std::unique_ptr<llvm::orc::DefinitionGenerator> dg) {
@@ -59,10 +92,17 @@ class IncrementalJIT {
   /// 此函数可以与addGenerator()结合使用，以跨不同的IncrementalJIT实例提供符号解析。
   std::unique_ptr<llvm::orc::DefinitionGenerator> getGenerator();
 
+  /// 把事务的模块交给JIT：为它创建资源跟踪器，然后通过addTransactionModule()
+  /// 加入符号索引、分层编译器和JIT，并立即编译包装函数。
   void addModule(Transaction& transaction);
 
   llvm::Error removeModule(const Transaction& transaction);
 
+  /// 一次卸载多个事务的模块：它们的资源跟踪器先被合并到一个跟踪器中，
+  /// 然后通过一次ORC调用一起移除，代价与被卸载的模块数成正比。
+  /// 没有模块的事务被忽略。
+  llvm::Error removeModules(llvm::ArrayRef<const Transaction*> transactions);
+
   /// 根据其IR名称(来自clang的mangler)获取符号的地址。
   /// include_host_symbols参数控制查找是否应该包含来自主机进程的符号(通过dlsym)。
   void* getSymbolAddress(llvm::StringRef name, bool include_host_symbols);
@@ -70,29 +110,177 @@ class IncrementalJIT {
   /// 检查JIT是否已经发出或知道如何根据其IR名称(来自clang的mangler)发出符号。
   bool doesSymbolAlreadyExist(llvm::StringRef unmangled_name);
 
+  /// JIT定义的符号和宿主导出符号的索引，doesSymbolAlreadyExist()和
+  /// BackendPasses通过它查询，不再遍历模块或调用dlsym。
+  SymbolIndex& getSymbolIndex() { return symbol_index_; }
+
   /// 注入一个已知地址的符号。名称没有链接器损坏，即由IR所知。
   llvm::JITTargetAddress addOrReplaceDefinition(llvm::StringRef name,
                                                 llvm::JITTargetAddress known_addr);
 
-  llvm::Error runCtors() const {
-    return jit_->initialize(jit_->getMainJITDylib());
-  }
+  llvm::Error runCtors() const;
 
   /// 获取JIT使用的TargetMachine。
-  /// 非const函数因为BackendPasses需要更新OptLevel。
+  /// 非const函数因为BackendPasses需要更新OptLevel。并发模式下它只能在
+  /// 解释器线程上使用，编译线程读取模块中记录的优化级别。
   llvm::TargetMachine &getTargetMachine() { return *tm_; }
 
+  /// 是否在ORC的编译线程池上并发编译模块。
+  bool isConcurrent() const { return compile_threads_ != 0; }
+
+  /// 是否按需编译函数：只有包装函数被立即编译，
+  /// 其余函数在第一次被调用时才经过object layer。
+  bool isLazy() const { return lazy_compilation_; }
+
+  /// 返回新事务模块应使用的context。
+  /// 单线程模式下所有模块共享single_threaded_context_；并发模式下每个模块
+  /// 拥有独立的context，这样不同模块的编译不会在context锁上串行化。
+  llvm::orc::ThreadSafeContext getModuleContext();
+
+  /// 返回一个与tm_配置相同的JITTargetMachineBuilder，用于在其他线程上
+  /// 创建独立的TargetMachine。它不复制tm_当前的OptLevel(可能正在被
+  /// BackendPasses修改)，调用者需要自己设置codegen优化级别。
+  llvm::orc::JITTargetMachineBuilder getTargetMachineBuilder() const;
+
+  /// 把一个已经编译好的目标文件加入主JITDylib，可以从任意线程调用。
+  /// 目标文件的生命周期与JIT相同，不属于任何事务。
+  llvm::Error addObjectFile(std::unique_ptr<llvm::MemoryBuffer> obj);
+
+  /// 把目标文件加入给定的资源跟踪器，随跟踪器一起被移除。
+  llvm::Error addObjectFile(llvm::orc::ResourceTrackerSP rt,
+                            std::unique_ptr<llvm::MemoryBuffer> obj);
+
+  /// 分层编译器，TierUpThreshold为0时为nullptr。
+  TieredCompiler* getTieredCompiler() const { return tiered_compiler_.get(); }
+
+  /// 设置磁盘目标文件缓存，之后编译的模块都会先查询它。传入nullptr关闭缓存。
+  void setObjectCache(std::unique_ptr<IncrementalObjectCache> cache);
+
+  /// 返回磁盘目标文件缓存，未启用时为nullptr。
+  IncrementalObjectCache* getObjectCache() const { return object_cache_.get(); }
+
+  /// 是否保存之后加入的每个事务模块的目标文件，供InterpreterCheckpoint使用。
+  /// 开启时事务模块在加入JIT时被立即编译。
+  /// 惰性模式下模块被拆分为按函数编译的分区，不支持记录。
+  void setRecordObjects(bool record) { record_objects_ = record; }
+  bool isRecordingObjects() const { return record_objects_; }
+
+  /// 保存模块的编译结果，由编译器在开启记录时调用，可以从任意线程调用。
+  void recordObject(const llvm::Module& module, const llvm::MemoryBuffer& obj);
+
+  /// 返回事务模块的编译结果，没有记录时返回nullptr。
+  const RecordedObject* getRecordedObject(const Transaction& transaction) const;
+
+  /// 加入一个从检查点恢复的目标文件。它定义的全局符号被记录下来，
+  /// 之后的模块中相同符号的定义会被BackendPasses删除，避免重复定义。
+  /// 所有恢复的目标文件共享一个资源跟踪器，可以通过removeRestoredObjects()
+  /// 一起卸载。
+  llvm::Error addRestoredObject(std::unique_ptr<llvm::MemoryBuffer> obj);
+
+  /// 给定IR名称的符号是否由恢复的目标文件定义。
+  bool isRestoredSymbol(llvm::StringRef name) const {
+    return restored_symbols_.count(name);
+  }
+
+  llvm::Error removeRestoredObjects();
+
+  /// 是否在模块编译为目标代码之后立即释放它的IR。关闭时编译过的模块保存在
+  /// compiled_modules_中。卸载只依赖资源跟踪器，符号查找只依赖JIT的符号表，
+  /// 都不需要IR；释放之后Transaction::getCompiledModule()只能用来判断事务
+  /// 是否已经编译，不能再解引用。
+  void setReleaseIR(bool release) { release_ir_ = release; }
+  bool isReleasingIR() const { return release_ir_; }
+
+  /// 释放已经保存的编译过的模块的IR，返回估算释放的字节数。
+  uint64_t releaseCompiledModules();
+
+  IRMemoryStatistics getIRMemoryStatistics() const;
+
  private:
+  /// 创建IRCompileLayer使用的编译器，由configureBuilder()安装。
+  /// 单线程模式下编译器使用tm_(其OptLevel由BackendPasses设置)；
+  /// 并发模式下每个模块使用自己的TargetMachine，优化级别取自模块本身。
+  /// 两种模式都会查询object_cache_。
+  std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> createCompiler();
+
+  /// 查找事务的包装函数，立即编译它所在的模块(惰性模式下只编译包装函数)。
+  /// 事务没有包装函数时什么也不做。
+  llvm::Error compileWrapper(const Transaction& transaction);
+
+  /// 按opts创建jit_：读取编译线程数和ReleaseIRAfterJIT，按CachePath和
+  /// ObjectCacheSize创建object_cache_(之前没有通过setObjectCache()设置时)，
+  /// LazyCompilation打开时创建LLLazyJIT，通过configureBuilder()安装编译器，
+  /// 然后调用installCompiledModuleHandler()；TierUpThreshold不为0时创建
+  /// tiered_compiler_。由构造函数在创建tm_之后调用。
+  llvm::Error createJIT(const InvocationOptions& opts,
+                        const clang::CodeGenOptions& cgopts,
+                        std::unique_ptr<llvm::orc::ExecutorProcessControl> epc);
+
+  /// 在createJIT()创建LLJIT(惰性模式下为LLLazyJIT)之前配置编译器和编译线程数。
+  template <typename BuilderT>
+  void configureBuilder(BuilderT& builder) {
+    builder.setNumCompileThreads(compile_threads_);
+    builder.setCompileFunctionCreator(
+        [this](llvm::orc::JITTargetMachineBuilder)
+            -> llvm::Expected<
+                std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+          return createCompiler();
+        });
+  }
+
+  /// 把事务的模块交给JIT，由addModule()调用。
+  /// 惰性模式下模块经过CompileOnDemandLayer，每个函数都被替换为一个在第一次
+  /// 调用时触发编译的stub。两种模式下事务的包装函数都随后被立即查找，
+  /// 从而被立即编译，编译时间计入当前记录的jit-link阶段。
+  llvm::Error addTransactionModule(const Transaction& transaction,
+                                   llvm::orc::ResourceTrackerSP rt,
+                                   llvm::orc::ThreadSafeModule tsm);
+
+  /// 由createJIT()在创建jit_之后调用，让IRCompileLayer把编译过的模块交给
+  /// onModuleCompiled()，而不是直接销毁。
+  void installCompiledModuleHandler();
+
+  /// 根据release_ir_保存或释放编译过的模块，可以在编译线程上调用。
+  void onModuleCompiled(llvm::orc::ThreadSafeModule tsm);
+
+  /// 以下成员会被编译线程上的编译器和onModuleCompiled()访问，
+  /// 必须比jit_活得更久：jit_析构时会等待仍在进行的编译任务。
+  std::unique_ptr<IncrementalObjectCache> object_cache_;
+  std::map<const llvm::Module*, llvm::orc::ThreadSafeModule> compiled_modules_;
+  std::atomic<bool> release_ir_{false};
+  IRMemoryStatistics ir_stats_;
+  /// 保护compiled_modules_和ir_stats_。
+  mutable std::mutex compiled_modules_mutex_;
+
+  std::atomic<bool> record_objects_{false};
+  /// 模块名到编译结果的映射。
+  std::map<std::string, RecordedObject> recorded_objects_;
+  /// 开启记录之后加入的事务到其模块名的映射。
+  std::map<const Transaction*, std::string> transaction_modules_;
+  uint64_t next_record_sequence_ = 0;
+  mutable std::mutex recorded_objects_mutex_;
+
+  SymbolIndex symbol_index_;
+
   std::unique_ptr<llvm::orc::LLJIT> jit_;
+  /// 在jit_之前销毁：它的后台线程使用jit_。
+  std::unique_ptr<TieredCompiler> tiered_compiler_;
   llvm::orc::SymbolMap injected_symbols_;
   SharedAtomicFlag skip_host_process_lookup_;
   llvm::StringSet<> forbid_dl_symbols_;
   llvm::orc::ResourceTrackerSP current_rt_;
   std::map<const Transaction*, llvm::orc::ResourceTrackerSP> resource_trackers_;
-  std::map<const llvm::Module*, llvm::orc::ThreadSafeModule> compiled_modules_;
   bool jit_link_;
   std::unique_ptr<llvm::TargetMachine> tm_;
   llvm::orc::ThreadSafeContext single_threaded_context_;
+  /// ORC编译线程数，0表示在调用线程上编译。
+  unsigned compile_threads_ = 0;
+  /// jit_是否为LLLazyJIT。
+  bool lazy_compilation_ = false;
+
+  /// 恢复的目标文件的资源跟踪器及其定义的符号(IR名称)。
+  llvm::orc::ResourceTrackerSP restored_rt_;
+  llvm::StringSet<> restored_symbols_;
 };
 
 }  // namespace cppinterp
@@ -0,0 +1,118 @@
+#ifndef CPPINTERP_INCREMENTAL_INCREMENTAL_OBJECT_CACHE_H
+#define CPPINTERP_INCREMENTAL_INCREMENTAL_OBJECT_CACHE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/Support/Chrono.h"
+
+namespace llvm {
+class MemoryBuffer;
+class MemoryBufferRef;
+class Module;
+class raw_ostream;
+class TargetMachine;
+}  // namespace llvm
+
+namespace cppinterp {
+
+class CompilerOptions;
+
+/// 持久化的磁盘目标文件缓存。
+///
+/// 键是(经过BackendPasses之后的)IR的文本形式、目标三元组、CPU、
+/// 目标特性和模块中记录的优化级别的SHA1值。IR文本中的ModuleID和
+/// source_filename被替换为占位符，因此不含由模块名派生的符号的模块，
+/// 键与模块名、事务编号无关。含有这类符号(例如动态初始化函数
+/// _GLOBAL__sub_I_<模块名>)的模块只与同名的模块共用条目，例如进程重启后
+/// 重放相同的输入时。
+/// 命中时直接把可重定位目标文件交给LLJIT的object layer，跳过codegen。
+/// 缓存总大小超过上限时，按最近使用时间淘汰最旧的条目(LRU)。
+class IncrementalObjectCache : public llvm::ObjectCache {
+ public:
+  /// 缓存的统计计数器。
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes_evicted = 0;
+  };
+
+ private:
+  /// 一个磁盘条目。
+  struct Entry {
+    uint64_t size = 0;
+    llvm::sys::TimePoint<> last_use;
+  };
+
+  /// 缓存目录。
+  std::string dir_;
+
+  /// 缓存的最大字节数，超过后开始淘汰。
+  uint64_t max_bytes_;
+
+  /// 计算键时使用的TargetMachine，只读取不会改变的目标三元组、CPU和特性。
+  const llvm::TargetMachine& tm_;
+
+  /// 磁盘条目索引，第一次访问时通过扫描目录建立。
+  std::map<std::string, Entry> entries_;
+  bool entries_loaded_ = false;
+  uint64_t total_bytes_ = 0;
+
+  /// getObject()未命中时计算的键，供notifyObjectCompiled()复用。
+  llvm::DenseMap<const llvm::Module*, std::string> pending_keys_;
+
+  Statistics stats_;
+
+  /// ORC可能在多个线程上编译模块。
+  mutable std::mutex mutex_;
+
+  std::string computeKey(const llvm::Module& module) const;
+  std::string getEntryPath(llvm::StringRef key) const;
+  void loadEntries();
+  void evict();
+
+ public:
+  IncrementalObjectCache(llvm::StringRef dir, uint64_t max_bytes,
+                         const llvm::TargetMachine& tm);
+  ~IncrementalObjectCache() override;
+
+  /// 根据CompilerOptions创建缓存：目录为CachePath下的"objects"子目录，
+  /// 上限为ObjectCacheSize。未启用或目录无法创建时返回nullptr。
+  static std::unique_ptr<IncrementalObjectCache> Create(
+      const CompilerOptions& opts, const llvm::TargetMachine& tm);
+
+  /// \name llvm::ObjectCache overrides
+  /// \{
+  void notifyObjectCompiled(const llvm::Module* module,
+                            llvm::MemoryBufferRef obj) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(
+      const llvm::Module* module) override;
+  /// \}
+
+  /// 模块编译失败时由编译器调用，丢弃getObject()为它计算的键。
+  void notifyCompileFailed(const llvm::Module* module);
+
+  llvm::StringRef getDirectory() const { return dir_; }
+  uint64_t getMaxBytes() const { return max_bytes_; }
+
+  /// 当前缓存在磁盘上占用的字节数。
+  uint64_t getTotalBytes() const;
+
+  Statistics getStatistics() const;
+
+  /// 打印统计信息。
+  void dump(llvm::raw_ostream& out) const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INCREMENTAL_INCREMENTAL_OBJECT_CACHE_H
@@ -161,6 +161,16 @@ class IncrementalParser {
   /// 添加用户生成(user-generated)的事务。
   void addTransaction(Transaction* transaction);
 
+  /// 按从新到旧的顺序把唯一ID为point_id的顶层事务之后的顶层事务追加到out，
+  /// 代价与它们的个数成正比。point_id为0时返回所有事务。
+  ///\returns point_id不是已知的顶层事务的唯一ID时返回false。
+  bool getTransactionsAfter(unsigned point_id,
+                            std::vector<Transaction*>& out) const;
+
+  /// 一次移除最后count个顶层事务：把它们从事务列表中删除，丢弃它们的输入
+  /// 缓冲区条目，并把事务放回事务池。调用者负责事先卸载它们的声明和模块。
+  void popTransactions(size_t count);
+
   /// 返回解释器看到的事务列表。
   /// 有意地创建一个副本：该函数的目的是用于调试。
   std::vector<const Transaction*> getAllTransactions();
@@ -0,0 +1,117 @@
+#ifndef CPPINTERP_INCREMENTAL_SYMBOL_INDEX_H
+#define CPPINTERP_INCREMENTAL_SYMBOL_INDEX_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class Module;
+class raw_ostream;
+}  // namespace llvm
+
+namespace cppinterp {
+
+class Transaction;
+
+/// IncrementalJIT的符号索引，判断一个符号是否已经存在时不再遍历模块或者
+/// 对每个已加载的库调用dlsym。名字都是IR名称。
+///
+/// JIT定义的符号：事务模块加入JIT时记录它定义的非局部全局符号，
+/// 卸载事务时删除，查询是一次哈希表查找。
+///
+/// 宿主进程和共享库导出的符号：通过dl_iterate_phdr遍历已加载的ELF对象，
+/// 把它们.dynsym中定义的全局符号和弱符号放入一个Bloom过滤器。每次查询只
+/// 比较动态链接器的加载计数器：有新加载的对象时只索引新对象，有对象被卸载
+/// 时重新构建。过滤器否定的名字一定不是导出符号，直接返回；其余的名字通过
+/// dlsym确认，结果被缓存到下一次加载或卸载为止。
+/// 通过llvm::sys::DynamicLibrary::AddSymbol()显式添加的符号不在过滤器中。
+///
+/// 所有操作都由一个互斥锁保护。
+class SymbolIndex {
+ public:
+  struct Statistics {
+    /// JIT定义的符号数。
+    uint64_t jit_symbols = 0;
+    /// 放入过滤器的导出符号数和它们所在的对象数。
+    uint64_t host_symbols = 0;
+    uint64_t host_objects = 0;
+    /// 过滤器的位数，以及因为加载、卸载或者容量不足重新构建的次数。
+    uint64_t filter_bits = 0;
+    uint64_t rebuilds = 0;
+    /// 宿主符号的查询次数，其中被过滤器否定的次数、命中缓存的次数，
+    /// 以及过滤器肯定但dlsym没有找到的次数。
+    uint64_t host_lookups = 0;
+    uint64_t filtered = 0;
+    uint64_t cache_hits = 0;
+    uint64_t false_positives = 0;
+  };
+
+ private:
+  /// 每个符号使用的哈希函数个数。构建时每个符号占用16到32位，
+  /// 增量索引使每个符号占用的位数少于12时重新构建。
+  static constexpr unsigned kNumHashes = 6;
+  static constexpr uint64_t kBitsPerSymbol = 16;
+  static constexpr uint64_t kMinBitsPerSymbol = 12;
+
+  /// JIT定义的符号到定义它的模块个数的映射。
+  llvm::StringMap<unsigned> jit_symbols_;
+
+  /// 事务到它定义的符号的映射，条目属于jit_symbols_。
+  std::map<const Transaction*, std::vector<llvm::StringMapEntry<unsigned>*>>
+      transaction_symbols_;
+
+  std::vector<uint64_t> filter_;
+
+  /// 已经放入过滤器的对象，以程序头表的地址标识。
+  llvm::DenseSet<const void*> indexed_objects_;
+
+  /// 最后一次索引时动态链接器的加载和卸载计数。
+  unsigned long long loads_ = 0;
+  unsigned long long unloads_ = 0;
+
+  /// dlsym的结果，包括没有找到的名字。
+  llvm::StringMap<void*> host_cache_;
+
+  Statistics stats_;
+
+  mutable std::mutex mutex_;
+
+  /// 索引新加载的对象，有对象被卸载或者容量不足时重新构建过滤器。
+  void refresh();
+
+  void rebuild(uint64_t expected_symbols);
+  void insert(llvm::StringRef name);
+  bool mayContain(llvm::StringRef name) const;
+
+ public:
+  SymbolIndex() = default;
+  SymbolIndex(const SymbolIndex&) = delete;
+  SymbolIndex& operator=(const SymbolIndex&) = delete;
+
+  /// 记录transaction的模块定义的符号，在模块加入JIT时调用。
+  void addModuleSymbols(const Transaction& transaction,
+                        const llvm::Module& module);
+
+  /// 删除transaction的模块定义的符号，在卸载模块时调用。
+  void removeModuleSymbols(const Transaction& transaction);
+
+  bool isDefinedInJIT(llvm::StringRef name) const;
+
+  /// 返回宿主进程或已加载的共享库导出的符号的地址，不存在时返回nullptr。
+  /// 不会自动加载库。
+  void* findHostSymbol(llvm::StringRef name);
+
+  Statistics getStatistics() const;
+
+  void dump(llvm::raw_ostream& out) const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INCREMENTAL_SYMBOL_INDEX_H
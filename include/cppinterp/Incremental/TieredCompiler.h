@@ -0,0 +1,163 @@
+#ifndef CPPINTERP_INCREMENTAL_TIERED_COMPILER_H
+#define CPPINTERP_INCREMENTAL_TIERED_COMPILER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/Error.h"
+
+namespace llvm {
+class Function;
+class Module;
+class PassBuilder;
+class raw_ostream;
+class TargetMachine;
+}  // namespace llvm
+
+namespace clang {
+class CodeGenOptions;
+}  // namespace clang
+
+namespace cppinterp {
+
+class IncrementalJIT;
+class Transaction;
+
+/// 分层编译：函数先以O0编译并带有入口计数器，调用次数达到阈值后在后台线程上
+/// 以更高的优化级别重新编译，并切换到优化后的版本。
+///
+/// instrumentModule()把每个符合条件的函数F改写为一个跳板：
+/// 跳板递增F.__tier_count，在计数达到阈值时调用__cppinterp_tier_up，
+/// 然后通过F.__tier_slot中的指针尾调用真正的函数体。
+/// F.__tier_slot由JIT链接器初始化为O0函数体F.__tier0的地址。
+/// 重新编译完成后，F.__tier_slot被改写为优化后函数体的地址，
+/// 已经链接的调用者因此无需重新链接就会使用新的函数体。
+///
+/// 优化后的目标文件加入函数所在事务的资源跟踪器，与事务一起被卸载。
+/// 卸载事务之前IncrementalJIT调用removeTransactions()，它丢弃等待中的
+/// 重新编译，并等待正在进行的重新编译完成。TieredCompiler由IncrementalJIT
+/// 拥有，在jit_之前被销毁。
+class TieredCompiler {
+ public:
+  struct Statistics {
+    uint64_t instrumented_functions = 0;
+    uint64_t tier_ups = 0;
+    uint64_t failed_tier_ups = 0;
+  };
+
+ private:
+  /// 一个被插桩的事务模块。
+  struct ModuleInfo {
+    /// 模块所属的事务和它的资源跟踪器，模块加入JIT之前为空。
+    const Transaction* transaction = nullptr;
+    llvm::orc::ResourceTrackerSP tracker;
+  };
+
+  /// 一个被插桩的函数。
+  struct FunctionInfo {
+    /// 事务模块在插桩之后的bitcode，同一事务的函数共享。
+    std::shared_ptr<const llvm::SmallVector<char, 0>> bitcode;
+    std::shared_ptr<ModuleInfo> module;
+    /// 函数是否已经(或正在)被重新编译。
+    bool promoted = false;
+  };
+
+  IncrementalJIT& jit_;
+  const clang::CodeGenOptions& cgopts_;
+
+  /// 调用次数达到该值时重新编译。
+  const unsigned threshold_;
+
+  /// 重新编译时使用的优化级别。
+  const int opt_level_;
+
+  /// 函数名到被插桩函数的映射，名称为跳板函数的IR名称。
+  llvm::StringMap<FunctionInfo> functions_;
+
+  /// 已经插桩、还没有加入JIT的模块，以模块名为键。
+  llvm::StringMap<std::shared_ptr<ModuleInfo>> pending_modules_;
+
+  /// 后台线程正在重新编译的函数所在的模块。
+  const ModuleInfo* in_flight_ = nullptr;
+
+  /// 等待重新编译的函数。
+  std::deque<std::string> queue_;
+
+  Statistics stats_;
+
+  bool stop_ = false;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+
+  /// 重新编译使用的TargetMachine和优化流水线，只在后台线程上使用，
+  /// 第一次重新编译时创建，之后复用。被重新编译的模块只剩一个函数体，
+  /// 只需要优化流水线，不再运行BackendPasses中处理事务模块的pass。
+  /// pass_builder_注册的分析引用它自己，必须比分析管理器活得更久。
+  std::unique_ptr<llvm::TargetMachine> tm_;
+  std::unique_ptr<llvm::PassBuilder> pass_builder_;
+  llvm::LoopAnalysisManager lam_;
+  llvm::FunctionAnalysisManager fam_;
+  llvm::CGSCCAnalysisManager cgam_;
+  llvm::ModuleAnalysisManager mam_;
+  std::unique_ptr<llvm::ModulePassManager> mpm_;
+
+  /// 后台重新编译线程。
+  std::thread worker_;
+
+  bool isEligible(const llvm::Function& function) const;
+  void instrumentFunction(llvm::Function& function);
+  void run();
+  llvm::Error createPipeline();
+  llvm::Error promote(llvm::StringRef name,
+                      const llvm::SmallVector<char, 0>& bitcode,
+                      llvm::orc::ResourceTrackerSP tracker);
+
+ public:
+  /// 运行时回调，由跳板在计数达到阈值时调用。
+  static void TierUp(void* tiered_compiler, const char* name);
+
+  TieredCompiler(IncrementalJIT& jit, const clang::CodeGenOptions& cgopts,
+                 unsigned threshold, int opt_level = 2);
+  ~TieredCompiler();
+
+  unsigned getThreshold() const { return threshold_; }
+  int getOptLevel() const { return opt_level_; }
+
+  /// 为模块中符合条件的函数插入入口计数器和跳板。
+  /// 在BackendPasses以O0运行之后、模块交给JIT之前调用。
+  void instrumentModule(llvm::Module& module);
+
+  /// 记录被插桩的模块所属的事务和资源跟踪器，由IncrementalJIT在模块
+  /// 加入JIT时调用。没有被插桩的模块被忽略。
+  void addTransactionModule(const Transaction& transaction,
+                            llvm::StringRef module_name,
+                            llvm::orc::ResourceTrackerSP tracker);
+
+  /// 丢弃这些事务中的函数，并等待正在进行的重新编译完成。
+  /// 由IncrementalJIT在移除它们的资源跟踪器之前调用。
+  void removeTransactions(llvm::ArrayRef<const Transaction*> transactions);
+
+  /// 请求重新编译给定的函数，可以从任意线程调用。
+  void requestTierUp(llvm::StringRef name);
+
+  Statistics getStatistics() const;
+
+  void dump(llvm::raw_ostream& out) const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INCREMENTAL_TIERED_COMPILER_H
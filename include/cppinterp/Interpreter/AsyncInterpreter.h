@@ -0,0 +1,123 @@
+#ifndef CPPINTERP_INTERPRETER_ASYNC_INTERPRETER_H
+#define CPPINTERP_INTERPRETER_ASYNC_INTERPRETER_H
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cppinterp/Interpreter/Interpreter.h"
+#include "cppinterp/Interpreter/Value.h"
+#include "llvm/ADT/FunctionExtras.h"
+
+namespace cppinterp {
+
+/// Interpreter的异步前端：请求被放入队列并立即返回future。
+///
+/// 保证：
+/// - 所有请求按提交顺序在唯一的编译线程上编译，编译之间不会重叠。
+/// - declare()、process()、evaluate()和post()完全在编译线程上运行，
+///   包括它们执行的包装函数和静态初始化函数，因此它们彼此之间按顺序生效。
+/// - execute()只在编译线程上编译：输入被包装为一个extern "C"函数，
+///   然后在执行线程上运行。多个execute()可以彼此重叠，也可以与之后的
+///   编译重叠，因此一个耗时的execute()不会阻塞其他请求。
+///   依赖execute()副作用的请求应该先等待它的future。
+///   函数运行完毕之后它的事务在编译线程上被卸载，见unloadFinishedExecutions()。
+/// - process()和evaluate()返回的Value在编译线程上通过
+///   Value::makeThreadShareable()变为可以跨线程共享：引用计数是原子的，
+///   最后一个引用在其他线程上释放时，JIT编译的析构函数推迟到编译线程
+///   开始处理下一个请求时运行，不会与编译或卸载同时进行。
+///   post()返回的Value需要fn自己调用它。
+/// - 在执行线程上运行的代码不能直接调用Interpreter；它可以通过
+///   AsyncInterpreter提交请求，但不能在执行线程上等待一个排在后面的
+///   execute()。
+/// - AsyncInterpreter存在期间不能从其他线程直接使用Interpreter。
+///   析构函数会完成所有已提交的请求。
+class AsyncInterpreter {
+ public:
+  struct EvaluationResult {
+    Interpreter::CompilationResult result = Interpreter::kFailure;
+    Value value;
+  };
+
+ private:
+  using Task = llvm::unique_function<void()>;
+
+  Interpreter& interpreter_;
+
+  std::deque<Task> compile_queue_;
+  std::deque<Task> execution_queue_;
+  bool stop_compilation_ = false;
+  bool stop_execution_ = false;
+  mutable std::mutex mutex_;
+  std::condition_variable compile_cond_;
+  std::condition_variable execution_cond_;
+
+  std::thread compile_thread_;
+  std::vector<std::thread> execution_threads_;
+
+  /// execute()编译的、已经运行完毕但还没有卸载的事务。只在编译线程上访问。
+  std::vector<Transaction*> finished_executions_;
+
+  /// 在编译线程上卸载finished_executions_中可以卸载的事务。
+  /// 只包含顶层声明的事务不会被之后的输入引用，直接卸载；包含模板实例化
+  /// 等声明的事务可能被之后的输入使用，只在它是最后一个事务时卸载。
+  void unloadFinishedExecutions();
+
+  void enqueueCompilation(Task task);
+  void enqueueExecution(Task task);
+  void runQueue(std::deque<Task>& queue, std::condition_variable& cond,
+                const bool& stop);
+
+ public:
+  ///\param[in] interpreter - 被包装的解释器。
+  ///\param[in] execution_threads - 运行execute()的线程数，
+  ///   0表示使用硬件线程数。
+  AsyncInterpreter(Interpreter& interpreter, unsigned execution_threads = 0);
+  ~AsyncInterpreter();
+
+  std::future<Interpreter::CompilationResult> declare(std::string input);
+
+  std::future<EvaluationResult> process(std::string input);
+
+  std::future<EvaluationResult> evaluate(std::string input);
+
+  /// 编译并运行一段没有结果的语句。
+  std::future<Interpreter::CompilationResult> execute(std::string input);
+
+  /// 在编译线程上以独占方式对解释器调用fn。
+  template <typename FnT>
+  auto post(FnT&& fn)
+      -> std::future<std::invoke_result_t<FnT&, Interpreter&>> {
+    using ResultT = std::invoke_result_t<FnT&, Interpreter&>;
+    std::promise<ResultT> promise;
+    std::future<ResultT> future = promise.get_future();
+    enqueueCompilation([this, fn = std::forward<FnT>(fn),
+                        promise = std::move(promise)]() mutable {
+      try {
+        if constexpr (std::is_void_v<ResultT>) {
+          fn(interpreter_);
+          promise.set_value();
+        } else {
+          promise.set_value(fn(interpreter_));
+        }
+      } catch (...) {
+        promise.set_exception(std::current_exception());
+      }
+    });
+    return future;
+  }
+
+  /// 等待编译的请求数。
+  size_t getNumPendingCompilations() const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_ASYNC_INTERPRETER_H
@@ -0,0 +1,85 @@
+#ifndef CPPINTERP_INTERPRETER_EXPRESSION_CACHE_H
+#define CPPINTERP_INTERPRETER_EXPRESSION_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace clang {
+class FunctionDecl;
+}  // namespace clang
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace cppinterp {
+
+/// 表达式结果缓存：把规范化的表达式映射到已经JIT的包装函数，
+/// 重复的表达式只需要通过Interpreter::RunFunction()重新运行包装函数，
+/// 不再解析和编译。
+///
+/// 条目属于一个纪元(epoch)，纪元是缓存之外最近一个事务的ID。每次查询前
+/// 调用sync()传入当前最后一个事务的ID：如果它与缓存自己编译之后记录的ID
+/// 不同，说明有其他输入被编译，或者unload回滚了事务(包装函数可能已经被
+/// 卸载)，旧纪元的条目全部作废。
+///
+/// 只应该用于没有副作用的表达式：命中时包装函数被重新运行，
+/// 而不是返回上一次的值。
+class ExpressionCache {
+ public:
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t invalidations = 0;
+  };
+
+ private:
+  /// 规范化的表达式到包装函数的映射，只包含当前纪元的条目。
+  llvm::StringMap<const clang::FunctionDecl*> entries_;
+
+  /// 当前纪元。
+  unsigned epoch_ = 0;
+
+  /// 缓存最后一次编译之后的最后一个事务的ID。
+  unsigned observed_transaction_ = 0;
+
+  /// 条目数的上限，达到时清空缓存。
+  const size_t max_entries_;
+
+  Statistics stats_;
+
+ public:
+  ExpressionCache(size_t max_entries = 4096) : max_entries_(max_entries) {}
+
+  /// 去掉首尾空白和末尾的分号，把字符串和字符字面量之外的连续空白合并为
+  /// 一个空格。
+  static std::string normalize(llvm::StringRef input);
+
+  /// 根据当前最后一个事务的ID检查纪元是否改变。
+  void sync(unsigned last_transaction_id);
+
+  /// 记录缓存自己编译之后的最后一个事务的ID。
+  void setObservedTransaction(unsigned last_transaction_id) {
+    observed_transaction_ = last_transaction_id;
+  }
+
+  /// 返回表达式的包装函数，未命中时返回nullptr。
+  const clang::FunctionDecl* lookup(llvm::StringRef normalized);
+
+  void insert(llvm::StringRef normalized, const clang::FunctionDecl* wrapper);
+
+  void clear();
+
+  unsigned getEpoch() const { return epoch_; }
+  size_t size() const { return entries_.size(); }
+  Statistics getStatistics() const { return stats_; }
+
+  void dump(llvm::raw_ostream& out) const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_EXPRESSION_CACHE_H
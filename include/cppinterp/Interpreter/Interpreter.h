@@ -5,6 +5,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "cppinterp/Interpreter/InvocationOptions.h"
 #include "cppinterp/Interpreter/RuntimeOptions.h"
@@ -59,16 +60,28 @@ namespace cppinterp {
 class ClangInternalState;
 class CompilationOptions;
 class DynamicLibraryManager;
+class ExpressionCache;
 class IncrementalCUDADeviceCompiler;
 class IncrementalExecutor;
+class IncrementalJIT;
 class IncrementalParser;
 class InterpreterCallbacks;
+class LibraryIndex;
 class LookupHelper;
+class PreparedSnippet;
 class Transaction;
+class TransactionProfiler;
 class Value;
+class ValueAllocator;
+class ValuePrinterCache;
 
 /// 实现类似解释器的行为并且管理增量编译。
 class Interpreter {
+  /// SessionHost在编译锁内编译，在锁外运行包装函数。
+  friend class SessionHost;
+  /// AsyncInterpreter在执行线程上运行execute()编译的函数，之后卸载它的事务。
+  friend class AsyncInterpreter;
+
  public:
   // ignore_files_func_t接受const引用，以避免必须包含PresumedLoc的实际定义。
   using ignore_files_func_t = bool (*)(const clang::PresumedLoc&);
@@ -155,6 +168,9 @@ class Interpreter {
   /// 实现增量编译的worker类。
   std::unique_ptr<IncrementalParser> incr_parser_;
 
+  /// 运行编译的代码，拥有IncrementalJIT。-fsyntax-only模式下为nullptr。
+  std::unique_ptr<IncrementalExecutor> executor_;
+
   /// 编译的析构函数包装的缓存。
   std::unordered_map<const clang::RecordDecl*, void*> dtor_wrappers_;
 
@@ -185,6 +201,21 @@ class Interpreter {
   /// Interpreter callbacks.
   std::unique_ptr<InterpreterCallbacks> callbacks_;
 
+  /// 每次输入的编译和执行时间统计，为nullptr时不收集。
+  std::unique_ptr<TransactionProfiler> profiler_;
+
+  /// evaluateCached()使用的表达式结果缓存，为nullptr时不缓存。
+  std::unique_ptr<ExpressionCache> expr_cache_;
+
+  /// Value托管分配的内存池，第一次使用时创建。
+  std::unique_ptr<ValueAllocator> value_allocator_;
+
+  /// Value::print()使用的按类型缓存的打印函数，第一次使用时创建。
+  std::unique_ptr<ValuePrinterCache> printer_cache_;
+
+  /// 自动加载使用的共享库导出符号索引，与JIT中的生成器共享。
+  std::shared_ptr<LibraryIndex> library_index_;
+
   /// 关于通过.storeState存储的最后状态的信息
   mutable std::vector<ClangInternalState*> stored_states_;
 
@@ -194,6 +225,10 @@ class Interpreter {
   };
   mutable const Transaction* cached_transactions_[kNumTransactions] = {};
 
+  /// 通过setRollbackPoint()命名的回滚点到当时最后一个事务的唯一ID的映射，
+  /// 没有事务时为0。事务会被事务池重用，不能保存事务指针。
+  std::unordered_map<std::string, unsigned> rollback_points_;
+
   CompilationResult DeclareInternal(const std::string& input,
                                     const CompilationOptions& co,
                                     Transaction** transaction = nullptr) const;
@@ -204,6 +239,18 @@ class Interpreter {
                                      Transaction** transaction = nullptr,
                                      size_t wrap_point = 0);
 
+  /// 把indices指定的表达式放在一个事务中编译并逐个运行，
+  /// 编译失败时把它们分成两半分别重试。wrap_points是每个输入的包装起点。
+  void EvaluateBatchInternal(const std::vector<std::string>& inputs,
+                             const std::vector<size_t>& wrap_points,
+                             const std::vector<size_t>& indices,
+                             std::vector<Value>& values,
+                             std::vector<CompilationResult>& results);
+
+  /// 运行调用线程拥有、在其他线程上释放了最后一个引用的共享值的析构函数，
+  /// 在每个入口处调用，见Value::makeThreadShareable()。
+  void ReclaimDeferredValues();
+
   CompilationResult CodeCompleteInternal(const std::string& input,
                                          unsigned offset);
 
@@ -347,6 +394,41 @@ class Interpreter {
   /// 编译只包含表达式的输入行。
   CompilationResult evaluate(const std::string& input, Value& value);
 
+  /// 求值多个互相独立的表达式。
+  /// 每个表达式有自己的包装函数，但它们在同一个事务和模块中编译，
+  /// 因此只运行一次Sema/CodeGen管线、一次BackendPasses和一次JIT链接。
+  /// 一个表达式编译失败时，其他表达式仍然会被求值。
+  /// 输入按顺序生效，结果与逐个evaluate()相同：没有需要包装的部分的输入
+  /// 和包装起点之前有声明的输入会结束之前的一组，分开编译。
+  ///\param[in] inputs - 要求值的表达式。
+  ///\param[out] values - 每个表达式的值，与inputs一一对应。
+  ///\returns 每个表达式的编译结果，与inputs一一对应。
+  std::vector<CompilationResult> evaluateBatch(
+      const std::vector<std::string>& inputs, std::vector<Value>& values);
+
+  /// 与evaluate()相同，但打开表达式缓存时重复的表达式会直接重新运行
+  /// 上一次编译的包装函数。只应该用于没有副作用的表达式。
+  CompilationResult evaluateCached(const std::string& input, Value& value);
+
+  /// 打开或关闭evaluateCached()使用的表达式缓存。
+  void enableExpressionCache(bool enable = true);
+  ExpressionCache* getExpressionCache() const { return expr_cache_.get(); }
+
+  /// 返回Value托管分配的内存池，其中包括存活的值和字节数的统计。
+  ValueAllocator& getValueAllocator();
+
+  /// 返回Value::print()使用的打印函数缓存，可以在其中设置输出的上限。
+  ValuePrinterCache& getValuePrinterCache();
+
+  /// 把一段带参数的代码编译为可以反复调用的函数，调用时不再解析代码。
+  ///\param[in] params - 参数列表，例如"int a, const std::string& s"。
+  ///\param[in] body - 函数体，通过return返回结果。
+  ///\param[in] result_type - 返回类型，不能是引用类型。
+  ///\returns 编译失败时返回nullptr。
+  std::unique_ptr<PreparedSnippet> prepare(
+      llvm::StringRef params, llvm::StringRef body,
+      llvm::StringRef result_type = "void");
+
   /// 编译输入行，其中只包含表达式和打印输出执行结果。
   CompilationResult echo(const std::string& input, Value* value = nullptr);
 
@@ -381,6 +463,23 @@ class Interpreter {
   void runAndRemoveStaticDestructors();
   void runAndRemoveStaticDestructors(unsigned number_of_transaction);
 
+  /// 把当前最后一个事务记录为名为name的回滚点，覆盖同名的回滚点。
+  void setRollbackPoint(llvm::StringRef name);
+  bool hasRollbackPoint(llvm::StringRef name) const {
+    return rollback_points_.count(name.str());
+  }
+
+  /// 一次卸载回滚点之后的所有事务，代价与被卸载的事务成正比：
+  /// 运行它们(包括嵌套事务)的静态析构函数，通过一次ORC调用移除它们的模块，
+  /// 在一次遍历中从AST中移除它们的顶层声明，按相反的顺序撤销它们的宏指令，
+  /// 然后把它们从事务列表中删除。
+  /// 引用被卸载代码的缓存被清空，指向被卸载事务的回滚点被删除。
+  ///
+  /// 如果被卸载的声明重新声明了回滚点之前的声明(例如重新打开的命名空间
+  /// 或者前置声明的定义)，或者被卸载的事务包含隐式实例化，什么也不做并返回
+  /// kFailure，此时应该使用unload()逐个卸载事务。
+  CompilationResult rollbackTo(llvm::StringRef name);
+
   bool isPrintingDebug() const { return print_debug_; }
   void enablePrintDebug(bool print = true) { print_debug_ = print; }
 
@@ -412,12 +511,26 @@ class Interpreter {
   /// 注册一个DefinitionGenerator来动态地为进程中不可用的生成代码提供符号。
   void addGenerator(std::unique_ptr<llvm::orc::DefinitionGenerator> dg);
 
+  /// 打开(必要时构建)LibSearchPath和系统库路径上的共享库导出符号的索引，
+  /// 之后JIT无法解析的符号会自动加载定义它的库，见LibraryIndex。
+  /// 没有打开UseLibraryIndex选项或者索引无法建立时返回false。
+  bool enableLibraryAutoload();
+  const LibraryIndex* getLibraryIndex() const { return library_index_.get(); }
+
   ExecutionResult executeTransaction(Transaction& transaction);
 
   /// 在给定的声明上下文中计算给定的表达式
   Value Evaluate(const char* expr, clang::DeclContext* dc,
                  bool value_printer_req = false);
 
+  /// 打开或关闭每次输入的编译和执行时间统计，关闭时丢弃已有的记录。
+  void enableProfiling(bool enable = true);
+  bool isProfiling() const { return profiler_ != nullptr; }
+
+  /// 返回统计数据，没有打开统计时返回nullptr。
+  const TransactionProfiler* getProfiler() const { return profiler_.get(); }
+  TransactionProfiler* getProfiler() { return profiler_.get(); }
+
   /// 解释器回调访问器。
   void setCallbacks(std::unique_ptr<InterpreterCallbacks> C);
   const InterpreterCallbacks* getCallbacks() const { return callbacks_.get(); }
@@ -0,0 +1,78 @@
+#ifndef CPPINTERP_INTERPRETER_INTERPRETER_CHECKPOINT_H
+#define CPPINTERP_INTERPRETER_INTERPRETER_CHECKPOINT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cppinterp/Interpreter/StartupSnapshot.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+namespace clang {
+class CompilerInstance;
+class CompilerInvocation;
+}  // namespace clang
+
+namespace cppinterp {
+
+class IncrementalJIT;
+class Transaction;
+
+/// 解释器状态的检查点：AST(PCH)加上每个已提交事务的目标文件。
+///
+/// 保存：在第一个事务之前调用IncrementalJIT::setRecordObjects(true)，
+/// 在没有未完成事务的时候调用Save()。检查点目录包含：
+/// - ast.pch和ast.deps：由StartupSnapshot写入的AST；
+/// - <n>.o：按编译顺序排列的目标文件；
+/// - manifest：格式版本、目标三元组，以及每个目标文件及其静态初始化函数。
+///   manifest最后写入，它存在时检查点才完整。
+///
+/// 恢复：Load()之后，如果isUsable()为真，在创建CompilerInstance之前调用
+/// applyTo()加载AST，创建IncrementalJIT之后调用restore()。目标文件以只读
+/// 内存映射的方式加入JIT，不再重新解析和编译；它们的静态初始化函数按原来的
+/// 顺序运行一次，因此全局变量回到初始化之后的状态，而包装函数(语句和表达式)
+/// 的副作用不会被重放。
+class InterpreterCheckpoint {
+  struct ObjectEntry {
+    std::string file;
+    std::vector<std::string> ctors;
+  };
+
+  std::string dir_;
+  StartupSnapshot ast_;
+  std::string triple_;
+  std::vector<ObjectEntry> objects_;
+
+ public:
+  InterpreterCheckpoint(llvm::StringRef dir);
+
+  /// 把当前状态写入dir，覆盖其中已有的检查点。
+  ///\param[in] dir - 检查点目录，不存在时会被创建。
+  ///\param[in] CI - 解释器的CompilerInstance。
+  ///\param[in] first - 事务链中的第一个事务。
+  ///\param[in] jit - 编译这些事务的JIT，必须开启了目标文件记录。
+  static llvm::Error Save(llvm::StringRef dir, clang::CompilerInstance& CI,
+                          const Transaction* first, const IncrementalJIT& jit);
+
+  /// 读取dir中的检查点。
+  static llvm::Expected<std::unique_ptr<InterpreterCheckpoint>> Load(
+      llvm::StringRef dir);
+
+  /// AST依赖的文件是否都没有改变。
+  bool isUsable() const { return ast_.isUsable(); }
+
+  /// 让invocation在创建CompilerInstance时加载检查点的AST。
+  void applyTo(clang::CompilerInvocation& invocation) const {
+    ast_.applyTo(invocation);
+  }
+
+  /// 把目标文件加入jit并运行它们的静态初始化函数。
+  llvm::Error restore(IncrementalJIT& jit) const;
+
+  size_t getNumObjects() const { return objects_.size(); }
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_INTERPRETER_CHECKPOINT_H
@@ -1,6 +1,7 @@
 #ifndef CPPINTERP_INTERPRETER_INVOCATION_OPTIONS_H
 #define CPPINTERP_INTERPRETER_INVOCATION_OPTIONS_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -39,6 +40,17 @@ class CompilerOptions {
   /// The output path of any C++ PCMs we're building on demand.
   /// Equal to ModuleCachePath in the HeaderSearchOptions.
   std::string CachePath;
+  /// Size bound in bytes of the on-disk object cache, kept in the "objects"
+  /// subdirectory of CachePath. 0 disables the object cache.
+  uint64_t ObjectCacheSize = 0;
+  /// Whether to save the post-initialization AST as a PCH in the "startup"
+  /// subdirectory of CachePath and load it on later starts (see
+  /// StartupSnapshot for the invalidation rules).
+  bool UseStartupSnapshot = false;
+  /// Whether to index the exported symbols of the libraries on LibSearchPath
+  /// in the "libraries" subdirectory of CachePath and auto-load the library
+  /// defining a symbol the JIT cannot resolve (see LibraryIndex).
+  bool UseLibraryIndex = false;
   // If not empty, the name of the module we're currently compiling.
   std::string ModuleName;
   /// Custom path of the CUDA toolkit
@@ -69,6 +81,22 @@ class InvocationOptions {
   unsigned Help : 1;
   unsigned NoRuntime : 1;
   unsigned PtrCheck : 1;  /// Enable NullDerefProtectionTransformer
+
+  /// 传给IncrementalJIT的ORC编译线程数。
+  /// 0表示在调用线程上编译；否则独立事务的模块会在线程池上并发编译。
+  unsigned CompileThreads = 0;
+
+  /// 是否按需编译：只有包装函数被立即编译，其他函数在第一次调用时编译。
+  bool LazyCompilation = false;
+
+  /// 分层编译：函数先以O0编译，调用次数达到该阈值后在后台以TierUpOptLevel
+  /// 重新编译。0表示关闭分层编译。
+  unsigned TierUpThreshold = 0;
+  int TierUpOptLevel = 2;
+
+  /// 模块编译为目标代码之后是否释放它的IR，传给IncrementalJIT::setReleaseIR()。
+  bool ReleaseIRAfterJIT = false;
+
   bool Verbose() const { return CompilerOpts.Verbose; }
 
   static void PrintHelp();
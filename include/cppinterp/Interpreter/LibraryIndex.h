@@ -0,0 +1,95 @@
+#ifndef CPPINTERP_INTERPRETER_LIBRARY_INDEX_H
+#define CPPINTERP_INTERPRETER_LIBRARY_INDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class MemoryBuffer;
+namespace orc {
+class DefinitionGenerator;
+}  // namespace orc
+}  // namespace llvm
+
+namespace cppinterp {
+
+class CompilerOptions;
+
+/// 搜索路径上所有共享库导出的符号的磁盘索引，用于自动加载：
+/// JIT遇到未解析的符号时直接找到定义它的库，不需要逐个尝试加载。
+///
+/// build()扫描每个搜索目录中的ELF共享库(文件名含有".so"，与宿主架构相同，
+/// 通过符号链接重复出现的文件只索引一次)，把它们.dynsym中定义的全局符号
+/// 写入<CachePath>/libraries/<key>.idx。弱符号(主要是模板和内联函数的
+/// 实例)不被索引：它们出现在很多库中，不能用来决定加载哪个库。
+/// 同一个符号由多个库定义时，查找返回搜索顺序中的第一个。
+///
+/// 索引是一个按符号名哈希分桶的定长表，open()以只读内存映射的方式打开它，
+/// 查找不需要反序列化，代价是一次哈希和桶内的几次比较。
+///
+/// 失效规则：
+/// - 键由索引格式版本和搜索路径列表计算，改变搜索路径会使用另一个文件。
+/// - 索引记录了每个目录的修改时间以及每个库的大小和修改时间。
+///   目录中增删文件或者库被替换时open()返回false，调用者应该调用build()。
+/// - 索引先写入临时文件再重命名，多个进程同时构建不会读到不完整的文件。
+class LibraryIndex {
+  /// 索引文件的路径。
+  std::string path_;
+
+  /// 按顺序扫描的目录。
+  std::vector<std::string> search_paths_;
+
+  /// 映射的索引文件，未打开时为nullptr。
+  std::unique_ptr<llvm::MemoryBuffer> buffer_;
+
+  /// 检查索引文件的格式，以及它记录的目录和库是否都没有改变。
+  bool isValid(const llvm::MemoryBuffer& buffer) const;
+
+ public:
+  /// 根据编译选项创建索引。CachePath为空、没有打开UseLibraryIndex选项或者
+  /// 目录无法创建时返回nullptr。
+  static std::unique_ptr<LibraryIndex> Create(
+      const CompilerOptions& opts, llvm::ArrayRef<std::string> search_paths);
+
+  LibraryIndex(llvm::StringRef path, llvm::ArrayRef<std::string> search_paths);
+  ~LibraryIndex();
+
+  LibraryIndex(const LibraryIndex&) = delete;
+  LibraryIndex& operator=(const LibraryIndex&) = delete;
+
+  static std::string computeKey(llvm::ArrayRef<std::string> search_paths);
+
+  const std::string& getPath() const { return path_; }
+
+  /// 映射索引文件。文件不存在、格式不对或者已经过期时返回false。
+  bool open();
+
+  /// 扫描搜索路径，写入索引文件并映射它。
+  ///\returns 成功时返回true。
+  bool build();
+
+  /// 先尝试open()，失败时调用build()。
+  bool openOrBuild() { return open() || build(); }
+
+  bool isOpen() const { return buffer_ != nullptr; }
+
+  /// 返回定义name(链接器名称)的库的路径，索引中没有时返回空字符串。
+  llvm::StringRef lookup(llvm::StringRef name) const;
+
+  size_t getNumLibraries() const;
+  size_t getNumSymbols() const;
+
+  /// 返回一个DefinitionGenerator：JIT查找不到的符号如果在索引中，
+  /// 就加载定义它的库(RTLD_GLOBAL)并通过dlsym提供它的地址。
+  static std::unique_ptr<llvm::orc::DefinitionGenerator> createGenerator(
+      std::shared_ptr<const LibraryIndex> index);
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_LIBRARY_INDEX_H
@@ -0,0 +1,172 @@
+#ifndef CPPINTERP_INTERPRETER_PREPARED_SNIPPET_H
+#define CPPINTERP_INTERPRETER_PREPARED_SNIPPET_H
+
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include "cppinterp/Interpreter/Value.h"
+#include "llvm/Support/Error.h"
+
+namespace cppinterp {
+
+class Interpreter;
+
+/// C++类型(去掉引用和cv限定之后)对应的Value::TypeKind，与Value对clang类型的
+/// 映射一致：枚举按其底层类型，指针和类类型为kPtrOrObjTy。
+template <typename T, typename Enable = void>
+struct SnippetTypeKind {
+  static constexpr Value::TypeKind value =
+      std::is_void<T>::value ? Value::kVoid : Value::kPtrOrObjTy;
+};
+
+template <typename T>
+struct SnippetTypeKind<T, std::enable_if_t<std::is_enum<T>::value>>
+    : SnippetTypeKind<std::underlying_type_t<T>> {};
+
+#define X(type, name)                                        \
+  template <>                                                \
+  struct SnippetTypeKind<type> {                             \
+    static constexpr Value::TypeKind value = Value::k##name; \
+  };
+CPPINTERP_VALUE_BUILTIN_TYPES
+#undef X
+
+/// 编译一次、可以用不同参数反复调用的代码片段，由Interpreter::prepare()创建。
+///
+/// 片段被编译为一个带有声明的参数的函数，以及一个extern "C"的跳板
+/// void(void** args, void* result)：args[i]指向第i个参数的对象，
+/// result指向足够存放返回值的未初始化存储，跳板在其中构造返回值。
+/// 调用时不再解析任何代码。
+///
+/// 片段引用的事务被卸载之后不能再调用它。
+class PreparedSnippet {
+ public:
+  using ThunkT = void (*)(void** args, void* result);
+
+  /// 类型化调用的结果：返回void时是llvm::Error，否则是llvm::Expected<R>。
+  template <typename R>
+  using InvokeResultT = std::conditional_t<std::is_void<R>::value,
+                                           llvm::Error, llvm::Expected<R>>;
+
+ private:
+  Interpreter& interpreter_;
+  ThunkT thunk_;
+
+  /// 参数和返回值的规范化clang::QualType(不透明指针)。
+  std::vector<void*> param_types_;
+  void* result_type_;
+
+  /// 参数(去掉引用之后)和返回值的类型对应的Value::TypeKind，在构造时计算，
+  /// 用于检查类型化调用。没有对应TypeKind的内置类型(例如__int128)为kInvalid，
+  /// 这样的片段只能通过invokeRaw()或Value调用。
+  std::vector<Value::TypeKind> param_kinds_;
+  Value::TypeKind result_kind_;
+
+  /// 参数和返回值(去掉引用和顶层cv限定之后)的typeid(T).name()，即去掉
+  /// _ZTS前缀的Itanium RTTI名字，由Interpreter::prepare()计算。
+  /// 指针和类类型按它比较。
+  std::vector<std::string> param_type_names_;
+  std::string result_type_name_;
+
+  template <typename T>
+  static constexpr Value::TypeKind kindOf() {
+    return SnippetTypeKind<
+        std::remove_cv_t<std::remove_reference_t<T>>>::value;
+  }
+
+  /// C++类型T是否与TypeKind为kind、typeid名字为type_name的片段类型相符。
+  template <typename T>
+  static bool matches(Value::TypeKind kind, const std::string& type_name) {
+    if (kind != kindOf<T>()) {
+      return false;
+    }
+    return kind != Value::kPtrOrObjTy ||
+           type_name ==
+               typeid(std::remove_cv_t<std::remove_reference_t<T>>).name();
+  }
+
+  template <typename... ArgsT>
+  bool checkArgs(std::index_sequence<>) const {
+    return true;
+  }
+
+  template <typename ArgT, typename... RestT, size_t I, size_t... Is>
+  bool checkArgs(std::index_sequence<I, Is...>) const {
+    return matches<ArgT>(param_kinds_[I], param_type_names_[I]) &&
+           checkArgs<RestT...>(std::index_sequence<Is...>());
+  }
+
+ public:
+  PreparedSnippet(Interpreter& interpreter, ThunkT thunk,
+                  std::vector<void*> param_types, void* result_type,
+                  std::vector<std::string> param_type_names,
+                  std::string result_type_name);
+
+  size_t getNumParams() const { return param_types_.size(); }
+  ThunkT getThunk() const { return thunk_; }
+
+  /// 检查调用的参数个数以及参数和返回值的类型是否与声明的签名一致。
+  /// 内置类型和枚举按Value::TypeKind比较，不做任何转换：例如int不能传给
+  /// float参数，int64_t(long)也不能传给long long参数。
+  /// 指针和类类型按typeid名字比较，例如std::string不能接收另一个同样大小的
+  /// 类的返回值。
+  template <typename R, typename... ArgsT>
+  bool checkSignature() const {
+    if (sizeof...(ArgsT) != param_kinds_.size()) {
+      return false;
+    }
+    if (!matches<R>(result_kind_, result_type_name_)) {
+      return false;
+    }
+    return checkArgs<ArgsT...>(std::index_sequence_for<ArgsT...>());
+  }
+
+  /// 直接调用跳板，调用者负责参数和返回值的类型。
+  void invokeRaw(void** args, void* result) const { thunk_(args, result); }
+
+  /// 类型化调用：参数按引用传给片段，返回值以R返回。
+  /// 签名与checkSignature()不一致时不调用片段，返回错误。
+  template <typename R = void, typename... ArgsT>
+  InvokeResultT<R> invoke(ArgsT&&... args) const {
+    if (!checkSignature<R, ArgsT...>()) {
+      return llvm::createStringError(
+          llvm::inconvertibleErrorCode(),
+          "prepared snippet invoked with a mismatching signature");
+    }
+    void* arg_ptrs[] = {
+        const_cast<void*>(static_cast<const void*>(std::addressof(args)))...,
+        nullptr};
+    return invokeImpl<R>(arg_ptrs, std::is_void<R>());
+  }
+
+  /// 以Value传递参数和返回值。参数的类型(忽略引用和cv限定)必须与声明的
+  /// 参数类型相同。
+  ///\returns 参数个数或类型不匹配时返回false，此时result不变。
+  bool invoke(const std::vector<Value>& args, Value& result) const;
+
+ private:
+  template <typename R>
+  InvokeResultT<R> invokeImpl(void** args, std::true_type /*is_void*/) const {
+    thunk_(args, nullptr);
+    return llvm::Error::success();
+  }
+
+  template <typename R>
+  InvokeResultT<R> invokeImpl(void** args, std::false_type /*is_void*/) const {
+    alignas(R) unsigned char storage[sizeof(R)];
+    thunk_(args, storage);
+    R* ret = std::launder(reinterpret_cast<R*>(storage));
+    R result = std::move(*ret);
+    ret->~R();
+    return std::move(result);
+  }
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_PREPARED_SNIPPET_H
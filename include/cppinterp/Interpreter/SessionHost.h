@@ -0,0 +1,122 @@
+#ifndef CPPINTERP_INTERPRETER_SESSION_HOST_H
+#define CPPINTERP_INTERPRETER_SESSION_HOST_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cppinterp/Interpreter/Interpreter.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace cppinterp {
+
+class Value;
+
+/// 在一个进程中管理同一个基础解释器的多个子解释器会话，
+/// 让不同的会话可以在不同的线程上使用。
+///
+/// 每个会话是通过子解释器构造函数创建的普通子解释器，拥有自己的
+/// CompilerInstance、LLVMContext和IncrementalJIT。基础解释器初始化之后的
+/// AST通过子解释器的外部AST源按需读取，已经JIT的运行时符号通过基础解释器的
+/// 符号生成器解析，共享库索引(见LibraryIndex)被所有会话直接使用；
+/// 除此之外没有共享的状态。因此每个会话的内存占用和创建代价与单独的
+/// 子解释器相同，SessionHost只提供会话的管理和跨线程使用时需要的加锁。
+///
+/// 线程模型：
+/// - 同一个会话一次只能被一个线程使用，Session的方法会等待。
+/// - 子解释器编译时会惰性地读取并修改基础解释器的AST查找表，
+///   因此所有会话的编译在SharedState::compile_mutex上串行化。
+///   process()只在编译期间持有这个锁，包装函数在锁外运行，
+///   不同会话的代码可以并发执行。结果的析构函数调用在释放锁之前被
+///   预先编译。compileFunction()返回的函数可以在
+///   不持有任何锁的情况下从任意线程并发调用。
+/// - 创建SessionHost之后，基础解释器不能再被直接使用。
+/// - 会话和SessionHost通过shared_ptr共享基础解释器和编译锁，
+///   会话可以比SessionHost活得更久；基础解释器在最后一个会话和
+///   SessionHost都释放之后才被销毁。
+class SessionHost {
+ public:
+  using SessionID = unsigned;
+
+  /// 会话和SessionHost共享的状态。
+  struct SharedState {
+    std::shared_ptr<const Interpreter> base;
+
+    /// 串行化所有读写基础解释器AST的操作。
+    std::mutex compile_mutex;
+  };
+
+  class Session {
+    friend class SessionHost;
+
+    /// 在interpreter_之前声明，保证子解释器先于基础解释器销毁。
+    const std::shared_ptr<SharedState> state_;
+    const SessionID id_;
+    std::unique_ptr<Interpreter> interpreter_;
+    std::mutex mutex_;
+
+   public:
+    Session(std::shared_ptr<SharedState> state, SessionID id,
+            std::unique_ptr<Interpreter> interpreter);
+    ~Session();
+
+    SessionID getID() const { return id_; }
+
+    /// 与Interpreter::process()相同，但只在编译期间持有编译锁。
+    /// 会话不打印结果，需要打印时通过withInterpreter()调用Value::print()。
+    /// 需要析构的结果在析构时会编译析构函数的调用，应该在withInterpreter()
+    /// 中释放。
+    Interpreter::CompilationResult process(const std::string& input,
+                                           Value* value = nullptr);
+
+    Interpreter::CompilationResult declare(const std::string& input);
+
+    /// 编译extern "C"函数并返回其地址，失败时返回nullptr。
+    void* compileFunction(llvm::StringRef name, llvm::StringRef code);
+
+    /// 在持有会话锁和编译锁的情况下访问子解释器。
+    /// fn中执行的代码也持有编译锁，长时间运行的代码应该使用process()。
+    template <typename FnT>
+    auto withInterpreter(FnT&& fn) -> decltype(fn(*interpreter_)) {
+      std::lock_guard<std::mutex> session_lock(mutex_);
+      std::lock_guard<std::mutex> compile_lock(state_->compile_mutex);
+      return fn(*interpreter_);
+    }
+  };
+
+ private:
+  std::shared_ptr<SharedState> state_;
+
+  /// 创建子解释器时使用的命令行参数。
+  std::vector<std::string> args_;
+
+  std::map<SessionID, std::shared_ptr<Session>> sessions_;
+  mutable std::mutex sessions_mutex_;
+  std::atomic<SessionID> next_id_{1};
+
+ public:
+  ///\param[in] base - 已经初始化的基础解释器。
+  ///\param[in] args - 子解释器的命令行参数，第一个元素是程序名。
+  SessionHost(std::shared_ptr<const Interpreter> base,
+              std::vector<std::string> args);
+  ~SessionHost();
+
+  /// 创建一个新会话，失败时返回nullptr。
+  std::shared_ptr<Session> createSession();
+
+  /// 返回给定ID的会话，不存在时返回nullptr。
+  std::shared_ptr<Session> getSession(SessionID id) const;
+
+  /// 关闭会话。正在使用会话的线程持有的引用仍然有效，
+  /// 子解释器在最后一个引用释放时销毁。
+  bool closeSession(SessionID id);
+
+  size_t getNumSessions() const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_SESSION_HOST_H
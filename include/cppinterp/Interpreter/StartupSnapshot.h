@@ -0,0 +1,84 @@
+#ifndef CPPINTERP_INTERPRETER_STARTUP_SNAPSHOT_H
+#define CPPINTERP_INTERPRETER_STARTUP_SNAPSHOT_H
+
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace clang {
+class CompilerInstance;
+class CompilerInvocation;
+}  // namespace clang
+
+namespace cppinterp {
+
+class CompilerOptions;
+
+/// 初始化之后的AST快照(PCH)，用于跳过运行时前导代码和用户头文件的解析。
+///
+/// 第一次启动时，Interpreter::Initialize完成后调用write()把AST写入
+/// <CachePath>/startup/<key>.pch，并在<key>.deps中记录初始化期间读取的
+/// 每个文件的路径、大小和修改时间。之后的启动如果isUsable()为真，
+/// 就在创建CompilerInstance之前调用applyTo()把快照作为隐式PCH加载，
+/// 并跳过前导代码的解析。clang通过FileManager以只读内存映射的方式打开PCH，
+/// 多个进程共享同一份物理页。
+///
+/// 失效规则：
+/// - 键由快照格式版本、clang版本、目标三元组、CompilerOptions中影响
+///   语言的标志、传给clang的其余参数、头文件搜索路径(用户路径、
+///   系统前缀、sysroot和资源目录)以及是否加载运行时计算。
+///   其中任何一项改变都会使用另一个文件，旧快照保留给其他配置使用。
+/// - 初始化期间读取的任何文件被删除，或者大小、修改时间改变，
+///   isUsable()返回假，调用者应该重新初始化并调用write()覆盖旧快照。
+/// - 只在初始化没有错误时写入快照。
+/// - 如果clang加载PCH失败(文件损坏或clang自身的校验失败)，
+///   调用者应该调用invalidate()删除快照，然后不使用快照重新启动。
+/// - 快照先写入临时文件再重命名，同时启动的多个进程不会读到不完整的文件；
+///   它们写入的内容相同，最后一次重命名生效。
+class StartupSnapshot {
+  /// 快照所在的目录。
+  std::string dir_;
+
+  /// 快照的键，文件名由它得出。
+  std::string key_;
+
+  std::string getDepsPath() const;
+
+ public:
+  /// 根据编译选项创建快照。
+  /// CachePath为空或者没有打开StartupSnapshot选项时返回nullptr。
+  ///\param[in] opts - 解释器的编译选项。
+  ///\param[in] invocation - 将要用来创建CompilerInstance的调用，
+  ///   从中读取头文件搜索路径和目标三元组。
+  ///\param[in] no_runtime - 是否跳过了运行时前导代码。
+  static std::unique_ptr<StartupSnapshot> Create(
+      const CompilerOptions& opts, const clang::CompilerInvocation& invocation,
+      bool no_runtime);
+
+  StartupSnapshot(llvm::StringRef dir, llvm::StringRef key);
+
+  static std::string computeKey(const CompilerOptions& opts,
+                                const clang::CompilerInvocation& invocation,
+                                bool no_runtime);
+
+  const std::string& getKey() const { return key_; }
+  std::string getPCHPath() const;
+
+  /// 快照是否存在，并且它依赖的文件都没有改变。
+  bool isUsable() const;
+
+  /// 让invocation在创建CompilerInstance时加载快照。
+  void applyTo(clang::CompilerInvocation& invocation) const;
+
+  /// 把CI当前的AST写入快照。
+  ///\returns 成功时返回true。
+  bool write(clang::CompilerInstance& CI) const;
+
+  /// 删除快照。
+  void invalidate() const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_STARTUP_SNAPSHOT_H
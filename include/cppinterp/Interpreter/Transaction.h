@@ -8,6 +8,7 @@
 #include "cppinterp/Interpreter/CompilationOptions.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/Module.h"
 
 namespace clang {
@@ -132,6 +133,10 @@ class Transaction {
   /// 如果DefinitionShadower是启用的，'__cppinterp_N5xxx'命名空间将嵌套全局定义(如果有的话)。
   clang::NamespaceDecl* definition_shadow_ns_ = nullptr;
 
+  /// module_所在的context。并发编译时每个模块拥有独立的context，
+  /// 必须声明在module_之前，保证module_先被销毁。
+  llvm::orc::ThreadSafeContext module_context_;
+
   /// llvm模块包含我们将要恢复的信息。
   std::unique_ptr<llvm::Module> module_;
 
@@ -150,6 +155,9 @@ class Transaction {
   /// 下一个事务。
   const Transaction* next_;
 
+  /// 事务的唯一ID，每次(重新)初始化时递增分配，从不为0。
+  unsigned unique_id_;
+
   /// 保存ASTContext和Preprocessor的Sema。
   clang::Sema& sema_;
 
@@ -414,6 +422,13 @@ class Transaction {
     module_ = std::move(module);
   }
 
+  const llvm::orc::ThreadSafeContext& getModuleContext() const {
+    return module_context_;
+  }
+  void setModuleContext(llvm::orc::ThreadSafeContext context) {
+    module_context_ = std::move(context);
+  }
+
   const llvm::Module* getCompiledModule() const { return compiled_module_; }
 
   IncrementalExecutor* getExecutor() const { return exe_; }
@@ -429,7 +444,7 @@ class Transaction {
 
   /// 事务可以被重用，并且事务指针不能作为事务的唯一句柄。
   /// 客户端使用唯一句柄来检查解释器是否看到了更多输入。
-  unsigned getUniqueID() const;
+  unsigned getUniqueID() const { return unique_id_; }
 
   /// 擦除给定位置的元素。
   void erase(iterator pos);
@@ -0,0 +1,99 @@
+#ifndef CPPINTERP_INTERPRETER_TRANSACTION_POOL_H
+#define CPPINTERP_INTERPRETER_TRANSACTION_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+
+namespace clang {
+class Sema;
+}  // namespace clang
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace cppinterp {
+
+class CompilationOptions;
+class Transaction;
+
+/// 可重用的块分配事务池，由IncrementalParser创建和释放事务。
+///
+/// 事务的存储按slab分配，每个slab容纳的事务数取自观察到的同时存活的
+/// 事务数的峰值。释放的事务不被析构，而是清空后放入空闲列表，
+/// 它的声明队列保留已经增长的缓冲区，下一个事务可以直接使用。
+/// 缓冲区远大于观察到的队列长度分布(90%分位数)时被释放，避免一个巨大的
+/// 输入让池一直持有大量内存。
+///
+/// 嵌套事务同样来自池：释放父事务时它们也被放回池中。
+/// 所有事务必须在池销毁之前释放。
+class TransactionPool {
+ public:
+  struct Statistics {
+    /// takeTransaction()的次数，以及其中重用空闲事务的次数。
+    uint64_t requests = 0;
+    uint64_t hits = 0;
+    /// 分配的slab个数和其中的事务个数。
+    uint64_t slabs = 0;
+    uint64_t slab_transactions = 0;
+    /// 因为过大而被释放的声明队列缓冲区个数。
+    uint64_t trimmed_buffers = 0;
+    /// 当前和峰值存活的事务数。
+    uint64_t live = 0;
+    uint64_t peak_live = 0;
+
+    double getHitRate() const {
+      return requests ? static_cast<double>(hits) / requests : 0.0;
+    }
+  };
+
+ private:
+  /// 每个slab容纳的事务数的范围。
+  static constexpr size_t kMinSlabTransactions = 4;
+  static constexpr size_t kMaxSlabTransactions = 64;
+  /// 声明队列长度的直方图，第i个桶统计长度的位宽为i的队列。
+  static constexpr unsigned kNumBuckets = 32;
+
+  clang::Sema& sema_;
+
+  llvm::BumpPtrAllocator slabs_;
+
+  /// 已经构造、等待重用的事务。
+  llvm::SmallVector<Transaction*, 16> free_;
+
+  /// slab中还没有构造事务的存储。
+  llvm::SmallVector<void*, 16> storage_;
+
+  uint64_t queue_histogram_[kNumBuckets] = {};
+  uint64_t queue_samples_ = 0;
+
+  Statistics stats_;
+
+  void refill();
+
+  /// 观察到的声明队列长度的90%分位数(向上取整到2的幂)。
+  size_t getTypicalQueueSize() const;
+
+ public:
+  explicit TransactionPool(clang::Sema& sema) : sema_(sema) {}
+  ~TransactionPool();
+
+  TransactionPool(const TransactionPool&) = delete;
+  TransactionPool& operator=(const TransactionPool&) = delete;
+
+  Transaction* takeTransaction(const CompilationOptions& opts);
+
+  /// 把事务放回池中。reuse为false时事务被析构，只有存储被重用。
+  void releaseTransaction(Transaction* transaction, bool reuse = true);
+
+  Statistics getStatistics() const { return stats_; }
+
+  void dump(llvm::raw_ostream& out) const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_TRANSACTION_POOL_H
@@ -0,0 +1,145 @@
+#ifndef CPPINTERP_INTERPRETER_TRANSACTION_PROFILER_H
+#define CPPINTERP_INTERPRETER_TRANSACTION_PROFILER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace cppinterp {
+
+class Transaction;
+
+/// 记录每次输入在编译和执行各阶段所花费的时间。
+///
+/// 一次Interpreter的公开调用(evaluateBatch()、evaluateCached()、prepare()、
+/// rollbackTo())对应一条记录，由ScopedRecord开启和结束。
+/// 各阶段由PhaseRAII计时。阶段可以嵌套，记录中保存阶段树：同一路径上的阶段
+/// 合并为一个节点，例如惰性编译时"execution > jit-link"是第一次调用函数时
+/// 的编译。每个节点记录包括和不包括嵌套阶段的时间；phase_ns按阶段汇总不包括
+/// 嵌套阶段的时间，因此各阶段的时间之和不超过记录的总时间。
+/// 当前记录保存在thread_local变量中，没有开启记录时PhaseRAII不做任何事。
+///
+/// 并发编译时模块在ORC的编译线程上编译，那里没有当前记录；解释器线程
+/// 等待编译完成的时间计入它当时所在的阶段(jit-link或execution)。
+class TransactionProfiler {
+ public:
+  enum Phase {
+    /// 交给IncrementalParser的编译。它的自身时间是下面的嵌套阶段没有覆盖的
+    /// 部分：包装输入、事务的开始和提交等。
+    kCompile,
+    /// IncrementalParser::ParseInternal中的词法和语法分析。clang的语法分析
+    /// 会随时调用Sema，这部分时间计入parse。
+    kParse,
+    /// 输入结束之后的语义分析：ParseInternal中的延迟模板实例化和
+    /// ActOnEndOfTranslationUnitFragment。
+    kSema,
+    /// 把事务的声明交给clang CodeGen生成IR：
+    /// IncrementalParser::codeGenTransaction。
+    kCodeGen,
+    /// ASTTransformer::Transform。
+    kTransformers,
+    /// BackendPasses::runOnModule。
+    kBackendPasses,
+    /// IncrementalJIT生成机器码并链接。
+    kJITLink,
+    /// IncrementalJIT::runCtors运行静态初始化函数。
+    kStaticInit,
+    /// 运行包装函数或者缓存的编译结果。
+    kExecution,
+    kNumPhases
+  };
+
+  static const char* getPhaseName(Phase phase);
+
+  /// 阶段树中的一个节点。
+  struct PhaseNode {
+    Phase phase;
+    /// 父节点在Record::nodes中的下标，-1表示顶层阶段。
+    int parent;
+    /// 进入该节点的次数。
+    unsigned count = 0;
+    /// 包括嵌套阶段的时间(纳秒)。
+    uint64_t total_ns = 0;
+    /// 不包括嵌套阶段的时间(纳秒)。
+    uint64_t self_ns = 0;
+  };
+
+  /// 一次输入的统计。
+  struct Record {
+    /// 输入的开头部分。
+    std::string input;
+    /// 最后一个被编译的事务的唯一ID，0表示没有事务被编译。
+    unsigned transaction_id = 0;
+    /// 各阶段自身的时间(纳秒)，不包括嵌套阶段的时间。
+    std::array<uint64_t, kNumPhases> phase_ns{};
+    /// 阶段树，父节点总是在子节点之前。
+    std::vector<PhaseNode> nodes;
+    /// 整个记录的时间(纳秒)。
+    uint64_t total_ns = 0;
+    /// BackendPasses之后模块的指令数。
+    uint64_t instruction_count = 0;
+    /// 生成的目标文件的字节数。
+    uint64_t object_size = 0;
+
+    /// 没有被任何阶段覆盖的时间。
+    uint64_t getUnaccountedNs() const;
+  };
+
+  /// 为当前线程开启一条记录，析构时把它加入profiler。
+  class ScopedRecord {
+    TransactionProfiler* profiler_;
+    Record record_;
+    std::chrono::steady_clock::time_point start_;
+    Record* parent_record_;
+    int parent_node_;
+
+   public:
+    /// profiler为nullptr时不做任何事，方便在关闭profiling时使用。
+    ScopedRecord(TransactionProfiler* profiler, llvm::StringRef input);
+    ~ScopedRecord();
+  };
+
+  /// 为当前记录的一个阶段计时。
+  class PhaseRAII {
+    bool active_;
+    int parent_node_;
+    std::chrono::steady_clock::time_point start_;
+
+   public:
+    PhaseRAII(Phase phase);
+    ~PhaseRAII();
+  };
+
+  /// 把事务关联到当前记录。
+  static void setTransaction(const Transaction& transaction);
+  /// 累加当前记录的指令数。
+  static void addInstructionCount(uint64_t count);
+  /// 累加当前记录的目标文件大小。
+  static void addObjectSize(uint64_t size);
+
+  /// 返回所有记录的副本，按完成顺序排列。
+  std::vector<Record> getRecords() const;
+
+  void clear();
+
+  /// 按总时间从高到低打印记录，limit为0表示打印全部。
+  /// tree为true时在每条记录之后打印它的阶段树。
+  void dump(llvm::raw_ostream& out, size_t limit = 0, bool tree = false) const;
+
+ private:
+  std::vector<Record> records_;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_TRANSACTION_PROFILER_H
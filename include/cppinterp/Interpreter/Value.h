@@ -1,6 +1,7 @@
 #ifndef CPPINTERP_INTERPRETER_VALUE_H
 #define CPPINTERP_INTERPRETER_VALUE_H
 
+#include <cstddef>  // for size_t
 #include <cstdint>  // for uintptr_t
 
 namespace llvm {
@@ -32,6 +33,12 @@ class QualType;
   X(char16_t, Char16)                 \
   X(char32_t, Char32)
 
+/// 可以直接存放在Value中的平凡记录类型的最大字节数。
+/// 不能小于long double和指针的大小，更大的值会增大每个Value。
+#ifndef CPPINTERP_VALUE_INLINE_STORAGE_SIZE
+#define CPPINTERP_VALUE_INLINE_STORAGE_SIZE 16
+#endif
+
 namespace cppinterp {
 
 class Interpreter;
@@ -46,6 +53,9 @@ class Value {
 #undef X
 
     void* ptr_;
+
+    /// 内联存放的平凡可复制、平凡析构的小型记录。
+    unsigned char inline_[CPPINTERP_VALUE_INLINE_STORAGE_SIZE];
   };
 
   enum TypeKind : short {
@@ -66,6 +76,9 @@ class Value {
   /// 是否Value类需要分配和释放内存。
   bool needs_managed_alloc_ = false;
 
+  /// 对象是否直接存放在storage_中，此时getPtr()返回storage_的地址。
+  bool stored_inline_ = false;
+
   TypeKind type_kind_ = Value::kInvalid;
 
   /// 值类型。
@@ -144,10 +157,12 @@ class Value {
   Value(Value&& other)
       : storage_(other.storage_),
         needs_managed_alloc_(other.needs_managed_alloc_),
+        stored_inline_(other.stored_inline_),
         type_kind_(other.type_kind_),
         type_(other.type_),
         interpreter_(other.interpreter_) {
     other.needs_managed_alloc_ = false;
+    other.stored_inline_ = false;
     other.type_kind_ = Value::kInvalid;
   }
 
@@ -184,6 +199,24 @@ class Value {
   /// 此类型是否需要托管堆，例如storage_成员提供的存储不足，或者需要析构。
   bool needsManagedAllocation() const { return needs_managed_alloc_; }
 
+  /// 对象是否直接存放在Value中。复制Value会复制对象，getPtr()返回的
+  /// 地址只在这个Value存在期间有效。
+  bool isStoredInline() const { return stored_inline_; }
+
+  /// 让这个值(以及与它共享负载的所有副本)可以在线程之间传递：之后负载的
+  /// 引用计数使用原子操作，副本可以在任意线程上复制和销毁而不复制负载。
+  /// 必须在只有当前线程持有副本时调用，通常是在求值的线程上。
+  ///
+  /// 析构函数只在调用本函数的线程上运行：在其他线程上释放最后一个引用时，
+  /// 对象被放入解释器的ValueAllocator中所有者线程的回收队列，等待所有者
+  /// 线程调用ValueAllocator::reclaimDeferred()。所有者线程进入解释器的
+  /// 下一个请求以及它的下一次托管分配都会调用它；解释器析构时运行
+  /// 队列中剩下的所有析构函数。
+  void makeThreadShareable();
+
+  /// 值是否可以在线程之间传递。不需要托管分配的值总是可以。
+  bool isThreadShareable() const;
+
   /// 确定是否设置了该值。
   bool isValid() const { return type_kind_ != Value::kInvalid; }
   bool isInvalid() const { return !isValid(); }
@@ -194,8 +227,47 @@ class Value {
   /// 确定该值是否已设置且不为空。
   bool hasValue() const { return isValid() && !isVoid(); }
 
+  /// 返回值的数据所在的地址：托管分配时是分配的对象，否则是storage_本身。
+  void* getDataAddress() {
+    return needs_managed_alloc_ ? storage_.ptr_ : &storage_;
+  }
+  const void* getDataAddress() const {
+    return needs_managed_alloc_ ? storage_.ptr_ : &storage_;
+  }
+
+  /// 连续存放的同类型元素的视图，直接指向JIT代码产生的内存。
+  struct ArrayView {
+    const void* data = nullptr;
+    /// 元素个数和相邻元素之间的字节数。
+    size_t count = 0;
+    size_t stride = 0;
+    /// 元素的规范化clang::QualType(不透明指针)，以及它对应的TypeKind，
+    /// 非内置类型的元素为kPtrOrObjTy。
+    void* element_type = nullptr;
+    TypeKind element_kind = Value::kInvalid;
+
+    clang::QualType getElementType() const;
+
+    /// 以T的数组访问元素，T的大小与stride不同时返回nullptr。
+    /// 调用者负责确认element_kind或element_type与T相符。
+    template <typename T>
+    const T* getAs() const {
+      return stride == sizeof(T) ? static_cast<const T*>(data) : nullptr;
+    }
+  };
+
+  /// 如果值是常量数组(多维数组按最内层元素展开)、std::array或std::vector
+  /// (vector<bool>和使用有状态分配器的vector除外)，返回其元素的视图，
+  /// 不复制元素。元素类型没有对应的TypeKind(例如__int128)时返回false。
+  /// 视图在值(对于内联存放的值，是这个Value对象本身)存在且容器未被修改
+  /// 期间有效。
+  ///\returns 值不是可识别的连续存放的元素时返回false。
+  bool getArrayView(ArrayView& view) const;
+
   void** getPtrAddress() { return &storage_.ptr_; }
-  void* getPtr() const { return storage_.ptr_; }
+  void* getPtr() const {
+    return stored_inline_ ? const_cast<Storage*>(&storage_) : storage_.ptr_;
+  }
   void setPtr(void* value) { storage_.ptr_ = value; }
 
 #define X(type, name)                                 \
@@ -219,7 +291,7 @@ class Value {
 template <>
 inline void* Value::getAs() const {
   if (isPointerOrObjectType())
-    return storage_.ptr_;
+    return getPtr();
   return (void*)getAs<uintptr_t>();
 }
 
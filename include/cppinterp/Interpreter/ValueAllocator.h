@@ -0,0 +1,99 @@
+#ifndef CPPINTERP_INTERPRETER_VALUE_ALLOCATOR_H
+#define CPPINTERP_INTERPRETER_VALUE_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "llvm/Support/Allocator.h"
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace cppinterp {
+
+/// Value托管分配(对象、数组和成员指针类型的结果)使用的内存池。
+///
+/// 块按大小分为2的幂的大小类，从BumpPtrAllocator的slab中切出，释放后
+/// 进入对应大小类的空闲链表等待重用，因此大量小对象结果不再逐个调用
+/// malloc/free。超过最大大小类的块直接使用operator new。
+/// slab只在ValueAllocator析构时归还系统，它必须比所有分配自它的Value
+/// 活得更久。
+///
+/// 所有操作都由一个互斥锁保护，可以从多个线程释放Value。
+/// 共享值的析构可以被推迟到回收队列，见Value::makeThreadShareable()。
+class ValueAllocator {
+ public:
+  /// 最小和最大的块大小，包括AllocatedValue的头部。
+  static constexpr size_t kMinBlockSize = 64;
+  static constexpr size_t kMaxBlockSize = 4096;
+  static constexpr unsigned kNumSizeClasses = 7;
+
+  struct Statistics {
+    /// 存活的值的个数和它们负载的总字节数。
+    uint64_t live_values = 0;
+    uint64_t live_bytes = 0;
+    uint64_t peak_live_bytes = 0;
+    /// 所有分配的次数，以及其中从空闲链表重用的次数。
+    uint64_t allocations = 0;
+    uint64_t reused = 0;
+    /// 超过最大大小类、直接向系统分配的次数。
+    uint64_t large_allocations = 0;
+    /// 向系统申请的slab个数和总字节数。
+    uint64_t slabs = 0;
+    uint64_t pooled_bytes = 0;
+    /// 在回收队列中等待所有者线程析构的值的个数。
+    uint64_t deferred = 0;
+  };
+
+  using DestroyFn = void (*)(void* block);
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  llvm::BumpPtrAllocator slabs_;
+  FreeBlock* free_lists_[kNumSizeClasses] = {};
+  Statistics stats_;
+  /// 在其他线程上释放、等待在所有者线程上析构的块，按所有者线程分组。
+  std::map<std::thread::id, std::vector<std::pair<void*, DestroyFn>>>
+      deferred_;
+  mutable std::mutex mutex_;
+
+  static unsigned getSizeClass(size_t block_size);
+
+ public:
+  ValueAllocator() = default;
+  ~ValueAllocator();
+  ValueAllocator(const ValueAllocator&) = delete;
+  ValueAllocator& operator=(const ValueAllocator&) = delete;
+
+  /// 分配block_size字节、按std::max_align_t对齐的块。
+  ///\param[in] payload_size - 计入统计的负载字节数。
+  void* allocate(size_t block_size, size_t payload_size);
+
+  /// 释放allocate()返回的块，大小必须与分配时相同。
+  void deallocate(void* block, size_t block_size, size_t payload_size);
+
+  /// 把block放入owner的回收队列，之后由owner线程上的reclaimDeferred()
+  /// 调用destroy(block)。
+  void deferDestruction(void* block, DestroyFn destroy, std::thread::id owner);
+
+  /// 析构所有者是调用线程的块，返回它们的个数。其他线程的块保留在队列中，
+  /// 所有者线程已经退出的块由析构函数处理。
+  size_t reclaimDeferred();
+
+  Statistics getStatistics() const;
+
+  void dump(llvm::raw_ostream& out) const;
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_VALUE_ALLOCATOR_H
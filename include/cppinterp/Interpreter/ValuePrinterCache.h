@@ -0,0 +1,85 @@
+#ifndef CPPINTERP_INTERPRETER_VALUE_PRINTER_CACHE_H
+#define CPPINTERP_INTERPRETER_VALUE_PRINTER_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "llvm/ADT/DenseMap.h"
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+namespace clang {
+class QualType;
+}  // namespace clang
+
+namespace cppinterp {
+
+class Interpreter;
+
+/// 按规范化类型缓存的值打印函数。
+///
+/// 第一次打印某个非内置类型的对象时，为它编译一个专用的extern "C"打印
+/// 函数，之后同一类型的对象直接调用它，不再生成和编译代码。
+/// 编译失败的类型(例如无法在代码中拼写的类型)也被记录，之后只打印地址。
+///
+/// 打印函数直接向llvm::raw_ostream写入，不构造中间字符串；容器和字符串
+/// 最多打印Limits::max_elements个元素，嵌套超过Limits::max_depth层的容器
+/// 被省略，因此打印巨大的容器也只产生有界的输出。
+///
+/// 打印函数属于编译它的事务。卸载事务时应该调用clear()，与
+/// 析构函数包装的缓存相同。
+class ValuePrinterCache {
+ public:
+  struct Limits {
+    /// 每个容器或字符串最多打印的元素数。
+    size_t max_elements = 100;
+    /// 最多展开的容器嵌套层数。
+    unsigned max_depth = 4;
+  };
+
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t compilations = 0;
+    uint64_t failures = 0;
+  };
+
+  /// sink是打印函数的输出目标，object是被打印的对象的地址。
+  using PrinterFn = void (*)(void* sink, const void* object);
+
+ private:
+  Interpreter& interpreter_;
+
+  /// 规范化clang::Type到打印函数的映射，编译失败的类型映射到nullptr。
+  llvm::DenseMap<const void*, PrinterFn> printers_;
+
+  Limits limits_;
+  Statistics stats_;
+
+  PrinterFn compilePrinter(clang::QualType type);
+
+ public:
+  explicit ValuePrinterCache(Interpreter& interpreter)
+      : interpreter_(interpreter) {}
+
+  /// 返回type的打印函数，必要时编译它。无法打印时返回nullptr。
+  PrinterFn getPrinter(clang::QualType type);
+
+  /// 打印object指向的type类型的对象。
+  ///\param[in] escape - 是否转义字符串和字符中不可打印的字符和引号。
+  ///\returns 没有打印函数时返回false，此时什么也不输出。
+  bool print(llvm::raw_ostream& out, clang::QualType type,
+             const void* object, bool escape = false);
+
+  void setLimits(const Limits& limits) { limits_ = limits; }
+  const Limits& getLimits() const { return limits_; }
+
+  void clear() { printers_.clear(); }
+  size_t size() const { return printers_.size(); }
+  Statistics getStatistics() const { return stats_; }
+};
+
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_INTERPRETER_VALUE_PRINTER_CACHE_H
@@ -90,6 +90,17 @@ void AddIncludePaths(llvm::StringRef PathStr, clang::HeaderSearchOptions& Opts,
 ///
 void LogNonExistantDirectory(llvm::StringRef Path);
 
+///\brief Writes Contents to Path through a temporary file in the same
+/// directory followed by a rename, so that other processes never see a
+/// partially written file.
+///
+///\param[in] Path - File to create or replace
+///\param[in] Contents - Data to write
+///
+///\return true on success
+///
+bool WriteFileAtomically(llvm::StringRef Path, llvm::StringRef Contents);
+
 ///\brief Copies the current include paths into the HeaderSearchOptions.
 ///
 ///\param[in] Opts - HeaderSearchOptions to read from
@@ -4,6 +4,8 @@
 #include <string>
 
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Support/Compiler.h"
 
 namespace cppinterp {
@@ -13,9 +15,17 @@ namespace platform {
 /// 返回当前工作目录。
 std::string GetCwd();
 
-/// 获取系统库路径。
+/// 获取系统库路径：/etc/ld.so.conf及其include的文件中的目录，
+/// ld.so.cache中的库所在的目录，以及动态链接器的可信目录。
+/// 结果在第一次调用时读取，之后每个进程复用。
 bool GetSystemLibraryPaths(llvm::SmallVectorImpl<std::string>& paths);
 
+/// 返回/etc/ld.so.cache中宿主架构的库名(例如"libz.so.1")到路径的映射。
+const llvm::StringMap<std::string>& GetSystemLibraryMap();
+
+/// 返回ld.so.cache中名为name的库的路径，没有时返回空字符串。
+llvm::StringRef FindSystemLibrary(llvm::StringRef name);
+
 /// 返回给定路径的规范化版本。
 std::string NormalizePath(const std::string& path);
 
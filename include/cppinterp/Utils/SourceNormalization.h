@@ -0,0 +1,31 @@
+#ifndef CPPINTERP_UTILS_SOURCE_NORMALIZATION_H
+#define CPPINTERP_UTILS_SOURCE_NORMALIZATION_H
+
+#include <string>
+
+namespace clang {
+class LangOptions;
+}  // namespace clang
+
+namespace cppinterp {
+namespace utils {
+
+///\brief 返回输入中需要放进包装函数的部分的起点。
+///
+/// 开头的预处理指令、注释和顶层声明(using、namespace、typedef、template、
+/// extern、类型定义和函数定义)留在全局作用域，从第一个语句或表达式开始
+/// 的部分由Interpreter::WrapInput()包装。这只是基于token的启发式判断，
+/// 变量声明被放进包装函数，由DeclExtractor提取出来。
+///
+///\param[in] source - 用户输入。
+///\param[in] lang_opts - 词法分析使用的语言选项。
+///
+///\returns 包装起点的偏移；输入中没有需要包装的部分时返回std::string::npos。
+///
+size_t getWrapPoint(const std::string& source,
+                    const clang::LangOptions& lang_opts);
+
+}  // namespace utils
+}  // namespace cppinterp
+
+#endif  // CPPINTERP_UTILS_SOURCE_NORMALIZATION_H
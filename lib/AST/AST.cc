@@ -8,14 +8,18 @@
 
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Decl.h"
+#include "clang/AST/DeclCXX.h"
 #include "clang/AST/DeclTemplate.h"
 #include "clang/AST/DeclarationName.h"
 #include "clang/AST/GlobalDecl.h"
 #include "clang/AST/Mangle.h"
 #include "clang/AST/Stmt.h"
 #include "clang/Sema/Lookup.h"
+#include "clang/Sema/Scope.h"
 #include "clang/Sema/Sema.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 
 namespace cppinterp {
@@ -119,6 +123,40 @@ clang::Expr* GetOrCreateLastExpr(clang::FunctionDecl* fd, int* found_at,
   }
 }
 
+static const clang::Decl* FindUnremovableDecl(
+    const clang::Decl* decl,
+    const llvm::SmallPtrSetImpl<const clang::Decl*>& removed) {
+  if (const auto* linkage = llvm::dyn_cast<clang::LinkageSpecDecl>(decl)) {
+    for (const clang::Decl* child : linkage->decls()) {
+      if (const clang::Decl* found = FindUnremovableDecl(child, removed)) {
+        return found;
+      }
+    }
+    return nullptr;
+  }
+  const clang::Decl* prev = decl->getPreviousDecl();
+  if (prev && !removed.count(prev)) {
+    return decl;
+  }
+  return nullptr;
+}
+
+const clang::Decl* FindUnremovableDecl(llvm::ArrayRef<clang::Decl*> decls) {
+  llvm::SmallPtrSet<const clang::Decl*, 64> removed;
+  for (const clang::Decl* decl : decls) {
+    removed.insert(decl);
+    if (const auto* linkage = llvm::dyn_cast<clang::LinkageSpecDecl>(decl)) {
+      removed.insert(linkage->decls_begin(), linkage->decls_end());
+    }
+  }
+  for (const clang::Decl* decl : decls) {
+    if (const clang::Decl* found = FindUnremovableDecl(decl, removed)) {
+      return found;
+    }
+  }
+  return nullptr;
+}
+
 }  // namespace analyze
 
 namespace synthesize {
@@ -126,5 +164,59 @@ namespace synthesize {
 const char* const UniquePrefix = "__cppinterp_unique";
 
 }
+
+namespace lookup {
+
+const clang::NamespaceDecl* Namespace(clang::Sema* sema,
+                                      llvm::StringRef name) {
+  clang::DeclarationName decl_name = &sema->Context.Idents.get(name);
+  clang::LookupResult result(*sema, decl_name, clang::SourceLocation(),
+                             clang::Sema::LookupNestedNameSpecifierName);
+  result.suppressDiagnostics();
+  sema->LookupName(result, sema->TUScope);
+  if (result.empty()) {
+    return nullptr;
+  }
+  result.resolveKind();
+  if (!result.isSingleResult()) {
+    return nullptr;
+  }
+  return llvm::dyn_cast<clang::NamespaceDecl>(result.getFoundDecl());
+}
+
+}  // namespace lookup
+
+namespace transform {
+
+static void RemoveDecl(clang::Sema& sema, clang::Decl* decl) {
+  if (auto* linkage = llvm::dyn_cast<clang::LinkageSpecDecl>(decl)) {
+    // 链接规范是透明的上下文，其中的声明位于外层上下文的查找表中。
+    llvm::SmallVector<clang::Decl*, 8> children(linkage->decls_begin(),
+                                                linkage->decls_end());
+    for (auto it = children.rbegin(); it != children.rend(); ++it) {
+      RemoveDecl(sema, *it);
+    }
+  }
+  if (auto* named = llvm::dyn_cast<clang::NamedDecl>(decl)) {
+    if (named->getDeclName() && sema.TUScope &&
+        sema.TUScope->isDeclScope(named)) {
+      sema.TUScope->RemoveDecl(named);
+      sema.IdResolver.RemoveDecl(named);
+    }
+  }
+  clang::DeclContext* dc = decl->getLexicalDeclContext();
+  if (dc->containsDecl(decl)) {
+    dc->removeDecl(decl);
+  }
+}
+
+void RemoveDecls(clang::Sema& sema, llvm::ArrayRef<clang::Decl*> decls) {
+  // 从新到旧移除，这样依赖较早声明的声明先被移除。
+  for (auto it = decls.rbegin(); it != decls.rend(); ++it) {
+    RemoveDecl(sema, *it);
+  }
+}
+
+}  // namespace transform
 }  // namespace ast
 }  // namespace cppinterp
\ No newline at end of file
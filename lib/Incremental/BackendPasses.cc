@@ -3,25 +3,22 @@
 #include "clang/Basic/CharInfo.h"
 #include "clang/Basic/CodeGenOptions.h"
 #include "cppinterp/Incremental/IncrementalJIT.h"
+#include "cppinterp/Incremental/TieredCompiler.h"
+#include "cppinterp/Interpreter/TransactionProfiler.h"
 #include "cppinterp/Utils/Platform.h"
-#include "llvm/Analysis/InlineCost.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
-#include "llvm/Analysis/TargetTransformInfo.h"
-#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Target/TargetMachine.h"
-#include "llvm/Transforms/IPO.h"
-#include "llvm/Transforms/IPO/AlwaysInliner.h"
-#include "llvm/Transforms/IPO/Inliner.h"
-#include "llvm/Transforms/IPO/PassManagerBuilder.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Utils.h"
+#include "llvm/Transforms/Utils/AddDiscriminators.h"
 
 namespace {
 
-class KeepLocalGVPass : public llvm::ModulePass {
-  static char ID;
+class KeepLocalGVPass : public llvm::PassInfoMixin<KeepLocalGVPass> {
 
   bool runOnGlobal(llvm::GlobalValue& gv) {
     if (gv.isDeclaration()) {
@@ -52,20 +49,21 @@ class KeepLocalGVPass : public llvm::ModulePass {
   }
 
  public:
-  KeepLocalGVPass() : llvm::ModulePass(ID) {}
-
-  bool runOnModule(llvm::Module& module) override {
+  llvm::PreservedAnalyses run(llvm::Module& module,
+                              llvm::ModuleAnalysisManager&) {
     bool ret = false;
     for (auto&& f : module)
       ret |= runOnGlobal(f);
     for (auto&& global : module.globals())
       ret |= runOnGlobal(global);
-    return ret;
+    return ret ? llvm::PreservedAnalyses::none()
+               : llvm::PreservedAnalyses::all();
   }
+
+  static bool isRequired() { return true; }
 };
 
-class PreventLocalOptPass : public llvm::ModulePass {
-  static char ID;
+class PreventLocalOptPass : public llvm::PassInfoMixin<PreventLocalOptPass> {
 
   bool runOnGlobal(llvm::GlobalValue& gv) {
     if (!gv.isDeclaration()) {
@@ -98,20 +96,22 @@ class PreventLocalOptPass : public llvm::ModulePass {
   }
 
  public:
-  PreventLocalOptPass() : llvm::ModulePass(ID) {}
-
-  bool runOnModule(llvm::Module& module) override {
+  llvm::PreservedAnalyses run(llvm::Module& module,
+                              llvm::ModuleAnalysisManager&) {
     bool ret = false;
     for (auto&& f : module)
       ret |= runOnGlobal(f);
     for (auto&& global : module.globals())
       ret |= runOnGlobal(global);
-    return ret;
+    return ret ? llvm::PreservedAnalyses::none()
+               : llvm::PreservedAnalyses::all();
   }
+
+  static bool isRequired() { return true; }
 };
 
-class WeakTypeinfoVTablePass : public llvm::ModulePass {
-  static char ID;
+class WeakTypeinfoVTablePass
+    : public llvm::PassInfoMixin<WeakTypeinfoVTablePass> {
 
   bool runOnGlobalVariable(llvm::GlobalVariable& gv) {
     // 只需要考虑具有外部链接的符号，因为只有这些符号才能被报告为重复。
@@ -132,20 +132,21 @@ class WeakTypeinfoVTablePass : public llvm::ModulePass {
   }
 
  public:
-  WeakTypeinfoVTablePass() : ModulePass(ID) {}
-
-  bool runOnModule(llvm::Module& M) override {
+  llvm::PreservedAnalyses run(llvm::Module& M, llvm::ModuleAnalysisManager&) {
     bool ret = false;
     for (auto&& GV : M.globals())
       ret |= runOnGlobalVariable(GV);
-    return ret;
+    return ret ? llvm::PreservedAnalyses::none()
+               : llvm::PreservedAnalyses::all();
   }
+
+  static bool isRequired() { return true; }
 };
 
 /// 给CUDA模块添加一个后缀，为CUDA特定的函数和变量生成一个唯一的名称。
 /// 这对于延迟编译是必要的。如果没有后缀，则无法区分后续模块的tor/dtor、寄存器函数和ptx代码字符串。
-class UniqueCUDAStructorName : public llvm::ModulePass {
-  static char ID;
+class UniqueCUDAStructorName
+    : public llvm::PassInfoMixin<UniqueCUDAStructorName> {
 
   // 给符号附加后缀以使其唯一，
   // 后缀是 "_cppinterp_module_<module number>"
@@ -199,25 +200,77 @@ class UniqueCUDAStructorName : public llvm::ModulePass {
   }
 
  public:
-  UniqueCUDAStructorName() : llvm::ModulePass(ID) {}
-
-  bool runOnModule(llvm::Module& m) override {
+  llvm::PreservedAnalyses run(llvm::Module& m, llvm::ModuleAnalysisManager&) {
     bool ret = false;
     const llvm::StringRef ModuleName = m.getName();
     for (auto&& F : m)
       ret |= runOnFunction(F, ModuleName);
     for (auto&& G : m.globals())
       ret |= runOnGlobal(G, ModuleName);
-    return ret;
+    return ret ? llvm::PreservedAnalyses::none()
+               : llvm::PreservedAnalyses::all();
+  }
+
+  static bool isRequired() { return true; }
+};
+
+/// 旧的流水线在O1只运行AlwaysInliner，而新的O1流水线总是包含完整的内联器。
+/// O1时在流水线开始处把其余函数暂时标记为noinline，在结束处恢复。
+const char* const kTemporaryNoInline = "cppinterp-temporary-noinline";
+
+class DisableInliningPass : public llvm::PassInfoMixin<DisableInliningPass> {
+ public:
+  llvm::PreservedAnalyses run(llvm::Module& m, llvm::ModuleAnalysisManager&) {
+    bool ret = false;
+    for (llvm::Function& F : m) {
+      if (F.isDeclaration() ||
+          F.hasFnAttribute(llvm::Attribute::AlwaysInline) ||
+          F.hasFnAttribute(llvm::Attribute::NoInline))
+        continue;
+      F.addFnAttr(llvm::Attribute::NoInline);
+      F.addFnAttr(kTemporaryNoInline);
+      ret = true;
+    }
+    return ret ? llvm::PreservedAnalyses::none()
+               : llvm::PreservedAnalyses::all();
   }
+
+  static bool isRequired() { return true; }
+};
+
+class RestoreInliningPass : public llvm::PassInfoMixin<RestoreInliningPass> {
+ public:
+  llvm::PreservedAnalyses run(llvm::Module& m, llvm::ModuleAnalysisManager&) {
+    bool ret = false;
+    for (llvm::Function& F : m) {
+      if (!F.hasFnAttribute(kTemporaryNoInline))
+        continue;
+      F.removeFnAttr(llvm::Attribute::NoInline);
+      F.removeFnAttr(kTemporaryNoInline);
+      ret = true;
+    }
+    return ret ? llvm::PreservedAnalyses::none()
+               : llvm::PreservedAnalyses::all();
+  }
+
+  static bool isRequired() { return true; }
 };
 
 /// 将已经存在的弱符号的定义替换为声明。这减少了发射符号的数量。
-class ReuseExistingWeakSymbols : public llvm::ModulePass {
-  static char ID;
+class ReuseExistingWeakSymbols
+    : public llvm::PassInfoMixin<ReuseExistingWeakSymbols> {
   cppinterp::IncrementalJIT& jit_;
 
+  bool isRestoredDefinition(llvm::GlobalValue& gv) {
+    // 从检查点恢复的目标文件已经定义了这个符号，再次定义会导致链接错误。
+    return !gv.hasLocalLinkage() && jit_.isRestoredSymbol(gv.getName());
+  }
+
   bool shouldRemoveGlobalDefinition(llvm::GlobalValue& gv) {
+    if (isRestoredDefinition(gv)) {
+      return true;
+    }
+
     // Existing *weak* symbols can be re-used thanks to ODR.
     llvm::GlobalValue::LinkageTypes LT = gv.getLinkage();
     if (!gv.isDiscardableIfUnused(LT) || !gv.isWeakForLinker(LT)) {
@@ -230,8 +283,8 @@ class ReuseExistingWeakSymbols : public llvm::ModulePass {
     }
 
     // ...or in shared libraries (without auto-loading).
-    std::string Name = gv.getName().str();
-    return llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(Name);
+    // 索引的Bloom过滤器否定的名字不需要调用dlsym。
+    return jit_.getSymbolIndex().findHostSymbol(gv.getName());
   }
 
   bool runOnVar(llvm::GlobalVariable& gv) {
@@ -250,6 +303,11 @@ class ReuseExistingWeakSymbols : public llvm::ModulePass {
       return false;  // no change.
     }
 
+    if (isRestoredDefinition(func)) {
+      func.deleteBody();
+      return true;
+    }
+
     if (func.getInstructionCount() < 50) {
       // 这是一个小函数。保留它的定义以保留它用于内联:
       // jit它的成本很小，并且调用被内联的可能性很高。
@@ -263,125 +321,174 @@ class ReuseExistingWeakSymbols : public llvm::ModulePass {
   }
 
  public:
-  ReuseExistingWeakSymbols(cppinterp::IncrementalJIT& jit)
-      : ModulePass(ID), jit_(jit) {}
+  ReuseExistingWeakSymbols(cppinterp::IncrementalJIT& jit) : jit_(jit) {}
 
-  bool runOnModule(llvm::Module& m) override {
+  llvm::PreservedAnalyses run(llvm::Module& m, llvm::ModuleAnalysisManager&) {
     bool ret = false;
     for (auto&& F : m)
       ret |= runOnFunc(F);
     for (auto&& G : m.globals())
       ret |= runOnVar(G);
-    return ret;
+    return ret ? llvm::PreservedAnalyses::none()
+               : llvm::PreservedAnalyses::all();
   }
+
+  static bool isRequired() { return true; }
 };
 
 }  // namespace
 
-char KeepLocalGVPass::ID = 0;
-char PreventLocalOptPass::ID = 0;
-char WeakTypeinfoVTablePass::ID = 0;
-char UniqueCUDAStructorName::ID = 0;
-char ReuseExistingWeakSymbols::ID = 0;
-
 namespace cppinterp {
 
+BackendPasses::BackendPasses(const clang::CodeGenOptions& cgopts,
+                             IncrementalJIT& jit, llvm::TargetMachine& tm)
+    : tm_(tm), jit_(jit), cgopts_(cgopts), tiered_(jit.getTieredCompiler()) {
+  // 分析管理器只注册一次，所有优化级别和所有事务共享。
+  fam_.registerPass([this] {
+    return llvm::TargetLibraryAnalysis(
+        llvm::TargetLibraryInfoImpl(tm_.getTargetTriple()));
+  });
+  pb_ = createPassBuilder(cgopts_.OptimizationLevel);
+  pb_->registerModuleAnalyses(mam_);
+  pb_->registerCGSCCAnalyses(cgam_);
+  pb_->registerFunctionAnalyses(fam_);
+  pb_->registerLoopAnalyses(lam_);
+  pb_->crossRegisterProxies(lam_, fam_, cgam_, mam_);
+}
+
 BackendPasses::~BackendPasses() {}
 
-void BackendPasses::CreatePasses(llvm::Module& module, int opt_level) {
-  // 处理禁用LLVM优化，其中我们希望保留任何优化之前的内部模块。
-  if (cgopts_.DisableLLVMPasses) {
-    opt_level = 0;
-    // 至少要总是保持ForceInline -不内联对lib++来说是致命的。
-    // Inlining = cgopts_.NoInlining;
+std::unique_ptr<llvm::PassBuilder> BackendPasses::createPassBuilder(
+    int opt_level) {
+  // 与旧的流水线一致：向量化只在O2及以上打开。
+  llvm::PipelineTuningOptions PTO;
+  PTO.LoopUnrolling = cgopts_.UnrollLoops;
+  PTO.LoopInterleaving = cgopts_.UnrollLoops;
+  PTO.LoopVectorization = opt_level > 1;  // cgopts_.VectorizeLoop
+  PTO.SLPVectorization = opt_level > 1;   // cgopts_.VectorizeSLP
+  PTO.MergeFunctions = cgopts_.MergeFunctions;
+  auto PB = std::make_unique<llvm::PassBuilder>(&tm_, PTO);
+  tm_.registerPassBuilderCallbacks(*PB);
+
+  PB->registerPipelineStartEPCallback(
+      [](llvm::ModulePassManager& MPM, llvm::OptimizationLevel) {
+        MPM.addPass(llvm::createModuleToFunctionPassAdaptor(
+            llvm::AddDiscriminatorsPass()));
+      });
+
+  // 与旧的流水线一致：O1只内联always_inline函数。
+  if (opt_level == 1) {
+    PB->registerPipelineStartEPCallback(
+        [](llvm::ModulePassManager& MPM, llvm::OptimizationLevel) {
+          MPM.addPass(DisableInliningPass());
+        });
+    PB->registerOptimizerLastEPCallback(
+        [](llvm::ModulePassManager& MPM, llvm::OptimizationLevel) {
+          MPM.addPass(RestoreInliningPass());
+        });
   }
+  return PB;
+}
 
-  llvm::PassManagerBuilder PMBuilder;
-  PMBuilder.OptLevel = opt_level;
-  PMBuilder.SizeLevel = cgopts_.OptimizeSize;
-  PMBuilder.SLPVectorize = opt_level > 1 ? 1 : 0;   // cgopts_.VectorizeSLP
-  PMBuilder.LoopVectorize = opt_level > 1 ? 1 : 0;  // cgopts_.VectorizeLoop
-
-  PMBuilder.DisableUnrollLoops = !cgopts_.UnrollLoops;
-  PMBuilder.MergeFunctions = cgopts_.MergeFunctions;
-  PMBuilder.RerollLoops = cgopts_.RerollLoops;
-
-  PMBuilder.LibraryInfo =
-      new llvm::TargetLibraryInfoImpl(tm_.getTargetTriple());
-
-  // At O0 and O1 we only run the always inliner which is more efficient. At
-  // higher optimization levels we run the normal inliner.
-  // See also call to `CGOpts.setInlining()` in CIFactory!
-  if (PMBuilder.OptLevel <= 1) {
-    bool InsertLifetimeIntrinsics = PMBuilder.OptLevel != 0;
-    PMBuilder.Inliner =
-        llvm::createAlwaysInlinerLegacyPass(InsertLifetimeIntrinsics);
-  } else {
-    PMBuilder.Inliner = llvm::createFunctionInliningPass(
-        opt_level, PMBuilder.SizeLevel,
-        (!cgopts_.SampleProfileFile.empty() && cgopts_.PrepareForThinLTO));
+int BackendPasses::getModuleOptLevel(const llvm::Module& module) {
+  if (auto* level = llvm::mdconst::extract_or_null<llvm::ConstantInt>(
+          module.getModuleFlag(kOptLevelFlag))) {
+    return level->getZExtValue();
   }
+  return -1;
+}
 
-  // Set up the per-module pass manager.
-  pm_[opt_level].reset(new llvm::legacy::PassManager());
+llvm::CodeGenOpt::Level BackendPasses::getCodeGenOptLevel(int opt_level) {
+  static constexpr std::array<llvm::CodeGenOpt::Level, 4> CGOptLevel{
+      {llvm::CodeGenOpt::None, llvm::CodeGenOpt::Less,
+       llvm::CodeGenOpt::Default, llvm::CodeGenOpt::Aggressive}};
+  return CGOptLevel[opt_level < 0 ? 0 : (opt_level > 3 ? 3 : opt_level)];
+}
 
-  pm_[opt_level]->add(new KeepLocalGVPass());
-  pm_[opt_level]->add(new PreventLocalOptPass());
-  pm_[opt_level]->add(new WeakTypeinfoVTablePass());
-  pm_[opt_level]->add(new ReuseExistingWeakSymbols(jit_));
+void BackendPasses::CreatePasses(int opt_level) {
+  // 处理禁用LLVM优化，其中我们希望保留任何优化之前的内部模块。
+  // O0的流水线仍然会运行AlwaysInliner：不内联对libc++来说是致命的。
+  int pipeline_level = cgopts_.DisableLLVMPasses ? 0 : opt_level;
+
+  // 每个优化级别使用自己的PassBuilder构建流水线，调优选项与旧的流水线的
+  // 该级别一致；分析仍然注册在共享的pb_中。
+  pb_levels_[opt_level] = createPassBuilder(pipeline_level);
+  llvm::PassBuilder& PB = *pb_levels_[opt_level];
+
+  static const llvm::OptimizationLevel Levels[] = {
+      llvm::OptimizationLevel::O0, llvm::OptimizationLevel::O1,
+      llvm::OptimizationLevel::O2, llvm::OptimizationLevel::O3};
+  llvm::OptimizationLevel Level = Levels[pipeline_level];
+  if (cgopts_.OptimizeSize == 1)
+    Level = llvm::OptimizationLevel::Os;
+  else if (cgopts_.OptimizeSize == 2)
+    Level = llvm::OptimizationLevel::Oz;
+  if (pipeline_level == 0)
+    Level = llvm::OptimizationLevel::O0;
+
+  mpm_[opt_level].reset(new llvm::ModulePassManager());
+  llvm::ModulePassManager& MPM = *mpm_[opt_level];
+
+  if (cgopts_.VerifyModule)
+    MPM.addPass(llvm::VerifierPass());
+
+  MPM.addPass(KeepLocalGVPass());
+  MPM.addPass(PreventLocalOptPass());
+  MPM.addPass(WeakTypeinfoVTablePass());
+  MPM.addPass(ReuseExistingWeakSymbols(jit_));
 
   // The function __cuda_module_ctor and __cuda_module_dtor will just generated,
   // if a CUDA fatbinary file exist. Without file path there is no need for the
   // function pass.
   if (!cgopts_.CudaGpuBinaryFileName.empty())
-    pm_[opt_level]->add(new UniqueCUDAStructorName());
-  pm_[opt_level]->add(
-      createTargetTransformInfoWrapperPass(tm_.getTargetIRAnalysis()));
-
-  tm_.adjustPassManager(PMBuilder);
-
-  PMBuilder.addExtension(
-      llvm::PassManagerBuilder::EP_EarlyAsPossible,
-      [&](const llvm::PassManagerBuilder&, llvm::legacy::PassManagerBase& PM) {
-        PM.add(llvm::createAddDiscriminatorsPass());
-      });
+    MPM.addPass(UniqueCUDAStructorName());
 
   // if (!cgopts_.RewriteMapFiles.empty())
-  //   addSymbolRewriterPass(cgopts_, pm_);
-
-  PMBuilder.populateModulePassManager(*pm_[opt_level]);
+  //   addSymbolRewriterPass(cgopts_, MPM);
 
-  fpm_[opt_level].reset(new llvm::legacy::FunctionPassManager(&module));
-  fpm_[opt_level]->add(
-      createTargetTransformInfoWrapperPass(tm_.getTargetIRAnalysis()));
-  if (cgopts_.VerifyModule)
-    fpm_[opt_level]->add(llvm::createVerifierPass());
-  PMBuilder.populateFunctionPassManager(*fpm_[opt_level]);
+  if (Level == llvm::OptimizationLevel::O0)
+    MPM.addPass(PB.buildO0DefaultPipeline(Level));
+  else
+    MPM.addPass(PB.buildPerModuleDefaultPipeline(Level));
 }
 
 void BackendPasses::runOnModule(llvm::Module& module, int opt_level) {
+  TransactionProfiler::PhaseRAII phase(TransactionProfiler::kBackendPasses);
+
   if (opt_level < 0)
     opt_level = 0;
   if (opt_level > 3)
     opt_level = 3;
 
-  if (!pm_[opt_level])
-    CreatePasses(module, opt_level);
-
-  static constexpr std::array<llvm::CodeGenOpt::Level, 4> CGOptLevel{
-      {llvm::CodeGenOpt::None, llvm::CodeGenOpt::Less,
-       llvm::CodeGenOpt::Default, llvm::CodeGenOpt::Aggressive}};
-  // TM's OptLevel is used to build orc::SimpleCompiler passes for every Module.
-  tm_.setOptLevel(CGOptLevel[opt_level]);
+  // 分层编译时先以O0快速编译，热函数之后由TieredCompiler在后台重新优化。
+  if (tiered_)
+    opt_level = 0;
 
-  // Run the per-function passes on the module.
-  fpm_[opt_level]->doInitialization();
-  for (auto&& I : module.functions())
-    if (!I.isDeclaration())
-      fpm_[opt_level]->run(I);
-  fpm_[opt_level]->doFinalization();
+  if (!mpm_[opt_level])
+    CreatePasses(opt_level);
 
-  pm_[opt_level]->run(module);
+  // TM's OptLevel is used to build orc::SimpleCompiler passes for every Module.
+  tm_.setOptLevel(getCodeGenOptLevel(opt_level));
+  // 编译器和目标文件缓存都从模块中读取优化级别，不读取tm_：
+  // 并发编译时tm_可能已经被下一个事务修改。
+  module.setModuleFlag(llvm::Module::Override, kOptLevelFlag,
+                       llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(
+                           llvm::Type::getInt32Ty(module.getContext()),
+                           opt_level)));
+
+  mpm_[opt_level]->run(module, mam_);
+
+  // 缓存的分析结果以llvm::Module和llvm::Function的地址为键，
+  // 而模块随后就会交给JIT。只清空结果，保留已注册的分析。
+  lam_.clear();
+  cgam_.clear();
+  fam_.clear();
+  mam_.clear();
+
+  if (tiered_)
+    tiered_->instrumentModule(module);
+
+  TransactionProfiler::addInstructionCount(module.getInstructionCount());
 }
 
 }  // namespace cppinterp
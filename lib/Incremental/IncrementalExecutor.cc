@@ -0,0 +1,29 @@
+#include "cppinterp/Incremental/IncrementalExecutor.h"
+
+#include "cppinterp/Incremental/IncrementalJIT.h"
+#include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+
+namespace cppinterp {
+
+IncrementalExecutor::IncrementalExecutor(const clang::CompilerInstance& ci,
+                                         const InvocationOptions& opts,
+                                         llvm::Error& err,
+                                         void* extra_lib_handle, bool verbose) {
+  llvm::ErrorAsOutParameter _(&err);
+
+  auto epc = llvm::orc::SelfExecutorProcessControl::Create();
+  if (!epc) {
+    err = epc.takeError();
+    return;
+  }
+  jit_ = std::make_unique<IncrementalJIT>(*this, ci, opts, std::move(*epc), err,
+                                          extra_lib_handle, verbose);
+}
+
+IncrementalExecutor::~IncrementalExecutor() {}
+
+void IncrementalExecutor::addModule(Transaction& transaction) {
+  jit_->addModule(transaction);
+}
+
+}  // namespace cppinterp
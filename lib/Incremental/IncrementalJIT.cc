@@ -0,0 +1,589 @@
+#include "cppinterp/Incremental/IncrementalJIT.h"
+
+#include <algorithm>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/GlobalDecl.h"
+#include "clang/Basic/CodeGenOptions.h"
+#include "clang/Basic/TargetInfo.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "cppinterp/AST/AST.h"
+#include "cppinterp/Incremental/BackendPasses.h"
+#include "cppinterp/Incremental/IncrementalObjectCache.h"
+#include "cppinterp/Incremental/TieredCompiler.h"
+#include "cppinterp/Interpreter/InvocationOptions.h"
+#include "cppinterp/Interpreter/Transaction.h"
+#include "cppinterp/Interpreter/TransactionProfiler.h"
+#include "cppinterp/Utils/Output.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/DynamicLibrary.h"
+
+namespace {
+
+/// 每次编译时从IncrementalJIT读取当前的目标文件缓存，
+/// 因此缓存可以在LLJIT创建之后再设置。
+class CachingCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+  cppinterp::IncrementalJIT& jit_;
+
+ public:
+  CachingCompiler(cppinterp::IncrementalJIT& jit)
+      : IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(
+            jit.getTargetMachine().Options)),
+        jit_(jit) {}
+
+  llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(
+      llvm::Module& module) override {
+    cppinterp::TransactionProfiler::PhaseRAII phase(
+        cppinterp::TransactionProfiler::kJITLink);
+
+    // 单线程模式下编译总是在解释器线程上进行，可以直接修改tm_。
+    int opt_level = cppinterp::BackendPasses::getModuleOptLevel(module);
+    if (opt_level >= 0) {
+      jit_.getTargetMachine().setOptLevel(
+          cppinterp::BackendPasses::getCodeGenOptLevel(opt_level));
+    }
+
+    // 命中时SimpleCompiler直接返回缓存的目标文件，未命中时编译并回写缓存。
+    llvm::orc::SimpleCompiler compiler(jit_.getTargetMachine(),
+                                       jit_.getObjectCache());
+    auto obj = compiler(module);
+    if (!obj) {
+      if (cppinterp::IncrementalObjectCache* cache = jit_.getObjectCache()) {
+        cache->notifyCompileFailed(&module);
+      }
+      return obj;
+    }
+    cppinterp::TransactionProfiler::addObjectSize((*obj)->getBufferSize());
+    if (jit_.isRecordingObjects()) {
+      jit_.recordObject(module, **obj);
+    }
+    return obj;
+  }
+};
+
+/// 并发模式下的编译器：每个模块创建自己的TargetMachine，
+/// 因为TargetMachine不是线程安全的，且tm_的OptLevel随时可能被下一个事务修改。
+class ConcurrentCachingCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+  cppinterp::IncrementalJIT& jit_;
+  llvm::orc::JITTargetMachineBuilder jtmb_;
+
+ public:
+  ConcurrentCachingCompiler(cppinterp::IncrementalJIT& jit,
+                            llvm::orc::JITTargetMachineBuilder jtmb)
+      : IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(
+            jtmb.getOptions())),
+        jit_(jit),
+        jtmb_(std::move(jtmb)) {}
+
+  llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(
+      llvm::Module& module) override {
+    llvm::orc::JITTargetMachineBuilder jtmb = jtmb_;
+    int opt_level = cppinterp::BackendPasses::getModuleOptLevel(module);
+    if (opt_level >= 0) {
+      jtmb.setCodeGenOptLevel(
+          cppinterp::BackendPasses::getCodeGenOptLevel(opt_level));
+    }
+
+    auto tm = jtmb.createTargetMachine();
+    if (!tm) {
+      return tm.takeError();
+    }
+    // 在编译线程上运行时没有当前记录，目标文件的大小不会被统计。
+    llvm::orc::SimpleCompiler compiler(**tm, jit_.getObjectCache());
+    auto obj = compiler(module);
+    if (!obj) {
+      if (cppinterp::IncrementalObjectCache* cache = jit_.getObjectCache()) {
+        cache->notifyCompileFailed(&module);
+      }
+      return obj;
+    }
+    cppinterp::TransactionProfiler::addObjectSize((*obj)->getBufferSize());
+    if (jit_.isRecordingObjects()) {
+      jit_.recordObject(module, **obj);
+    }
+    return obj;
+  }
+};
+
+/// 与LLJIT的默认选择一致：MachO上的arm64和x86_64使用JITLink。
+bool UseJITLink(const llvm::Triple& triple) {
+  return triple.isOSBinFormatMachO() &&
+         (triple.getArch() == llvm::Triple::aarch64 ||
+          triple.getArch() == llvm::Triple::x86_64);
+}
+
+/// 为宿主创建TargetMachine，codegen优化级别取自CodeGenOptions，
+/// 之后由BackendPasses按事务修改。
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>> CreateHostTargetMachine(
+    const clang::CompilerInstance& ci, bool jit_link) {
+  auto jtmb = llvm::orc::JITTargetMachineBuilder::detectHost();
+  if (!jtmb) {
+    return jtmb.takeError();
+  }
+  jtmb->setCodeGenOptLevel(cppinterp::BackendPasses::getCodeGenOptLevel(
+      ci.getCodeGenOpts().OptimizationLevel));
+  if (jit_link) {
+    jtmb->setRelocationModel(llvm::Reloc::PIC_);
+  }
+  return jtmb->createTargetMachine();
+}
+
+}  // namespace
+
+namespace cppinterp {
+
+IncrementalJIT::IncrementalJIT(
+    IncrementalExecutor& /*executor*/, const clang::CompilerInstance& ci,
+    const InvocationOptions& opts,
+    std::unique_ptr<llvm::orc::ExecutorProcessControl> epc, llvm::Error& err,
+    void* extra_lib_handle, bool verbose)
+    : skip_host_process_lookup_(false),
+      jit_link_(UseJITLink(ci.getTarget().getTriple())),
+      single_threaded_context_(std::make_unique<llvm::LLVMContext>()) {
+  llvm::ErrorAsOutParameter _(&err);
+
+  auto tm = CreateHostTargetMachine(ci, jit_link_);
+  if (!tm) {
+    err = tm.takeError();
+    return;
+  }
+  tm_ = std::move(*tm);
+
+  if (llvm::Error jit_err =
+          createJIT(opts, ci.getCodeGenOpts(), std::move(epc))) {
+    err = std::move(jit_err);
+    return;
+  }
+
+  // 宿主进程和额外的库中的符号，skip_host_process_lookup_被锁定时和
+  // forbid_dl_symbols_中的符号除外。
+  const char prefix = jit_->getDataLayout().getGlobalPrefix();
+  auto filter = [this, skip = skip_host_process_lookup_](
+                    const llvm::orc::SymbolStringPtr& sym) {
+    return !skip && !forbid_dl_symbols_.contains(*sym);
+  };
+  auto host_lookup =
+      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(prefix,
+                                                                     filter);
+  if (!host_lookup) {
+    err = host_lookup.takeError();
+    return;
+  }
+  jit_->getMainJITDylib().addGenerator(std::move(*host_lookup));
+  if (extra_lib_handle) {
+    jit_->getMainJITDylib().addGenerator(
+        std::make_unique<llvm::orc::DynamicLibrarySearchGenerator>(
+            llvm::sys::DynamicLibrary(extra_lib_handle), prefix, filter));
+  }
+
+  jit_->getExecutionSession().setErrorReporter([verbose](llvm::Error error) {
+    // 未解析的符号由查找包装函数的调用者报告，只在verbose时打印。
+    if (!verbose) {
+      error = llvm::handleErrors(
+          std::move(error),
+          [](std::unique_ptr<llvm::orc::SymbolsNotFound>) -> llvm::Error {
+            return llvm::Error::success();
+          });
+    }
+    llvm::logAllUnhandledErrors(std::move(error), cppinterp::errs(),
+                                "cppinterp: JIT session error: ");
+  });
+}
+
+IncrementalJIT::~IncrementalJIT() {}
+
+void IncrementalJIT::addModule(Transaction& transaction) {
+  // 代码生成没有设置context时，模块在单线程的context中创建。
+  llvm::orc::ThreadSafeContext context = transaction.getModuleContext();
+  if (!context.getContext()) {
+    context = single_threaded_context_;
+  }
+  llvm::orc::ThreadSafeModule tsm(transaction.takeModule(),
+                                  std::move(context));
+  transaction.compiled_module_ = tsm.getModuleUnlocked();
+
+  llvm::orc::ResourceTrackerSP rt =
+      jit_->getMainJITDylib().createResourceTracker();
+  {
+    std::lock_guard<std::mutex> lock(compiled_modules_mutex_);
+    resource_trackers_[&transaction] = rt;
+  }
+  if (llvm::Error err =
+          addTransactionModule(transaction, std::move(rt), std::move(tsm))) {
+    llvm::logAllUnhandledErrors(std::move(err), cppinterp::errs(),
+                                "cppinterp: cannot add module: ");
+  }
+}
+
+llvm::orc::ThreadSafeContext IncrementalJIT::getModuleContext() {
+  if (!isConcurrent()) {
+    return single_threaded_context_;
+  }
+  return llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+}
+
+llvm::orc::JITTargetMachineBuilder IncrementalJIT::getTargetMachineBuilder()
+    const {
+  llvm::orc::JITTargetMachineBuilder jtmb(tm_->getTargetTriple());
+  jtmb.setCPU(tm_->getTargetCPU().str());
+  jtmb.getFeatures() = llvm::SubtargetFeatures(tm_->getTargetFeatureString());
+  jtmb.setCodeModel(tm_->getCodeModel());
+  jtmb.setRelocationModel(tm_->getRelocationModel());
+  jtmb.getOptions() = tm_->Options;
+  return jtmb;
+}
+
+llvm::Error IncrementalJIT::addObjectFile(
+    std::unique_ptr<llvm::MemoryBuffer> obj) {
+  return jit_->addObjectFile(std::move(obj));
+}
+
+llvm::Error IncrementalJIT::addObjectFile(
+    llvm::orc::ResourceTrackerSP rt, std::unique_ptr<llvm::MemoryBuffer> obj) {
+  return jit_->addObjectFile(std::move(rt), std::move(obj));
+}
+
+llvm::Error IncrementalJIT::addTransactionModule(
+    const Transaction& transaction, llvm::orc::ResourceTrackerSP rt,
+    llvm::orc::ThreadSafeModule tsm) {
+  TransactionProfiler::setTransaction(transaction);
+  TransactionProfiler::PhaseRAII phase(TransactionProfiler::kJITLink);
+  tsm.withModuleDo([&](llvm::Module& module) {
+    symbol_index_.addModuleSymbols(transaction, module);
+    if (tiered_compiler_) {
+      tiered_compiler_->addTransactionModule(
+          transaction, module.getModuleIdentifier(), rt);
+    }
+  });
+
+  if (!isLazy()) {
+    if (!isRecordingObjects()) {
+      if (llvm::Error err = jit_->addIRModule(std::move(rt), std::move(tsm))) {
+        return err;
+      }
+      return compileWrapper(transaction);
+    }
+
+    // 查找模块定义的任意一个符号会编译整个模块，目标文件随即被记录。
+    std::string module_name;
+    std::string defined_symbol;
+    tsm.withModuleDo([&](llvm::Module& module) {
+      module_name = module.getModuleIdentifier();
+      for (const llvm::GlobalValue& gv : module.global_values()) {
+        if (!gv.isDeclaration() && !gv.hasLocalLinkage() && gv.hasName()) {
+          defined_symbol = gv.getName().str();
+          break;
+        }
+      }
+    });
+    {
+      std::lock_guard<std::mutex> lock(recorded_objects_mutex_);
+      transaction_modules_[&transaction] = module_name;
+    }
+    if (llvm::Error err = jit_->addIRModule(std::move(rt), std::move(tsm))) {
+      return err;
+    }
+    if (defined_symbol.empty()) {
+      // 没有可以链接的定义，不会被编译；记录一个空的结果。
+      std::lock_guard<std::mutex> lock(recorded_objects_mutex_);
+      recorded_objects_[module_name].sequence = next_record_sequence_++;
+      return llvm::Error::success();
+    }
+    return jit_->lookup(defined_symbol).takeError();
+  }
+
+  auto& lazy_jit = static_cast<llvm::orc::LLLazyJIT&>(*jit_);
+  if (llvm::Error err = lazy_jit.getCompileOnDemandLayer().add(
+          std::move(rt), std::move(tsm))) {
+    return err;
+  }
+  return compileWrapper(transaction);
+}
+
+llvm::Error IncrementalJIT::compileWrapper(const Transaction& transaction) {
+  // 包装函数马上就会被RunFunction调用，立即编译它，
+  // 这样编译错误和未解析的符号在提交事务时就能被报告，
+  // 编译时间(并发模式下是等待编译线程的时间)也计入jit-link阶段。
+  const clang::FunctionDecl* wrapper = transaction.getWrapperFD();
+  if (!ast::analyze::IsWrapper(wrapper)) {
+    return llvm::Error::success();
+  }
+  std::string wrapper_name;
+  ast::analyze::MaybeMangleDeclName(clang::GlobalDecl(wrapper), wrapper_name);
+  return jit_->lookup(wrapper_name).takeError();
+}
+
+llvm::Error IncrementalJIT::runCtors() const {
+  TransactionProfiler::PhaseRAII phase(TransactionProfiler::kStaticInit);
+  return jit_->initialize(jit_->getMainJITDylib());
+}
+
+/// 按IR对象的个数估算模块占用的内存。
+static uint64_t EstimateModuleMemory(const llvm::Module& module) {
+  uint64_t bytes = sizeof(llvm::Module);
+  bytes += module.global_size() * sizeof(llvm::GlobalVariable);
+  for (const llvm::Function& function : module) {
+    bytes += sizeof(llvm::Function) +
+             function.arg_size() * sizeof(llvm::Argument);
+    for (const llvm::BasicBlock& block : function) {
+      bytes += sizeof(llvm::BasicBlock);
+      for (const llvm::Instruction& inst : block) {
+        bytes += sizeof(llvm::Instruction) +
+                 inst.getNumOperands() * sizeof(llvm::Use);
+      }
+    }
+  }
+  return bytes;
+}
+
+void IncrementalJIT::installCompiledModuleHandler() {
+  jit_->getIRCompileLayer().setNotifyCompiled(
+      [this](llvm::orc::MaterializationResponsibility&,
+             llvm::orc::ThreadSafeModule tsm) {
+        onModuleCompiled(std::move(tsm));
+      });
+}
+
+void IncrementalJIT::onModuleCompiled(llvm::orc::ThreadSafeModule tsm) {
+  const llvm::Module* module = nullptr;
+  uint64_t bytes = 0;
+  tsm.withModuleDo([&](llvm::Module& m) {
+    module = &m;
+    bytes = EstimateModuleMemory(m);
+  });
+
+  std::lock_guard<std::mutex> lock(compiled_modules_mutex_);
+  if (release_ir_) {
+    // tsm在返回时被销毁，IR随之释放。
+    ++ir_stats_.modules_released;
+    ir_stats_.bytes_released += bytes;
+    return;
+  }
+  ++ir_stats_.modules_retained;
+  ir_stats_.bytes_retained += bytes;
+  compiled_modules_[module] = std::move(tsm);
+}
+
+uint64_t IncrementalJIT::releaseCompiledModules() {
+  std::map<const llvm::Module*, llvm::orc::ThreadSafeModule> modules;
+  uint64_t bytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(compiled_modules_mutex_);
+    modules.swap(compiled_modules_);
+    bytes = ir_stats_.bytes_retained;
+    ir_stats_.modules_released += ir_stats_.modules_retained;
+    ir_stats_.bytes_released += bytes;
+    ir_stats_.modules_retained = 0;
+    ir_stats_.bytes_retained = 0;
+  }
+  // 在锁外销毁：销毁模块需要获取其context的锁。
+  modules.clear();
+  return bytes;
+}
+
+IncrementalJIT::IRMemoryStatistics IncrementalJIT::getIRMemoryStatistics()
+    const {
+  std::lock_guard<std::mutex> lock(compiled_modules_mutex_);
+  return ir_stats_;
+}
+
+void IncrementalJIT::recordObject(const llvm::Module& module,
+                                  const llvm::MemoryBuffer& obj) {
+  RecordedObject recorded;
+  recorded.object = llvm::MemoryBuffer::getMemBufferCopy(
+      obj.getBuffer(), module.getModuleIdentifier());
+
+  std::vector<llvm::orc::CtorDtorIterator::Element> ctors;
+  for (auto ctor : llvm::orc::getConstructors(module)) {
+    if (ctor.Func && !ctor.Func->hasLocalLinkage()) {
+      ctors.push_back(ctor);
+    }
+  }
+  std::stable_sort(ctors.begin(), ctors.end(),
+                   [](const auto& lhs, const auto& rhs) {
+                     return lhs.Priority < rhs.Priority;
+                   });
+  for (const auto& ctor : ctors) {
+    recorded.ctors.push_back(ctor.Func->getName().str());
+  }
+
+  std::lock_guard<std::mutex> lock(recorded_objects_mutex_);
+  recorded.sequence = next_record_sequence_++;
+  recorded_objects_[module.getModuleIdentifier()] = std::move(recorded);
+}
+
+const IncrementalJIT::RecordedObject* IncrementalJIT::getRecordedObject(
+    const Transaction& transaction) const {
+  std::lock_guard<std::mutex> lock(recorded_objects_mutex_);
+  auto module = transaction_modules_.find(&transaction);
+  if (module == transaction_modules_.end()) {
+    return nullptr;
+  }
+  auto it = recorded_objects_.find(module->second);
+  return it == recorded_objects_.end() ? nullptr : &it->second;
+}
+
+llvm::Error IncrementalJIT::addRestoredObject(
+    std::unique_ptr<llvm::MemoryBuffer> obj) {
+  auto obj_file =
+      llvm::object::ObjectFile::createObjectFile(obj->getMemBufferRef());
+  if (!obj_file) {
+    return obj_file.takeError();
+  }
+
+  // 目标文件中的名称带有链接器前缀，而BackendPasses查询的是IR名称。
+  // 弱符号不需要记录：ReuseExistingWeakSymbols会复用已经存在的弱定义。
+  const char prefix = jit_->getDataLayout().getGlobalPrefix();
+  for (const llvm::object::SymbolRef& sym : (*obj_file)->symbols()) {
+    auto flags = sym.getFlags();
+    if (!flags) {
+      return flags.takeError();
+    }
+    if (!(*flags & llvm::object::SymbolRef::SF_Global) ||
+        (*flags & (llvm::object::SymbolRef::SF_Undefined |
+                   llvm::object::SymbolRef::SF_Weak))) {
+      continue;
+    }
+    auto name = sym.getName();
+    if (!name) {
+      return name.takeError();
+    }
+    llvm::StringRef ir_name = *name;
+    if (prefix && ir_name.startswith(llvm::StringRef(&prefix, 1))) {
+      ir_name = ir_name.drop_front();
+    }
+    restored_symbols_.insert(ir_name);
+  }
+
+  if (!restored_rt_) {
+    restored_rt_ = jit_->getMainJITDylib().createResourceTracker();
+  }
+  return jit_->addObjectFile(restored_rt_, std::move(obj));
+}
+
+llvm::Error IncrementalJIT::removeRestoredObjects() {
+  restored_symbols_.clear();
+  if (!restored_rt_) {
+    return llvm::Error::success();
+  }
+  llvm::orc::ResourceTrackerSP rt = std::move(restored_rt_);
+  return rt->remove();
+}
+
+llvm::Error IncrementalJIT::removeModule(const Transaction& transaction) {
+  const Transaction* transactions[] = {&transaction};
+  return removeModules(transactions);
+}
+
+bool IncrementalJIT::doesSymbolAlreadyExist(llvm::StringRef unmangled_name) {
+  return symbol_index_.isDefinedInJIT(unmangled_name);
+}
+
+llvm::Error IncrementalJIT::removeModules(
+    llvm::ArrayRef<const Transaction*> transactions) {
+  if (tiered_compiler_) {
+    tiered_compiler_->removeTransactions(transactions);
+  }
+  llvm::orc::ResourceTrackerSP bulk =
+      jit_->getMainJITDylib().createResourceTracker();
+  std::vector<llvm::orc::ThreadSafeModule> modules;
+  {
+    std::lock_guard<std::mutex> lock(compiled_modules_mutex_);
+    for (const Transaction* transaction : transactions) {
+      symbol_index_.removeModuleSymbols(*transaction);
+      auto rt = resource_trackers_.find(transaction);
+      if (rt != resource_trackers_.end()) {
+        rt->second->transferTo(*bulk);
+        resource_trackers_.erase(rt);
+      }
+      auto module = compiled_modules_.find(transaction->getCompiledModule());
+      if (module != compiled_modules_.end()) {
+        modules.push_back(std::move(module->second));
+        compiled_modules_.erase(module);
+      }
+    }
+  }
+  // 在锁外估算和销毁：访问模块需要获取其context的锁。
+  uint64_t bytes = 0;
+  for (llvm::orc::ThreadSafeModule& tsm : modules) {
+    tsm.withModuleDo(
+        [&](llvm::Module& module) { bytes += EstimateModuleMemory(module); });
+  }
+  if (!modules.empty()) {
+    std::lock_guard<std::mutex> lock(compiled_modules_mutex_);
+    ir_stats_.modules_retained -= modules.size();
+    ir_stats_.bytes_retained -= std::min(bytes, ir_stats_.bytes_retained);
+  }
+  modules.clear();
+
+  {
+    std::lock_guard<std::mutex> lock(recorded_objects_mutex_);
+    for (const Transaction* transaction : transactions) {
+      auto module = transaction_modules_.find(transaction);
+      if (module != transaction_modules_.end()) {
+        recorded_objects_.erase(module->second);
+        transaction_modules_.erase(module);
+      }
+    }
+  }
+  return bulk->remove();
+}
+
+llvm::Error IncrementalJIT::createJIT(
+    const InvocationOptions& opts, const clang::CodeGenOptions& cgopts,
+    std::unique_ptr<llvm::orc::ExecutorProcessControl> epc) {
+  compile_threads_ = opts.CompileThreads;
+  lazy_compilation_ = opts.LazyCompilation;
+  release_ir_ = opts.ReleaseIRAfterJIT;
+  // 编译器在编译时查询object_cache_，必须在创建jit_之前设置。
+  if (!object_cache_) {
+    object_cache_ = IncrementalObjectCache::Create(opts.CompilerOpts, *tm_);
+  }
+
+  auto create = [&](auto& builder) -> llvm::Error {
+    builder.setExecutorProcessControl(std::move(epc));
+    builder.setJITTargetMachineBuilder(getTargetMachineBuilder());
+    builder.setDataLayout(tm_->createDataLayout());
+    configureBuilder(builder);
+    auto jit = builder.create();
+    if (!jit) {
+      return jit.takeError();
+    }
+    jit_ = std::move(*jit);
+    return llvm::Error::success();
+  };
+  llvm::orc::LLJITBuilder builder;
+  llvm::orc::LLLazyJITBuilder lazy_builder;
+  if (llvm::Error err = isLazy() ? create(lazy_builder) : create(builder)) {
+    return err;
+  }
+  installCompiledModuleHandler();
+
+  if (opts.TierUpThreshold) {
+    tiered_compiler_ = std::make_unique<TieredCompiler>(
+        *this, cgopts, opts.TierUpThreshold, opts.TierUpOptLevel);
+  }
+  return llvm::Error::success();
+}
+
+void IncrementalJIT::setObjectCache(
+    std::unique_ptr<IncrementalObjectCache> cache) {
+  object_cache_ = std::move(cache);
+}
+
+std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>
+IncrementalJIT::createCompiler() {
+  if (isConcurrent()) {
+    return std::make_unique<ConcurrentCachingCompiler>(
+        *this, getTargetMachineBuilder());
+  }
+  return std::make_unique<CachingCompiler>(*this);
+}
+
+}  // namespace cppinterp
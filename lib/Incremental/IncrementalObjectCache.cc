@@ -0,0 +1,270 @@
+#include "cppinterp/Incremental/IncrementalObjectCache.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "cppinterp/Incremental/BackendPasses.h"
+#include "cppinterp/Interpreter/InvocationOptions.h"
+#include "cppinterp/Utils/Output.h"
+#include "cppinterp/Utils/Paths.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+namespace cppinterp {
+
+namespace {
+/// 缓存文件的后缀，扫描目录时只考虑这些文件。
+const char* const kObjectSuffix = ".o";
+
+/// 缓存格式的版本，修改键的计算方式时需要递增。
+const char* const kCacheVersion = "cppinterp-objcache-4";
+
+/// 把ir中第一个以prefix开头的行的其余部分替换为占位符。
+void MaskLine(std::string& ir, llvm::StringRef prefix) {
+  size_t pos = 0;
+  while (ir.compare(pos, prefix.size(), prefix.data(), prefix.size()) != 0) {
+    pos = ir.find('\n', pos);
+    if (pos == std::string::npos) {
+      return;
+    }
+    ++pos;
+  }
+  pos += prefix.size();
+  size_t end = ir.find('\n', pos);
+  ir.replace(pos, end == std::string::npos ? end : end - pos, "<module>");
+}
+}  // namespace
+
+IncrementalObjectCache::IncrementalObjectCache(llvm::StringRef dir,
+                                               uint64_t max_bytes,
+                                               const llvm::TargetMachine& tm)
+    : dir_(dir.str()), max_bytes_(max_bytes), tm_(tm) {}
+
+IncrementalObjectCache::~IncrementalObjectCache() {}
+
+std::unique_ptr<IncrementalObjectCache> IncrementalObjectCache::Create(
+    const CompilerOptions& opts, const llvm::TargetMachine& tm) {
+  if (opts.CachePath.empty() || !opts.ObjectCacheSize) {
+    return nullptr;
+  }
+
+  llvm::SmallString<256> dir(opts.CachePath);
+  llvm::sys::path::append(dir, "objects");
+  if (std::error_code ec = llvm::sys::fs::create_directories(dir)) {
+    cppinterp::errs() << "cppinterp: cannot create object cache directory '"
+                      << dir << "': " << ec.message() << "\n";
+    return nullptr;
+  }
+
+  return std::make_unique<IncrementalObjectCache>(dir, opts.ObjectCacheSize,
+                                                  tm);
+}
+
+std::string IncrementalObjectCache::computeKey(
+    const llvm::Module& module) const {
+  // 优化级别取自模块本身：并发编译时tm_的OptLevel可能已经属于下一个事务。
+  // 没有经过BackendPasses的模块不被缓存。
+  int opt_level = BackendPasses::getModuleOptLevel(module);
+  if (opt_level < 0) {
+    return std::string();
+  }
+
+  // 模块名每个事务都不同。只替换ModuleID和source_filename中的模块名，
+  // 它们不影响目标文件。由模块名派生的符号(例如动态初始化函数
+  // _GLOBAL__sub_I_<模块名>)保留在键中：目标文件定义的正是这些名字，
+  // 不同名字的模块共用一个条目会缺少定义，或者绑定到旧事务的符号。
+  // 直接打印原模块(不克隆)。
+  std::string ir;
+  {
+    llvm::raw_string_ostream os(ir);
+    module.print(os, /*AAW=*/nullptr);
+  }
+  MaskLine(ir, "; ModuleID = ");
+  MaskLine(ir, "source_filename = ");
+
+  llvm::SHA1 hasher;
+  hasher.update(kCacheVersion);
+  hasher.update(llvm::StringRef("\0", 1));
+  hasher.update(tm_.getTargetTriple().str());
+  hasher.update(llvm::StringRef("\0", 1));
+  hasher.update(tm_.getTargetCPU());
+  hasher.update(llvm::StringRef("\0", 1));
+  hasher.update(tm_.getTargetFeatureString());
+  hasher.update(llvm::StringRef("\0", 1));
+  hasher.update(llvm::utostr(opt_level));
+  hasher.update(llvm::StringRef("\0", 1));
+  hasher.update(ir);
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+std::string IncrementalObjectCache::getEntryPath(llvm::StringRef key) const {
+  llvm::SmallString<256> path(dir_);
+  llvm::sys::path::append(path, key + kObjectSuffix);
+  return path.str().str();
+}
+
+void IncrementalObjectCache::loadEntries() {
+  if (entries_loaded_) {
+    return;
+  }
+  entries_loaded_ = true;
+
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator it(dir_, ec), end; it != end && !ec;
+       it.increment(ec)) {
+    llvm::StringRef file_name = llvm::sys::path::filename(it->path());
+    if (!file_name.endswith(kObjectSuffix)) {
+      continue;
+    }
+
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(it->path(), status) ||
+        status.type() != llvm::sys::fs::file_type::regular_file) {
+      continue;
+    }
+
+    // 以修改时间作为最近使用时间：命中时会更新它，而atime在noatime挂载下不可靠。
+    Entry& entry = entries_[file_name.drop_back(2).str()];
+    entry.size = status.getSize();
+    entry.last_use = status.getLastModificationTime();
+    total_bytes_ += entry.size;
+  }
+}
+
+void IncrementalObjectCache::evict() {
+  if (total_bytes_ <= max_bytes_) {
+    return;
+  }
+
+  std::vector<std::map<std::string, Entry>::iterator> lru;
+  lru.reserve(entries_.size());
+  for (auto it = entries_.begin(), end = entries_.end(); it != end; ++it) {
+    lru.push_back(it);
+  }
+  std::sort(lru.begin(), lru.end(), [](const auto& lhs, const auto& rhs) {
+    return lhs->second.last_use < rhs->second.last_use;
+  });
+
+  for (auto it : lru) {
+    if (total_bytes_ <= max_bytes_) {
+      break;
+    }
+    llvm::sys::fs::remove(getEntryPath(it->first));
+    total_bytes_ -= it->second.size;
+    ++stats_.evictions;
+    stats_.bytes_evicted += it->second.size;
+    entries_.erase(it);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> IncrementalObjectCache::getObject(
+    const llvm::Module* module) {
+  std::string key = computeKey(*module);
+  if (key.empty()) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  loadEntries();
+
+  auto entry = entries_.find(key);
+  if (entry != entries_.end()) {
+    std::string path = getEntryPath(key);
+    int fd;
+    if (!llvm::sys::fs::openFileForRead(path, fd)) {
+      llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+          llvm::MemoryBuffer::getOpenFile(
+              llvm::sys::fs::convertFDToNativeFile(fd), path,
+              /*FileSize=*/-1, /*RequiresNullTerminator=*/false);
+      if (buffer) {
+        entry->second.last_use = std::chrono::system_clock::now();
+        llvm::sys::fs::setLastAccessAndModificationTime(
+            fd, entry->second.last_use);
+        llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+        ++stats_.hits;
+        stats_.bytes_read += (*buffer)->getBufferSize();
+        return std::move(*buffer);
+      }
+      llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    }
+
+    // 文件被外部删除或无法读取：丢弃索引条目，按未命中处理。
+    total_bytes_ -= entry->second.size;
+    entries_.erase(entry);
+  }
+
+  ++stats_.misses;
+  pending_keys_[module] = std::move(key);
+  return nullptr;
+}
+
+void IncrementalObjectCache::notifyCompileFailed(const llvm::Module* module) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_keys_.erase(module);
+}
+
+void IncrementalObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                                  llvm::MemoryBufferRef obj) {
+  std::string key;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto pending = pending_keys_.find(module);
+    if (pending != pending_keys_.end()) {
+      key = std::move(pending->second);
+      pending_keys_.erase(pending);
+    }
+  }
+  if (key.empty()) {
+    key = computeKey(*module);
+    if (key.empty()) {
+      return;
+    }
+  }
+
+  // 其他进程永远不会读到写了一半的目标文件。
+  if (!utils::WriteFileAtomically(getEntryPath(key), obj.getBuffer())) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  loadEntries();
+  Entry& entry = entries_[key];
+  total_bytes_ -= entry.size;
+  entry.size = obj.getBufferSize();
+  entry.last_use = std::chrono::system_clock::now();
+  total_bytes_ += entry.size;
+  stats_.bytes_written += entry.size;
+  evict();
+}
+
+uint64_t IncrementalObjectCache::getTotalBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return total_bytes_;
+}
+
+IncrementalObjectCache::Statistics IncrementalObjectCache::getStatistics()
+    const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void IncrementalObjectCache::dump(llvm::raw_ostream& out) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  out << "Object cache '" << dir_ << "': " << entries_.size() << " entries, "
+      << total_bytes_ << "/" << max_bytes_ << " bytes\n"
+      << "  hits: " << stats_.hits << ", misses: " << stats_.misses << "\n"
+      << "  bytes read: " << stats_.bytes_read
+      << ", bytes written: " << stats_.bytes_written << "\n"
+      << "  evictions: " << stats_.evictions << " (" << stats_.bytes_evicted
+      << " bytes)\n";
+}
+
+}  // namespace cppinterp
@@ -0,0 +1,47 @@
+#include "cppinterp/Incremental/IncrementalParser.h"
+
+#include <cassert>
+
+#include "cppinterp/Interpreter/Transaction.h"
+#include "cppinterp/Interpreter/TransactionPool.h"
+#include "llvm/ADT/DenseSet.h"
+
+namespace cppinterp {
+
+bool IncrementalParser::getTransactionsAfter(
+    unsigned point_id, std::vector<Transaction*>& out) const {
+  size_t first = out.size();
+  for (auto it = transactions_.rbegin(); it != transactions_.rend(); ++it) {
+    if ((*it)->getUniqueID() == point_id) {
+      return true;
+    }
+    out.push_back(*it);
+  }
+  if (!point_id) {
+    return true;
+  }
+  out.resize(first);
+  return false;
+}
+
+void IncrementalParser::popTransactions(size_t count) {
+  assert(count <= transactions_.size() && "Popping too many transactions");
+  llvm::DenseSet<clang::FileID> buffers;
+  for (size_t i = 0; i < count; ++i) {
+    Transaction* transaction = transactions_.back();
+    transactions_.pop_back();
+    if (transaction->getBufferFID().isValid()) {
+      buffers.insert(transaction->getBufferFID());
+    }
+    transaction_pool_->releaseTransaction(transaction);
+  }
+
+  // 缓冲区按输入顺序排列，被移除的事务的缓冲区都在末尾。
+  // 缓冲区本身属于SourceManager，这里只丢弃条目。
+  while (!memory_buffers_.empty() &&
+         buffers.count(memory_buffers_.back().second)) {
+    memory_buffers_.pop_back();
+  }
+}
+
+}  // namespace cppinterp
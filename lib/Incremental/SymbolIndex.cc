@@ -0,0 +1,293 @@
+#include "cppinterp/Incremental/SymbolIndex.h"
+
+#include <link.h>
+
+#include <algorithm>
+#include <cstddef>
+
+#include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+namespace cppinterp {
+
+namespace {
+
+struct LoadCounts {
+  unsigned long long adds = 0;
+  unsigned long long subs = 0;
+};
+
+int ReadLoadCounts(dl_phdr_info* info, size_t size, void* data) {
+  auto* counts = static_cast<LoadCounts*>(data);
+  if (size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+    counts->adds = info->dlpi_adds;
+    counts->subs = info->dlpi_subs;
+  }
+  // 计数器对所有对象都相同，只需要第一个。
+  return 1;
+}
+
+/// 一个已加载对象导出的符号名，指向对象的字符串表。
+struct ExportedObject {
+  const void* id;
+  std::vector<llvm::StringRef> names;
+};
+
+/// 返回.gnu.hash描述的动态符号表的符号个数。
+size_t CountGnuHashSymbols(const uint32_t* gnu_hash) {
+  uint32_t num_buckets = gnu_hash[0];
+  uint32_t sym_offset = gnu_hash[1];
+  uint32_t bloom_size = gnu_hash[2];
+  const auto* bloom = reinterpret_cast<const ElfW(Addr)*>(gnu_hash + 4);
+  const auto* buckets = reinterpret_cast<const uint32_t*>(bloom + bloom_size);
+  const uint32_t* chain = buckets + num_buckets;
+
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < num_buckets; ++i) {
+    last = std::max(last, buckets[i]);
+  }
+  if (last < sym_offset) {
+    return sym_offset;
+  }
+  // 链的最后一个元素的最低位为1。
+  while (!(chain[last - sym_offset] & 1)) {
+    ++last;
+  }
+  return last + 1;
+}
+
+void CollectExports(const dl_phdr_info& info,
+                    std::vector<llvm::StringRef>& names) {
+  const ElfW(Dyn)* dynamic = nullptr;
+  for (ElfW(Half) i = 0; i < info.dlpi_phnum; ++i) {
+    if (info.dlpi_phdr[i].p_type == PT_DYNAMIC) {
+      dynamic = reinterpret_cast<const ElfW(Dyn)*>(info.dlpi_addr +
+                                                   info.dlpi_phdr[i].p_vaddr);
+      break;
+    }
+  }
+  if (!dynamic) {
+    return;
+  }
+
+  // 动态段中的地址通常已经被动态链接器重定位，vDSO等对象例外。
+  auto relocate = [&info](ElfW(Addr) ptr) {
+    return ptr < info.dlpi_addr ? ptr + info.dlpi_addr : ptr;
+  };
+  const ElfW(Sym)* symtab = nullptr;
+  const char* strtab = nullptr;
+  const uint32_t* hash = nullptr;
+  const uint32_t* gnu_hash = nullptr;
+  for (const ElfW(Dyn)* entry = dynamic; entry->d_tag != DT_NULL; ++entry) {
+    switch (entry->d_tag) {
+      case DT_SYMTAB:
+        symtab = reinterpret_cast<const ElfW(Sym)*>(
+            relocate(entry->d_un.d_ptr));
+        break;
+      case DT_STRTAB:
+        strtab = reinterpret_cast<const char*>(relocate(entry->d_un.d_ptr));
+        break;
+      case DT_HASH:
+        hash = reinterpret_cast<const uint32_t*>(relocate(entry->d_un.d_ptr));
+        break;
+      case DT_GNU_HASH:
+        gnu_hash =
+            reinterpret_cast<const uint32_t*>(relocate(entry->d_un.d_ptr));
+        break;
+    }
+  }
+  if (!symtab || !strtab || (!hash && !gnu_hash)) {
+    return;
+  }
+
+  // DT_HASH的nchain等于符号个数。
+  size_t num_symbols = hash ? hash[1] : CountGnuHashSymbols(gnu_hash);
+  for (size_t i = 1; i < num_symbols; ++i) {
+    const ElfW(Sym)& sym = symtab[i];
+    unsigned bind = sym.st_info >> 4;
+    unsigned type = sym.st_info & 0xf;
+    if (sym.st_shndx == SHN_UNDEF || !sym.st_name ||
+        (bind != STB_GLOBAL && bind != STB_WEAK && bind != STB_GNU_UNIQUE) ||
+        type == STT_SECTION || type == STT_FILE) {
+      continue;
+    }
+    names.push_back(strtab + sym.st_name);
+  }
+}
+
+struct CollectContext {
+  const llvm::DenseSet<const void*>& indexed;
+  std::vector<ExportedObject>& objects;
+};
+
+int CollectNewObjects(dl_phdr_info* info, size_t, void* data) {
+  auto* ctx = static_cast<CollectContext*>(data);
+  if (ctx->indexed.count(info->dlpi_phdr)) {
+    return 0;
+  }
+  ctx->objects.push_back({info->dlpi_phdr, {}});
+  CollectExports(*info, ctx->objects.back().names);
+  return 0;
+}
+
+uint64_t CountSymbols(const std::vector<ExportedObject>& objects) {
+  uint64_t count = 0;
+  for (const ExportedObject& object : objects) {
+    count += object.names.size();
+  }
+  return count;
+}
+
+}  // namespace
+
+void SymbolIndex::addModuleSymbols(const Transaction& transaction,
+                                   const llvm::Module& module) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& symbols = transaction_symbols_[&transaction];
+  for (const llvm::GlobalValue& gv : module.global_values()) {
+    if (gv.isDeclaration() || gv.hasLocalLinkage() || !gv.hasName()) {
+      continue;
+    }
+    auto entry = jit_symbols_.try_emplace(gv.getName(), 0).first;
+    ++entry->second;
+    symbols.push_back(&*entry);
+  }
+}
+
+void SymbolIndex::removeModuleSymbols(const Transaction& transaction) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = transaction_symbols_.find(&transaction);
+  if (it == transaction_symbols_.end()) {
+    return;
+  }
+  for (llvm::StringMapEntry<unsigned>* entry : it->second) {
+    if (--entry->second == 0) {
+      jit_symbols_.erase(entry->getKey());
+    }
+  }
+  transaction_symbols_.erase(it);
+}
+
+bool SymbolIndex::isDefinedInJIT(llvm::StringRef name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return jit_symbols_.count(name);
+}
+
+void SymbolIndex::refresh() {
+  LoadCounts counts;
+  dl_iterate_phdr(&ReadLoadCounts, &counts);
+  if (!filter_.empty() && counts.adds == loads_ && counts.subs == unloads_) {
+    return;
+  }
+  // 过滤器无法删除元素，有对象被卸载时重新构建。
+  bool rebuild_filter = filter_.empty() || counts.subs != unloads_;
+  loads_ = counts.adds;
+  unloads_ = counts.subs;
+  host_cache_.clear();
+
+  std::vector<ExportedObject> objects;
+  if (!rebuild_filter) {
+    CollectContext ctx{indexed_objects_, objects};
+    dl_iterate_phdr(&CollectNewObjects, &ctx);
+    uint64_t symbols = stats_.host_symbols + CountSymbols(objects);
+    rebuild_filter = stats_.filter_bits < symbols * kMinBitsPerSymbol;
+  }
+  if (rebuild_filter) {
+    indexed_objects_.clear();
+    stats_.host_symbols = 0;
+    stats_.host_objects = 0;
+    objects.clear();
+    CollectContext ctx{indexed_objects_, objects};
+    dl_iterate_phdr(&CollectNewObjects, &ctx);
+    rebuild(CountSymbols(objects));
+  }
+
+  for (const ExportedObject& object : objects) {
+    indexed_objects_.insert(object.id);
+    ++stats_.host_objects;
+    stats_.host_symbols += object.names.size();
+    for (llvm::StringRef name : object.names) {
+      insert(name);
+    }
+  }
+}
+
+void SymbolIndex::rebuild(uint64_t expected_symbols) {
+  uint64_t bits = llvm::PowerOf2Ceil(
+      std::max<uint64_t>(expected_symbols * kBitsPerSymbol, 4096));
+  filter_.assign(bits / 64, 0);
+  stats_.filter_bits = bits;
+  ++stats_.rebuilds;
+}
+
+void SymbolIndex::insert(llvm::StringRef name) {
+  uint64_t hash = llvm::xxHash64(name);
+  uint64_t h1 = hash & 0xffffffff;
+  // 奇数步长保证在2的幂大小的过滤器中k个位置互不相同。
+  uint64_t h2 = (hash >> 32) | 1;
+  uint64_t mask = stats_.filter_bits - 1;
+  for (unsigned i = 0; i < kNumHashes; ++i) {
+    uint64_t bit = (h1 + i * h2) & mask;
+    filter_[bit / 64] |= uint64_t(1) << (bit % 64);
+  }
+}
+
+bool SymbolIndex::mayContain(llvm::StringRef name) const {
+  uint64_t hash = llvm::xxHash64(name);
+  uint64_t h1 = hash & 0xffffffff;
+  uint64_t h2 = (hash >> 32) | 1;
+  uint64_t mask = stats_.filter_bits - 1;
+  for (unsigned i = 0; i < kNumHashes; ++i) {
+    uint64_t bit = (h1 + i * h2) & mask;
+    if (!(filter_[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void* SymbolIndex::findHostSymbol(llvm::StringRef name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.host_lookups;
+  refresh();
+  if (!mayContain(name)) {
+    ++stats_.filtered;
+    return nullptr;
+  }
+
+  auto cached = host_cache_.find(name);
+  if (cached != host_cache_.end()) {
+    ++stats_.cache_hits;
+    return cached->second;
+  }
+  void* addr = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(name.str());
+  if (!addr) {
+    ++stats_.false_positives;
+  }
+  host_cache_[name] = addr;
+  return addr;
+}
+
+SymbolIndex::Statistics SymbolIndex::getStatistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Statistics stats = stats_;
+  stats.jit_symbols = jit_symbols_.size();
+  return stats;
+}
+
+void SymbolIndex::dump(llvm::raw_ostream& out) const {
+  Statistics stats = getStatistics();
+  out << "Symbol index: " << stats.jit_symbols << " JIT symbols, "
+      << stats.host_symbols << " host symbols in " << stats.host_objects
+      << " objects (" << stats.filter_bits << " filter bits, "
+      << stats.rebuilds << " rebuilds), " << stats.host_lookups
+      << " host lookups (" << stats.filtered << " filtered, "
+      << stats.cache_hits << " cached, " << stats.false_positives
+      << " false positives)\n";
+}
+
+}  // namespace cppinterp
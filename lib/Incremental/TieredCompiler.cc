@@ -0,0 +1,465 @@
+#include "cppinterp/Incremental/TieredCompiler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "clang/Basic/CodeGenOptions.h"
+#include "cppinterp/AST/AST.h"
+#include "cppinterp/Incremental/BackendPasses.h"
+#include "cppinterp/Incremental/IncrementalJIT.h"
+#include "cppinterp/Utils/Casting.h"
+#include "cppinterp/Utils/Output.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+namespace cppinterp {
+
+namespace {
+/// O0函数体的后缀。
+const char* const kImplSuffix = ".__tier0";
+/// 保存当前函数体地址的全局变量的后缀。
+const char* const kSlotSuffix = ".__tier_slot";
+/// 入口计数器的后缀。
+const char* const kCountSuffix = ".__tier_count";
+
+/// 跳板调用的运行时回调，通过IncrementalJIT::addOrReplaceDefinition注入。
+const char* const kTierUpHook = "__cppinterp_tier_up";
+/// 地址为TieredCompiler对象的符号，作为回调的第一个参数。
+const char* const kSelfSymbol = "__cppinterp_tiered_compiler";
+
+/// 小于该指令数的函数不值得插桩：跳板本身的开销与函数体相当。
+const unsigned kMinInstructions = 16;
+}  // namespace
+
+void TieredCompiler::TierUp(void* tiered_compiler, const char* name) {
+  static_cast<TieredCompiler*>(tiered_compiler)->requestTierUp(name);
+}
+
+TieredCompiler::TieredCompiler(IncrementalJIT& jit,
+                               const clang::CodeGenOptions& cgopts,
+                               unsigned threshold, int opt_level)
+    : jit_(jit),
+      cgopts_(cgopts),
+      threshold_(threshold ? threshold : 1),
+      opt_level_(opt_level < 1 ? 1 : (opt_level > 3 ? 3 : opt_level)) {
+  jit_.addOrReplaceDefinition(
+      kTierUpHook, reinterpret_cast<uintptr_t>(
+                       utils::FunctionToVoidPtr(&TieredCompiler::TierUp)));
+  jit_.addOrReplaceDefinition(kSelfSymbol, reinterpret_cast<uintptr_t>(this));
+  worker_ = std::thread(&TieredCompiler::run, this);
+}
+
+TieredCompiler::~TieredCompiler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  worker_.join();
+}
+
+bool TieredCompiler::isEligible(const llvm::Function& function) const {
+  // 弱定义(模板、内联函数)可能在多个模块中出现，它们的跳板变量会冲突。
+  if (function.isDeclaration() || !function.hasExternalLinkage()) {
+    return false;
+  }
+
+  // musttail要求调用者与被调用者的原型完全一致，可变参数函数无法转发。
+  if (function.isVarArg() || function.isIntrinsic()) {
+    return false;
+  }
+
+  if (function.hasFnAttribute(llvm::Attribute::Naked) ||
+      function.hasFnAttribute(llvm::Attribute::ReturnsTwice)) {
+    return false;
+  }
+
+  // 包装函数只执行一次，没有重新编译的必要。
+  llvm::StringRef name = function.getName();
+  if (name.contains(ast::synthesize::UniquePrefix) || name == "main" ||
+      name.endswith(kImplSuffix)) {
+    return false;
+  }
+
+  return function.getInstructionCount() >= kMinInstructions;
+}
+
+void TieredCompiler::instrumentFunction(llvm::Function& function) {
+  llvm::Module& module = *function.getParent();
+  llvm::LLVMContext& ctx = module.getContext();
+  const std::string name = function.getName().str();
+
+  // 把函数体移到F.__tier0中，F本身变为跳板。
+  llvm::Function* impl = llvm::Function::Create(
+      function.getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+      name + kImplSuffix, &module);
+  impl->copyAttributesFrom(&function);
+  impl->getBasicBlockList().splice(impl->end(),
+                                   function.getBasicBlockList());
+  for (auto args : llvm::zip(function.args(), impl->args())) {
+    std::get<1>(args).takeName(&std::get<0>(args));
+    std::get<0>(args).replaceAllUsesWith(&std::get<1>(args));
+  }
+  impl->setSubprogram(function.getSubprogram());
+  function.setSubprogram(nullptr);
+
+  llvm::Type* int8_ty = llvm::Type::getInt8Ty(ctx);
+  llvm::Type* int8_ptr_ty = llvm::Type::getInt8PtrTy(ctx);
+  llvm::Type* int64_ty = llvm::Type::getInt64Ty(ctx);
+
+  // 由JIT链接器初始化为F.__tier0的地址。
+  auto* slot = new llvm::GlobalVariable(
+      module, int8_ptr_ty, /*isConstant=*/false,
+      llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantExpr::getBitCast(impl, int8_ptr_ty), name + kSlotSuffix);
+  slot->setAlignment(llvm::Align(8));
+  auto* counter = new llvm::GlobalVariable(
+      module, int64_ty, /*isConstant=*/false,
+      llvm::GlobalValue::ExternalLinkage, llvm::ConstantInt::get(int64_ty, 0),
+      name + kCountSuffix);
+  counter->setAlignment(llvm::Align(8));
+
+  llvm::GlobalVariable* self = module.getNamedGlobal(kSelfSymbol);
+  if (!self) {
+    self = new llvm::GlobalVariable(module, int8_ty, /*isConstant=*/false,
+                                    llvm::GlobalValue::ExternalLinkage,
+                                    /*Initializer=*/nullptr, kSelfSymbol);
+  }
+  llvm::FunctionCallee hook = module.getOrInsertFunction(
+      kTierUpHook, llvm::FunctionType::get(llvm::Type::getVoidTy(ctx),
+                                           {int8_ptr_ty, int8_ptr_ty},
+                                           /*isVarArg=*/false));
+
+  llvm::BasicBlock* entry = llvm::BasicBlock::Create(ctx, "entry", &function);
+  llvm::BasicBlock* tier_up =
+      llvm::BasicBlock::Create(ctx, "tier_up", &function);
+  llvm::BasicBlock* call = llvm::BasicBlock::Create(ctx, "call", &function);
+
+  llvm::IRBuilder<> builder(entry);
+  llvm::Value* count = builder.CreateAtomicRMW(
+      llvm::AtomicRMWInst::Add, counter, llvm::ConstantInt::get(int64_ty, 1),
+      llvm::MaybeAlign(8), llvm::AtomicOrdering::Monotonic);
+  llvm::Value* hot = builder.CreateICmpEQ(
+      count, llvm::ConstantInt::get(int64_ty, threshold_ - 1));
+  builder.CreateCondBr(hot, tier_up, call);
+
+  builder.SetInsertPoint(tier_up);
+  builder.CreateCall(hook, {builder.CreateBitCast(self, int8_ptr_ty),
+                            builder.CreateGlobalStringPtr(name)});
+  builder.CreateBr(call);
+
+  builder.SetInsertPoint(call);
+  llvm::LoadInst* target =
+      builder.CreateAlignedLoad(int8_ptr_ty, slot, llvm::Align(8));
+  target->setAtomic(llvm::AtomicOrdering::Acquire);
+  llvm::SmallVector<llvm::Value*, 8> args;
+  for (llvm::Argument& arg : function.args()) {
+    args.push_back(&arg);
+  }
+  llvm::CallInst* result = builder.CreateCall(
+      function.getFunctionType(),
+      builder.CreateBitCast(target, function.getType()), args);
+  result->setCallingConv(function.getCallingConv());
+  // 只转发返回值和参数的属性，sret、byval等ABI属性必须与被调用者一致。
+  llvm::AttributeList attrs = function.getAttributes();
+  llvm::SmallVector<llvm::AttributeSet, 8> param_attrs;
+  for (unsigned i = 0, e = function.arg_size(); i != e; ++i) {
+    param_attrs.push_back(attrs.getParamAttrs(i));
+  }
+  result->setAttributes(llvm::AttributeList::get(
+      ctx, llvm::AttributeSet(), attrs.getRetAttrs(), param_attrs));
+  result->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  if (function.getReturnType()->isVoidTy()) {
+    builder.CreateRetVoid();
+  } else {
+    builder.CreateRet(result);
+  }
+}
+
+void TieredCompiler::instrumentModule(llvm::Module& module) {
+  std::vector<llvm::Function*> candidates;
+  for (llvm::Function& function : module) {
+    if (isEligible(function)) {
+      candidates.push_back(&function);
+    }
+  }
+  if (candidates.empty()) {
+    return;
+  }
+
+  for (llvm::Function* function : candidates) {
+    instrumentFunction(*function);
+  }
+
+  // 保存插桩后的模块，重新编译时从中取出O0函数体。
+  // bitcode与模块的LLVMContext无关，后台线程可以安全地读取它。
+  auto bitcode = std::make_shared<llvm::SmallVector<char, 0>>();
+  {
+    llvm::raw_svector_ostream os(*bitcode);
+    llvm::WriteBitcodeToFile(module, os);
+  }
+
+  auto module_info = std::make_shared<ModuleInfo>();
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_modules_[module.getModuleIdentifier()] = module_info;
+  for (llvm::Function* function : candidates) {
+    FunctionInfo& info = functions_[function->getName()];
+    info.bitcode = bitcode;
+    info.module = module_info;
+    info.promoted = false;
+  }
+  stats_.instrumented_functions += candidates.size();
+}
+
+void TieredCompiler::addTransactionModule(
+    const Transaction& transaction, llvm::StringRef module_name,
+    llvm::orc::ResourceTrackerSP tracker) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto pending = pending_modules_.find(module_name);
+  if (pending == pending_modules_.end()) {
+    return;
+  }
+  pending->second->transaction = &transaction;
+  pending->second->tracker = std::move(tracker);
+  pending_modules_.erase(pending);
+}
+
+void TieredCompiler::removeTransactions(
+    llvm::ArrayRef<const Transaction*> transactions) {
+  auto removed = [transactions](const ModuleInfo* module) {
+    return module && llvm::is_contained(transactions, module->transaction);
+  };
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // 正在进行的重新编译会改写跳板变量，必须在模块被移除之前完成。
+  cond_.wait(lock, [&] { return !removed(in_flight_); });
+  for (auto it = functions_.begin(), end = functions_.end(); it != end;) {
+    auto current = it++;
+    if (removed(current->second.module.get())) {
+      functions_.erase(current);
+    }
+  }
+  queue_.erase(std::remove_if(queue_.begin(), queue_.end(),
+                              [this](const std::string& name) {
+                                return !functions_.count(name);
+                              }),
+               queue_.end());
+}
+
+void TieredCompiler::requestTierUp(llvm::StringRef name) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto info = functions_.find(name);
+    if (info == functions_.end() || info->second.promoted ||
+        !info->second.module->tracker) {
+      return;
+    }
+    info->second.promoted = true;
+    queue_.push_back(name.str());
+  }
+  // removeTransactions()也在cond_上等待，必须唤醒所有线程。
+  cond_.notify_all();
+}
+
+void TieredCompiler::run() {
+  while (true) {
+    std::string name;
+    std::shared_ptr<const llvm::SmallVector<char, 0>> bitcode;
+    llvm::orc::ResourceTrackerSP tracker;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (stop_) {
+        return;
+      }
+      name = std::move(queue_.front());
+      queue_.pop_front();
+      const FunctionInfo& info = functions_.find(name)->second;
+      bitcode = info.bitcode;
+      tracker = info.module->tracker;
+      in_flight_ = info.module.get();
+    }
+
+    llvm::Error err = promote(name, *bitcode, std::move(tracker));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_ = nullptr;
+      if (err) {
+        ++stats_.failed_tier_ups;
+        cppinterp::errs() << "cppinterp: cannot recompile '" << name
+                          << "': " << llvm::toString(std::move(err)) << "\n";
+      } else {
+        ++stats_.tier_ups;
+        // 函数体已经切换，不再需要保留bitcode。
+        auto info = functions_.find(name);
+        if (info != functions_.end()) {
+          info->second.bitcode.reset();
+        }
+      }
+    }
+    // 唤醒在removeTransactions()中等待的线程。
+    cond_.notify_all();
+  }
+}
+
+llvm::Error TieredCompiler::createPipeline() {
+  if (mpm_) {
+    return llvm::Error::success();
+  }
+
+  llvm::orc::JITTargetMachineBuilder jtmb = jit_.getTargetMachineBuilder();
+  jtmb.setCodeGenOptLevel(BackendPasses::getCodeGenOptLevel(opt_level_));
+  llvm::Expected<std::unique_ptr<llvm::TargetMachine>> tm =
+      jtmb.createTargetMachine();
+  if (!tm) {
+    return tm.takeError();
+  }
+  tm_ = std::move(*tm);
+
+  llvm::PipelineTuningOptions pto;
+  pto.LoopUnrolling = cgopts_.UnrollLoops;
+  pto.LoopInterleaving = cgopts_.UnrollLoops;
+  pto.LoopVectorization = opt_level_ > 1;
+  pto.SLPVectorization = opt_level_ > 1;
+  pass_builder_ = std::make_unique<llvm::PassBuilder>(tm_.get(), pto);
+  tm_->registerPassBuilderCallbacks(*pass_builder_);
+
+  fam_.registerPass([this] {
+    return llvm::TargetLibraryAnalysis(
+        llvm::TargetLibraryInfoImpl(tm_->getTargetTriple()));
+  });
+  pass_builder_->registerModuleAnalyses(mam_);
+  pass_builder_->registerCGSCCAnalyses(cgam_);
+  pass_builder_->registerFunctionAnalyses(fam_);
+  pass_builder_->registerLoopAnalyses(lam_);
+  pass_builder_->crossRegisterProxies(lam_, fam_, cgam_, mam_);
+
+  static const llvm::OptimizationLevel levels[] = {
+      llvm::OptimizationLevel::O1, llvm::OptimizationLevel::O2,
+      llvm::OptimizationLevel::O3};
+  mpm_ = std::make_unique<llvm::ModulePassManager>(
+      cgopts_.DisableLLVMPasses
+          ? pass_builder_->buildO0DefaultPipeline(llvm::OptimizationLevel::O0)
+          : pass_builder_->buildPerModuleDefaultPipeline(
+                levels[opt_level_ - 1]));
+  return llvm::Error::success();
+}
+
+llvm::Error TieredCompiler::promote(llvm::StringRef name,
+                                    const llvm::SmallVector<char, 0>& bitcode,
+                                    llvm::orc::ResourceTrackerSP tracker) {
+  // 在私有的LLVMContext和TargetMachine上工作，不与解释器线程竞争。
+  // 这里不运行BackendPasses：它的ReuseExistingWeakSymbols会读取解释器线程
+  // 正在修改的JIT状态，而这个模块除了被重新编译的函数体之外只剩声明。
+  llvm::LLVMContext ctx;
+  llvm::Expected<std::unique_ptr<llvm::Module>> module_or_err =
+      llvm::parseBitcodeFile(
+          llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()),
+                                name),
+          ctx);
+  if (!module_or_err) {
+    return module_or_err.takeError();
+  }
+  std::unique_ptr<llvm::Module> module = std::move(*module_or_err);
+
+  llvm::Function* impl = module->getFunction((name + kImplSuffix).str());
+  if (!impl || impl->isDeclaration()) {
+    return llvm::make_error<llvm::StringError>(
+        "no O0 body to recompile", llvm::inconvertibleErrorCode());
+  }
+  const std::string tiered_name =
+      (name + ".__tier" + llvm::Twine(opt_level_)).str();
+  impl->setName(tiered_name);
+  // O0下clang给每个函数加上了optnone和noinline。
+  impl->removeFnAttr(llvm::Attribute::OptimizeNone);
+  impl->removeFnAttr(llvm::Attribute::NoInline);
+
+  // 只保留要重新编译的函数体和局部符号，其余符号引用JIT中已有的定义。
+  for (const char* structors : {"llvm.global_ctors", "llvm.global_dtors"}) {
+    if (llvm::GlobalVariable* gv = module->getNamedGlobal(structors)) {
+      gv->eraseFromParent();
+    }
+  }
+  for (llvm::Function& function : *module) {
+    if (&function == impl || function.isDeclaration() ||
+        function.hasLocalLinkage()) {
+      continue;
+    }
+    function.deleteBody();
+    function.setComdat(nullptr);
+  }
+  for (llvm::GlobalVariable& global : module->globals()) {
+    if (global.isDeclaration() || global.hasLocalLinkage()) {
+      continue;
+    }
+    global.setInitializer(nullptr);
+    global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    global.setComdat(nullptr);
+  }
+  // 删除了定义的符号由其他模块定义，不能假设它们与这个模块相邻。
+  for (llvm::GlobalValue& gv : module->global_values()) {
+    if (gv.isDeclaration()) {
+      gv.setVisibility(llvm::GlobalValue::DefaultVisibility);
+      gv.setDSOLocal(false);
+    }
+  }
+
+  if (llvm::Error err = createPipeline()) {
+    return err;
+  }
+  mpm_->run(*module, mam_);
+  // 缓存的分析结果以模块和函数的地址为键，模块随后就会被销毁。
+  lam_.clear();
+  cgam_.clear();
+  fam_.clear();
+  mam_.clear();
+
+  llvm::orc::SimpleCompiler compiler(*tm_);
+  llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> obj = compiler(*module);
+  if (!obj) {
+    return obj.takeError();
+  }
+  if (llvm::Error err =
+          jit_.addObjectFile(std::move(tracker), std::move(*obj))) {
+    return err;
+  }
+
+  void* addr =
+      jit_.getSymbolAddress(tiered_name, /*include_host_symbols=*/false);
+  void* slot = jit_.getSymbolAddress((name + kSlotSuffix).str(),
+                                     /*include_host_symbols=*/false);
+  if (!addr || !slot) {
+    return llvm::make_error<llvm::StringError>(
+        "recompiled function not found", llvm::inconvertibleErrorCode());
+  }
+  __atomic_store_n(static_cast<void**>(slot), addr, __ATOMIC_RELEASE);
+  return llvm::Error::success();
+}
+
+TieredCompiler::Statistics TieredCompiler::getStatistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void TieredCompiler::dump(llvm::raw_ostream& out) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  out << "Tiered compilation (threshold " << threshold_ << ", O" << opt_level_
+      << "): " << stats_.instrumented_functions << " instrumented, "
+      << stats_.tier_ups << " recompiled, " << stats_.failed_tier_ups
+      << " failed, " << queue_.size() << " pending\n";
+}
+
+}  // namespace cppinterp
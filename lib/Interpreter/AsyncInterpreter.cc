@@ -0,0 +1,214 @@
+#include "cppinterp/Interpreter/AsyncInterpreter.h"
+
+#include <algorithm>
+
+#include "cppinterp/Interpreter/Transaction.h"
+
+namespace cppinterp {
+
+AsyncInterpreter::AsyncInterpreter(Interpreter& interpreter,
+                                   unsigned execution_threads)
+    : interpreter_(interpreter) {
+  if (!execution_threads) {
+    execution_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  compile_thread_ = std::thread(
+      [this] { runQueue(compile_queue_, compile_cond_, stop_compilation_); });
+  execution_threads_.reserve(execution_threads);
+  for (unsigned i = 0; i < execution_threads; ++i) {
+    execution_threads_.emplace_back([this] {
+      runQueue(execution_queue_, execution_cond_, stop_execution_);
+    });
+  }
+}
+
+AsyncInterpreter::~AsyncInterpreter() {
+  // 先等编译线程排空队列：它在此期间还可能提交新的执行任务。
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_compilation_ = true;
+  }
+  compile_cond_.notify_all();
+  compile_thread_.join();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_execution_ = true;
+  }
+  execution_cond_.notify_all();
+  for (std::thread& thread : execution_threads_) {
+    thread.join();
+  }
+
+  // 编译线程停止之后结束的execute()提交的卸载任务。
+  while (!compile_queue_.empty()) {
+    Task task = std::move(compile_queue_.front());
+    compile_queue_.pop_front();
+    task();
+  }
+}
+
+void AsyncInterpreter::enqueueCompilation(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 编译线程是它求值的共享值的所有者，在每个请求之前运行
+    // 其他线程释放的这些值的析构函数。
+    compile_queue_.push_back([this, task = std::move(task)]() mutable {
+      interpreter_.ReclaimDeferredValues();
+      task();
+    });
+  }
+  compile_cond_.notify_one();
+}
+
+void AsyncInterpreter::enqueueExecution(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    execution_queue_.push_back(std::move(task));
+  }
+  execution_cond_.notify_one();
+}
+
+void AsyncInterpreter::runQueue(std::deque<Task>& queue,
+                                std::condition_variable& cond,
+                                const bool& stop) {
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond.wait(lock, [&] { return stop || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      task = std::move(queue.front());
+      queue.pop_front();
+    }
+    task();
+  }
+}
+
+std::future<Interpreter::CompilationResult> AsyncInterpreter::declare(
+    std::string input) {
+  return post([input = std::move(input)](Interpreter& interpreter) {
+    return interpreter.declare(input);
+  });
+}
+
+std::future<AsyncInterpreter::EvaluationResult> AsyncInterpreter::process(
+    std::string input) {
+  return post([input = std::move(input)](Interpreter& interpreter) {
+    EvaluationResult result;
+    result.result = interpreter.process(input, &result.value);
+    // 在交给调用者的线程之前，引用计数必须是原子的。
+    result.value.makeThreadShareable();
+    return result;
+  });
+}
+
+std::future<AsyncInterpreter::EvaluationResult> AsyncInterpreter::evaluate(
+    std::string input) {
+  return post([input = std::move(input)](Interpreter& interpreter) {
+    EvaluationResult result;
+    result.result = interpreter.evaluate(input, result.value);
+    // 在交给调用者的线程之前，引用计数必须是原子的。
+    result.value.makeThreadShareable();
+    return result;
+  });
+}
+
+std::future<Interpreter::CompilationResult> AsyncInterpreter::execute(
+    std::string input) {
+  auto promise =
+      std::make_shared<std::promise<Interpreter::CompilationResult>>();
+  std::future<Interpreter::CompilationResult> future = promise->get_future();
+
+  enqueueCompilation([this, promise, input = std::move(input)]() {
+    // 语句的作用域与包装函数相同，其中的声明在函数外不可见。
+    std::string name = "__cppinterp_async_exec";
+    interpreter_.createUniqueName(name);
+    std::string code = "extern \"C\" void " + name + "() {\n" + input + "\n;}";
+
+    Transaction* transaction = nullptr;
+    void* addr = nullptr;
+    try {
+      if (interpreter_.DeclareCFunction(name, code,
+                                        /*with_access_control=*/true,
+                                        transaction)) {
+        addr = interpreter_.getAddressOfGlobal(name);
+      }
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+      return;
+    }
+    if (!addr) {
+      if (transaction) {
+        interpreter_.unload(*transaction);
+      }
+      promise->set_value(Interpreter::kFailure);
+      return;
+    }
+
+    enqueueExecution([this, promise, addr, transaction]() {
+      std::exception_ptr exception;
+      try {
+        (*reinterpret_cast<void (*)()>(addr))();
+      } catch (...) {
+        exception = std::current_exception();
+      }
+      // 先提交卸载再完成future，等待future之后提交的请求排在卸载之后，
+      // 事务在卸载时通常还是最后一个。
+      enqueueCompilation([this, transaction]() {
+        finished_executions_.push_back(transaction);
+        unloadFinishedExecutions();
+      });
+      if (exception) {
+        promise->set_exception(exception);
+      } else {
+        promise->set_value(Interpreter::kSuccess);
+      }
+    });
+  });
+  return future;
+}
+
+/// 事务是否只包含顶层声明，没有模板实例化、嵌套事务或反序列化的声明。
+static bool HasOnlyTopLevelDecls(const Transaction& transaction) {
+  if (transaction.hasNestedTransactions() ||
+      transaction.deserialized_decls_begin() !=
+          transaction.deserialized_decls_end()) {
+    return false;
+  }
+  for (auto it = transaction.decls_begin(), end = transaction.decls_end();
+       it != end; ++it) {
+    if (it->call_ != Transaction::kCCIHandleTopLevelDecl) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AsyncInterpreter::unloadFinishedExecutions() {
+  // 卸载最后一个事务之后，之前的事务可能成为最后一个。
+  bool unloaded = true;
+  while (unloaded) {
+    unloaded = false;
+    for (auto it = finished_executions_.begin();
+         it != finished_executions_.end(); ++it) {
+      Transaction* transaction = *it;
+      if (transaction == interpreter_.getLastTransaction() ||
+          HasOnlyTopLevelDecls(*transaction)) {
+        finished_executions_.erase(it);
+        interpreter_.unload(*transaction);
+        unloaded = true;
+        break;
+      }
+    }
+  }
+}
+
+size_t AsyncInterpreter::getNumPendingCompilations() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return compile_queue_.size();
+}
+
+}  // namespace cppinterp
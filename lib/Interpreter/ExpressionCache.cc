@@ -0,0 +1,91 @@
+#include "cppinterp/Interpreter/ExpressionCache.h"
+
+#include "clang/Basic/CharInfo.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cppinterp {
+
+std::string ExpressionCache::normalize(llvm::StringRef input) {
+  input = input.trim();
+  while (input.consume_back(";")) {
+    input = input.rtrim();
+  }
+
+  std::string result;
+  result.reserve(input.size());
+  char quote = 0;
+  bool pending_space = false;
+  for (size_t i = 0, e = input.size(); i != e; ++i) {
+    char c = input[i];
+    if (quote) {
+      result += c;
+      if (c == '\\' && i + 1 != e) {
+        result += input[++i];
+      } else if (c == quote) {
+        quote = 0;
+      }
+      continue;
+    }
+
+    if (clang::isWhitespace(c)) {
+      pending_space = true;
+      continue;
+    }
+    if (pending_space) {
+      result += ' ';
+      pending_space = false;
+    }
+    result += c;
+    // 数字分隔符(1'000)前面是数字，不是字符字面量。
+    if (c == '"' ||
+        (c == '\'' && (i == 0 || !clang::isAsciiIdentifierContinue(
+                                     input[i - 1])))) {
+      quote = c;
+    }
+  }
+  return result;
+}
+
+void ExpressionCache::sync(unsigned last_transaction_id) {
+  if (last_transaction_id == observed_transaction_) {
+    return;
+  }
+  // 其他输入被编译或者事务被回滚，旧条目的包装函数可能已经被卸载。
+  if (!entries_.empty()) {
+    ++stats_.invalidations;
+  }
+  entries_.clear();
+  epoch_ = last_transaction_id;
+  observed_transaction_ = last_transaction_id;
+}
+
+const clang::FunctionDecl* ExpressionCache::lookup(
+    llvm::StringRef normalized) {
+  auto it = entries_.find(normalized);
+  if (it == entries_.end()) {
+    ++stats_.misses;
+    return nullptr;
+  }
+  ++stats_.hits;
+  return it->second;
+}
+
+void ExpressionCache::insert(llvm::StringRef normalized,
+                             const clang::FunctionDecl* wrapper) {
+  if (entries_.size() >= max_entries_) {
+    entries_.clear();
+  }
+  entries_[normalized] = wrapper;
+}
+
+void ExpressionCache::clear() {
+  entries_.clear();
+}
+
+void ExpressionCache::dump(llvm::raw_ostream& out) const {
+  out << "Expression cache: epoch " << epoch_ << ", " << entries_.size()
+      << " entries, " << stats_.hits << " hits, " << stats_.misses
+      << " misses, " << stats_.invalidations << " invalidations\n";
+}
+
+}  // namespace cppinterp
@@ -1,8 +1,34 @@
 #include "cppinterp/Interpreter/Interpreter.h"
 
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/AST/Mangle.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/TextDiagnosticBuffer.h"
+#include "clang/Lex/MacroInfo.h"
+#include "clang/Lex/Preprocessor.h"
+#include "cppinterp/AST/AST.h"
+#include "cppinterp/Incremental/IncrementalExecutor.h"
+#include "cppinterp/Incremental/IncrementalJIT.h"
 #include "cppinterp/Incremental/IncrementalParser.h"
 #include "cppinterp/Interpreter/CompilationOptions.h"
+#include "cppinterp/Interpreter/ExpressionCache.h"
+#include "cppinterp/Interpreter/LibraryIndex.h"
+#include "cppinterp/Interpreter/PreparedSnippet.h"
 #include "cppinterp/Interpreter/Transaction.h"
+#include "cppinterp/Interpreter/TransactionProfiler.h"
+#include "cppinterp/Interpreter/Value.h"
+#include "cppinterp/Interpreter/ValueAllocator.h"
+#include "cppinterp/Interpreter/ValuePrinterCache.h"
+#include "cppinterp/Utils/Output.h"
+#include "cppinterp/Utils/Platform.h"
+#include "cppinterp/Utils/SourceNormalization.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
 
 namespace cppinterp {
 
@@ -60,4 +86,508 @@ clang::CompilerInstance* Interpreter::getCI() const {
   return incr_parser_->getCI();
 }
 
-}  // namespace cppinterp
\ No newline at end of file
+void Interpreter::enableProfiling(bool enable) {
+  if (!enable) {
+    profiler_.reset();
+  } else if (!profiler_) {
+    profiler_ = std::make_unique<TransactionProfiler>();
+  }
+}
+
+std::vector<Interpreter::CompilationResult> Interpreter::evaluateBatch(
+    const std::vector<std::string>& inputs, std::vector<Value>& values) {
+  ReclaimDeferredValues();
+  TransactionProfiler::ScopedRecord record(getProfiler(),
+                                           llvm::join(inputs, "\n"));
+  values.clear();
+  values.resize(inputs.size());
+  std::vector<CompilationResult> results(inputs.size(), kFailure);
+
+  // 输入必须与逐个evaluate()时按相同的顺序生效。一起编译的输入中，
+  // 包装起点之前的声明的静态初始化函数在所有包装函数之前运行，
+  // 因此这样的输入只能是一组的第一个。没有需要包装的部分的输入
+  // (例如只有声明)在它之前的一组运行之后单独交给evaluate()。
+  const clang::LangOptions& lang_opts = getCI()->getLangOpts();
+  std::vector<size_t> wrap_points(inputs.size());
+  std::vector<size_t> indices;
+  for (size_t i = 0, e = inputs.size(); i != e; ++i) {
+    wrap_points[i] = utils::getWrapPoint(inputs[i], lang_opts);
+    if (wrap_points[i] == std::string::npos || wrap_points[i] != 0) {
+      EvaluateBatchInternal(inputs, wrap_points, indices, values, results);
+      indices.clear();
+    }
+    if (wrap_points[i] == std::string::npos) {
+      results[i] = evaluate(inputs[i], values[i]);
+    } else {
+      indices.push_back(i);
+    }
+  }
+  EvaluateBatchInternal(inputs, wrap_points, indices, values, results);
+  return results;
+}
+
+void Interpreter::EvaluateBatchInternal(
+    const std::vector<std::string>& inputs,
+    const std::vector<size_t>& wrap_points, const std::vector<size_t>& indices,
+    std::vector<Value>& values, std::vector<CompilationResult>& results) {
+  if (indices.empty()) {
+    return;
+  }
+  if (indices.size() == 1) {
+    // 单个表达式走普通路径，它的编译错误在这里被报告。
+    size_t index = indices.front();
+    results[index] = evaluate(inputs[index], values[index]);
+    return;
+  }
+
+  CompilationOptions co = makeDefaultCompilationOpts();
+  co.DeclarationExtraction = 0;
+  co.ValuePrinting = CompilationOptions::VPDisabled;
+  co.ResultEvaluation = 1;
+
+  // 每个表达式一个包装函数，拼接成一次输入。
+  // 包装起点之前的预处理指令和声明留在包装函数之外。
+  std::string source;
+  for (size_t index : indices) {
+    std::string buffer;
+    size_t wrap_point = wrap_points[index];
+    source += WrapInput(inputs[index], buffer, wrap_point);
+    source += "\n";
+  }
+
+  // 批量编译失败时会拆分重试，诊断只在单个表达式重试时显示。
+  // 编译期间的诊断先缓存起来，成功时再交给原来的consumer，
+  // 这样警告与逐个evaluate()时一样被显示。
+  Transaction* transaction = nullptr;
+  clang::DiagnosticsEngine& diags = getDiagnostics();
+  clang::DiagnosticConsumer* client = diags.getClient();
+  std::unique_ptr<clang::DiagnosticConsumer> owned_client = diags.takeClient();
+  clang::TextDiagnosticBuffer diag_buffer;
+  diags.setClient(&diag_buffer, /*ShouldOwnClient=*/false);
+  CompilationResult result;
+  {
+    TransactionProfiler::PhaseRAII phase(TransactionProfiler::kCompile);
+    result = DeclareInternal(source, co, &transaction);
+  }
+  diags.setClient(client, /*ShouldOwnClient=*/owned_client != nullptr);
+  owned_client.release();
+
+  if (result != kSuccess || !transaction) {
+    size_t half = indices.size() / 2;
+    EvaluateBatchInternal(
+        inputs, wrap_points,
+        std::vector<size_t>(indices.begin(), indices.begin() + half), values,
+        results);
+    EvaluateBatchInternal(
+        inputs, wrap_points,
+        std::vector<size_t>(indices.begin() + half, indices.end()), values,
+        results);
+    return;
+  }
+  diag_buffer.FlushDiagnostics(diags);
+
+  // 包装函数在事务中的顺序就是它们在输入中的顺序。
+  std::vector<const clang::FunctionDecl*> wrappers;
+  llvm::SmallPtrSet<const clang::FunctionDecl*, 16> seen;
+  for (auto it = transaction->decls_begin(), end = transaction->decls_end();
+       it != end; ++it) {
+    if (it->call_ != Transaction::kCCIHandleTopLevelDecl) {
+      continue;
+    }
+    for (clang::Decl* decl : it->dgr_) {
+      auto* fd = llvm::dyn_cast<clang::FunctionDecl>(decl);
+      if (fd && ast::analyze::IsWrapper(fd) && seen.insert(fd).second) {
+        wrappers.push_back(fd);
+      }
+    }
+  }
+  if (wrappers.size() != indices.size()) {
+    // 无法把包装函数对应到表达式，卸载还没有运行的包装函数并逐个求值。
+    unload(*transaction);
+    for (size_t index : indices) {
+      results[index] = evaluate(inputs[index], values[index]);
+    }
+    return;
+  }
+
+  TransactionProfiler::PhaseRAII phase(TransactionProfiler::kExecution);
+  for (size_t i = 0, e = indices.size(); i != e; ++i) {
+    ExecutionResult exe_result = RunFunction(wrappers[i], &values[indices[i]]);
+    results[indices[i]] = exe_result == kExeSuccess ? kSuccess : kFailure;
+  }
+}
+
+void Interpreter::enableExpressionCache(bool enable) {
+  if (!enable) {
+    expr_cache_.reset();
+  } else if (!expr_cache_) {
+    expr_cache_ = std::make_unique<ExpressionCache>();
+  }
+}
+
+bool Interpreter::enableLibraryAutoload() {
+  if (library_index_) {
+    return true;
+  }
+  std::vector<std::string> search_paths = opts_.LibSearchPath;
+  llvm::SmallVector<std::string, 16> system_paths;
+  platform::GetSystemLibraryPaths(system_paths);
+  search_paths.insert(search_paths.end(), system_paths.begin(),
+                      system_paths.end());
+
+  std::shared_ptr<LibraryIndex> index =
+      LibraryIndex::Create(opts_.CompilerOpts, search_paths);
+  if (!index || !index->openOrBuild()) {
+    return false;
+  }
+  library_index_ = index;
+  addGenerator(LibraryIndex::createGenerator(std::move(index)));
+  return true;
+}
+
+ValueAllocator& Interpreter::getValueAllocator() {
+  if (!value_allocator_) {
+    value_allocator_ = std::make_unique<ValueAllocator>();
+  }
+  return *value_allocator_;
+}
+
+void Interpreter::ReclaimDeferredValues() {
+  if (value_allocator_) {
+    value_allocator_->reclaimDeferred();
+  }
+}
+
+ValuePrinterCache& Interpreter::getValuePrinterCache() {
+  if (!printer_cache_) {
+    printer_cache_ = std::make_unique<ValuePrinterCache>(*this);
+  }
+  return *printer_cache_;
+}
+
+Interpreter::CompilationResult Interpreter::evaluateCached(
+    const std::string& input, Value& value) {
+  ReclaimDeferredValues();
+  TransactionProfiler::ScopedRecord record(getProfiler(), input);
+  if (!expr_cache_) {
+    return evaluate(input, value);
+  }
+
+  const Transaction* last = getLastTransaction();
+  expr_cache_->sync(last ? last->getUniqueID() : 0);
+
+  std::string key = ExpressionCache::normalize(input);
+  if (const clang::FunctionDecl* wrapper = expr_cache_->lookup(key)) {
+    // 与EvaluateInternal()相同地运行包装函数，异常和返回码由RunFunction处理。
+    TransactionProfiler::PhaseRAII phase(TransactionProfiler::kExecution);
+    value = Value();
+    return RunFunction(wrapper, &value) == kExeSuccess ? kSuccess : kFailure;
+  }
+
+  CompilationOptions co = makeDefaultCompilationOpts();
+  co.DeclarationExtraction = 0;
+  co.ValuePrinting = CompilationOptions::VPDisabled;
+  co.ResultEvaluation = 1;
+
+  Transaction* transaction = nullptr;
+  CompilationResult result =
+      EvaluateInternal(input, co, &value, &transaction);
+  if (result == kSuccess && transaction && transaction->getWrapperFD()) {
+    expr_cache_->insert(key, transaction->getWrapperFD());
+  }
+
+  // 自己编译的事务不改变纪元。
+  last = getLastTransaction();
+  expr_cache_->setObservedTransaction(last ? last->getUniqueID() : 0);
+  return result;
+}
+
+/// 把void** args解包为片段函数的参数并在ret中构造返回值的跳板模板。
+/// 按值传递的参数从调用者的对象复制，引用参数直接绑定到调用者的对象。
+/// prepare()在AST中找不到__cppinterp_prepared命名空间时才声明它，
+/// 所以它所在的事务被卸载之后会被重新声明。
+static const char* const kPreparedSnippetRuntime = R"code(
+#include <new>
+#include <type_traits>
+#include <utility>
+namespace __cppinterp_prepared {
+template <class A> struct arg { typedef const A& type; };
+template <class A> struct arg<A&> { typedef A& type; };
+template <class A> struct arg<A&&> { typedef A&& type; };
+template <class A> typename arg<A>::type get(void* p) {
+  return static_cast<typename arg<A>::type>(
+      *static_cast<typename std::remove_reference<A>::type*>(p));
+}
+template <class R, class... A, std::size_t... I>
+void call(R (*f)(A...), void** args, void*, std::true_type,
+          std::index_sequence<I...>) {
+  f(get<A>(args[I])...);
+}
+template <class R, class... A, std::size_t... I>
+void call(R (*f)(A...), void** args, void* ret, std::false_type,
+          std::index_sequence<I...>) {
+  ::new (ret) R(f(get<A>(args[I])...));
+}
+template <class R, class... A>
+void call(R (*f)(A...), void** args, void* ret) {
+  call(f, args, ret, std::is_void<R>(), std::index_sequence_for<A...>());
+}
+}
+)code";
+
+/// 返回与typeid(T).name()相同的名字：去掉引用和顶层cv限定之后的类型的
+/// Itanium RTTI名字，不带_ZTS前缀。void返回空字符串。
+static std::string GetTypeInfoName(clang::MangleContext& mangle_ctx,
+                                   clang::QualType type) {
+  type = type.getNonReferenceType().getUnqualifiedType();
+  if (type->isVoidType()) {
+    return std::string();
+  }
+  std::string name;
+  llvm::raw_string_ostream os(name);
+  mangle_ctx.mangleCXXRTTIName(type, os);
+  os.flush();
+  llvm::StringRef ref(name);
+  ref.consume_front("_ZTS");
+  return ref.str();
+}
+
+std::unique_ptr<PreparedSnippet> Interpreter::prepare(
+    llvm::StringRef params, llvm::StringRef body,
+    llvm::StringRef result_type) {
+  ReclaimDeferredValues();
+  TransactionProfiler::ScopedRecord record(getProfiler(), body);
+  std::string name = "__cppinterp_prepared";
+  createUniqueName(name);
+  std::string body_name = name + "_body";
+
+  std::string code;
+  if (!ast::lookup::Namespace(&getSema(), "__cppinterp_prepared")) {
+    code = kPreparedSnippetRuntime;
+  }
+  code += "extern \"C\" " + result_type.str() + " " + body_name + "(" +
+          params.str() + ") {\n" + body.str() + "\n;}\n";
+  code += "extern \"C\" void " + name + "(void** args, void* ret) {\n" +
+          "  __cppinterp_prepared::call(&" + body_name + ", args, ret);\n}\n";
+
+  Transaction* transaction = nullptr;
+  const clang::FunctionDecl* fd;
+  {
+    TransactionProfiler::PhaseRAII phase(TransactionProfiler::kCompile);
+    fd = DeclareCFunction(body_name, code, /*with_access_control=*/true,
+                          transaction);
+  }
+  if (!fd) {
+    return nullptr;
+  }
+
+  // 返回类型可能是引用的别名，只能在声明之后检查；
+  // 之后的失败都卸载刚刚声明的事务，不留下无法调用的片段。
+  clang::ASTContext& ctx = getCI()->getASTContext();
+  clang::QualType ret_type = fd->getReturnType().getCanonicalType();
+  if (ret_type->isReferenceType()) {
+    cppinterp::errs() << "cppinterp: prepared snippets cannot return a "
+                         "reference\n";
+    unload(*transaction);
+    return nullptr;
+  }
+  std::unique_ptr<clang::MangleContext> mangle_ctx(ctx.createMangleContext());
+  std::string result_type_name = GetTypeInfoName(*mangle_ctx, ret_type);
+
+  std::vector<void*> param_types;
+  std::vector<std::string> param_type_names;
+  for (const clang::ParmVarDecl* param : fd->parameters()) {
+    clang::QualType type = param->getType().getCanonicalType();
+    param_types.push_back(type.getAsOpaquePtr());
+    param_type_names.push_back(GetTypeInfoName(*mangle_ctx, type));
+  }
+
+  void* thunk = getAddressOfGlobal(name);
+  if (!thunk) {
+    unload(*transaction);
+    return nullptr;
+  }
+  return std::make_unique<PreparedSnippet>(
+      *this, reinterpret_cast<PreparedSnippet::ThunkT>(thunk),
+      std::move(param_types), ret_type.getAsOpaquePtr(),
+      std::move(param_type_names), std::move(result_type_name));
+}
+
+void Interpreter::setRollbackPoint(llvm::StringRef name) {
+  const Transaction* last = getLastTransaction();
+  rollback_points_[name.str()] = last ? last->getUniqueID() : 0;
+}
+
+/// 收集事务(包括嵌套事务)的顶层声明和宏指令(按出现顺序)，
+/// 以及需要卸载模块的事务。
+///\returns 第一个不能通过移除顶层声明撤销的声明(隐式实例化)，没有时返回
+/// nullptr。
+static const clang::Decl* CollectRollbackWork(
+    const Transaction& transaction, std::vector<clang::Decl*>& decls,
+    std::vector<Transaction::MacroDirectiveInfo>& macros,
+    std::vector<const Transaction*>& modules) {
+  modules.push_back(&transaction);
+  const clang::Decl* unremovable = nullptr;
+  for (auto it = transaction.nested_begin(); it != transaction.nested_end();
+       ++it) {
+    const clang::Decl* decl = CollectRollbackWork(**it, decls, macros, modules);
+    if (!unremovable) {
+      unremovable = decl;
+    }
+  }
+  macros.insert(macros.end(), transaction.macros_begin(),
+                transaction.macros_end());
+  for (auto it = transaction.decls_begin(); it != transaction.decls_end();
+       ++it) {
+    switch (it->call_) {
+      case Transaction::kCCIHandleTopLevelDecl:
+      case Transaction::kCCIHandleInterestingDecl:
+        for (clang::Decl* decl : it->dgr_) {
+          decls.push_back(decl);
+        }
+        break;
+      case Transaction::kCCIHandleCXXImplicitFunctionInstantiation:
+      case Transaction::kCCIHandleCXXStaticMemberVarInstantiation:
+        // 实例化被记录在模板中，移除它的代码后AST仍会认为它已经实例化。
+        if (!unremovable && !it->dgr_.isNull()) {
+          unremovable = *it->dgr_.begin();
+        }
+        break;
+      case Transaction::kCCIHandleTagDeclDefinition:
+      case Transaction::kCCIHandleVTable:
+        // 类模板的特化属于模板，其余的类属于上面收集的顶层声明。
+        for (clang::Decl* decl : it->dgr_) {
+          if (!unremovable &&
+              llvm::isa<clang::ClassTemplateSpecializationDecl>(decl)) {
+            unremovable = decl;
+          }
+        }
+        break;
+      default:
+        // 暂定定义属于上面收集的顶层声明。
+        break;
+    }
+  }
+  return unremovable;
+}
+
+/// 撤销一条宏指令：恢复它之前的定义，之前没有定义时取消宏的定义。
+/// 指令按相反的顺序撤销，因此被撤销的指令总是宏当前的最新指令。
+static void UndoMacroDirective(clang::Preprocessor& pp,
+                               const Transaction::MacroDirectiveInfo& info) {
+  clang::SourceLocation loc = info.md_->getLocation();
+  if (const clang::MacroDirective* prev = info.md_->getPrevious()) {
+    clang::MacroDirective::DefInfo def =
+        const_cast<clang::MacroDirective*>(prev)->getDefinition();
+    if (def && !def.isUndefined()) {
+      pp.appendDefMacroDirective(info.ii_, def.getMacroInfo(), loc);
+      return;
+    }
+  }
+  if (pp.isMacroDefined(info.ii_)) {
+    pp.appendUndefMacroDirective(info.ii_, loc);
+  }
+}
+
+Interpreter::CompilationResult Interpreter::rollbackTo(llvm::StringRef name) {
+  ReclaimDeferredValues();
+  TransactionProfiler::ScopedRecord record(getProfiler(),
+                                           "rollbackTo " + name.str());
+  auto point = rollback_points_.find(name.str());
+  if (point == rollback_points_.end()) {
+    cppinterp::errs() << "cppinterp: unknown rollback point '" << name
+                      << "'\n";
+    return kFailure;
+  }
+
+  // 从新到旧排列。
+  std::vector<Transaction*> removed;
+  if (!incr_parser_->getTransactionsAfter(point->second, removed)) {
+    cppinterp::errs() << "cppinterp: the transaction of rollback point '"
+                      << name << "' has been unloaded\n";
+    rollback_points_.erase(point);
+    return kFailure;
+  }
+  if (removed.empty()) {
+    return kSuccess;
+  }
+
+  std::vector<clang::Decl*> decls;
+  std::vector<Transaction::MacroDirectiveInfo> macros;
+  std::vector<const Transaction*> modules;
+  const clang::Decl* instantiation = nullptr;
+  for (auto it = removed.rbegin(); it != removed.rend(); ++it) {
+    const clang::Decl* decl = CollectRollbackWork(**it, decls, macros, modules);
+    if (!instantiation) {
+      instantiation = decl;
+    }
+  }
+  if (instantiation) {
+    cppinterp::errs() << "cppinterp: cannot roll back to '" << name << "': ";
+    if (const auto* named = llvm::dyn_cast<clang::NamedDecl>(instantiation)) {
+      cppinterp::errs() << "'" << named->getQualifiedNameAsString() << "' ";
+    }
+    cppinterp::errs() << "is an implicit instantiation made after the "
+                         "rollback point; unload the transactions one by "
+                         "one\n";
+    return kFailure;
+  }
+  if (const clang::Decl* decl = ast::analyze::FindUnremovableDecl(decls)) {
+    cppinterp::errs() << "cppinterp: cannot roll back to '" << name << "': ";
+    if (const auto* named = llvm::dyn_cast<clang::NamedDecl>(decl)) {
+      cppinterp::errs() << "'" << named->getQualifiedNameAsString() << "' ";
+    }
+    cppinterp::errs() << "redeclares a declaration before the rollback "
+                         "point; unload the transactions one by one\n";
+    return kFailure;
+  }
+
+  if (executor_) {
+    // 从新到旧运行每个事务(包括嵌套事务)的静态析构函数。
+    for (auto it = modules.rbegin(); it != modules.rend(); ++it) {
+      executor_->runAndRemoveStaticDestructors(*it);
+    }
+    if (llvm::Error err = executor_->getJIT().removeModules(modules)) {
+      llvm::logAllUnhandledErrors(std::move(err), cppinterp::errs(),
+                                  "cppinterp: rollback: ");
+    }
+  }
+  ast::transform::RemoveDecls(getSema(), decls);
+  clang::Preprocessor& pp = getCI()->getPreprocessor();
+  for (auto it = macros.rbegin(); it != macros.rend(); ++it) {
+    UndoMacroDirective(pp, *it);
+  }
+
+  // 清空可能引用被卸载代码的缓存。
+  // modules包含嵌套事务，cached_transactions_可能指向它们。
+  llvm::SmallPtrSet<const Transaction*, 16> removed_set(modules.begin(),
+                                                        modules.end());
+  llvm::DenseSet<unsigned> removed_ids;
+  for (const Transaction* transaction : modules) {
+    removed_ids.insert(transaction->getUniqueID());
+  }
+  for (auto it = rollback_points_.begin(); it != rollback_points_.end();) {
+    if (removed_ids.count(it->second)) {
+      it = rollback_points_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (const Transaction*& cached : cached_transactions_) {
+    if (removed_set.count(cached)) {
+      cached = nullptr;
+    }
+  }
+  dtor_wrappers_.clear();
+  if (expr_cache_) {
+    expr_cache_->clear();
+  }
+  if (printer_cache_) {
+    printer_cache_->clear();
+  }
+
+  incr_parser_->popTransactions(removed.size());
+  return kSuccess;
+}
+
+}  // namespace cppinterp
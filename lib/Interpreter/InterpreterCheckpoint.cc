@@ -0,0 +1,186 @@
+#include "cppinterp/Interpreter/InterpreterCheckpoint.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "cppinterp/Incremental/IncrementalJIT.h"
+#include "cppinterp/Interpreter/Transaction.h"
+#include "cppinterp/Utils/Paths.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cppinterp {
+
+namespace {
+/// manifest的第一行，修改检查点格式时需要递增。
+const char* const kCheckpointVersion = "cppinterp-checkpoint-1";
+const char* const kManifestName = "manifest";
+/// StartupSnapshot的键，AST保存为ast.pch和ast.deps。
+const char* const kASTKey = "ast";
+
+llvm::Error makeError(const llvm::Twine& msg) {
+  return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                 "checkpoint: " + msg);
+}
+
+std::string getPath(llvm::StringRef dir, llvm::StringRef file) {
+  llvm::SmallString<256> path(dir);
+  llvm::sys::path::append(path, file);
+  return path.str().str();
+}
+
+/// 按事务链的顺序收集已提交事务(包括嵌套事务)的编译结果。
+llvm::Error collectObjects(
+    const Transaction& transaction, const IncrementalJIT& jit,
+    std::vector<const IncrementalJIT::RecordedObject*>& objects) {
+  for (auto it = transaction.nested_begin(), end = transaction.nested_end();
+       it != end; ++it) {
+    if (llvm::Error err = collectObjects(**it, jit, objects)) {
+      return err;
+    }
+  }
+
+  if (transaction.getState() != Transaction::kCommitted ||
+      !transaction.getCompiledModule()) {
+    return llvm::Error::success();
+  }
+  const IncrementalJIT::RecordedObject* recorded =
+      jit.getRecordedObject(transaction);
+  if (!recorded) {
+    return makeError("transaction " + llvm::Twine(transaction.getUniqueID()) +
+                     " was compiled before object recording was enabled");
+  }
+  if (recorded->object) {
+    objects.push_back(recorded);
+  }
+  return llvm::Error::success();
+}
+}  // namespace
+
+InterpreterCheckpoint::InterpreterCheckpoint(llvm::StringRef dir)
+    : dir_(dir.str()), ast_(dir, kASTKey) {}
+
+llvm::Error InterpreterCheckpoint::Save(llvm::StringRef dir,
+                                        clang::CompilerInstance& CI,
+                                        const Transaction* first,
+                                        const IncrementalJIT& jit) {
+  if (!jit.isRecordingObjects()) {
+    return makeError("object recording is not enabled");
+  }
+  if (std::error_code ec = llvm::sys::fs::create_directories(dir)) {
+    return makeError("cannot create '" + dir + "': " + ec.message());
+  }
+
+  // 先删除manifest，写到一半失败时目录中不会留下看起来完整的检查点。
+  std::string manifest_path = getPath(dir, kManifestName);
+  llvm::sys::fs::remove(manifest_path);
+
+  std::vector<const IncrementalJIT::RecordedObject*> objects;
+  for (const Transaction* t = first; t; t = t->getNext()) {
+    if (llvm::Error err = collectObjects(*t, jit, objects)) {
+      return err;
+    }
+  }
+  // 嵌套事务可能先于外层事务编译，静态初始化函数必须按编译顺序运行。
+  std::stable_sort(objects.begin(), objects.end(),
+                   [](const auto* lhs, const auto* rhs) {
+                     return lhs->sequence < rhs->sequence;
+                   });
+
+  if (!StartupSnapshot(dir, kASTKey).write(CI)) {
+    return makeError("cannot write the AST");
+  }
+
+  std::string manifest;
+  llvm::raw_string_ostream manifest_os(manifest);
+  manifest_os << kCheckpointVersion << "\n";
+  manifest_os << "triple " << CI.getTargetOpts().Triple << "\n";
+  for (size_t i = 0, e = objects.size(); i != e; ++i) {
+    std::string file = llvm::utostr(i) + ".o";
+    if (!utils::WriteFileAtomically(getPath(dir, file),
+                                    objects[i]->object->getBuffer())) {
+      return makeError("cannot write '" + file + "'");
+    }
+    manifest_os << "object " << file << "\n";
+    for (const std::string& ctor : objects[i]->ctors) {
+      manifest_os << "ctor " << ctor << "\n";
+    }
+  }
+  manifest_os.flush();
+
+  if (!utils::WriteFileAtomically(manifest_path, manifest)) {
+    return makeError("cannot write the manifest");
+  }
+  return llvm::Error::success();
+}
+
+llvm::Expected<std::unique_ptr<InterpreterCheckpoint>>
+InterpreterCheckpoint::Load(llvm::StringRef dir) {
+  auto manifest = llvm::MemoryBuffer::getFile(getPath(dir, kManifestName));
+  if (!manifest) {
+    return makeError("cannot read the manifest in '" + dir +
+                     "': " + manifest.getError().message());
+  }
+
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  (*manifest)->getBuffer().split(lines, '\n', /*MaxSplit=*/-1,
+                                 /*KeepEmpty=*/false);
+  if (lines.empty() || lines.front() != kCheckpointVersion) {
+    return makeError("unsupported checkpoint format in '" + dir + "'");
+  }
+
+  auto checkpoint = std::make_unique<InterpreterCheckpoint>(dir);
+  for (llvm::StringRef line : llvm::makeArrayRef(lines).drop_front()) {
+    llvm::StringRef kind, value;
+    std::tie(kind, value) = line.split(' ');
+    if (kind == "triple") {
+      checkpoint->triple_ = value.str();
+    } else if (kind == "object") {
+      checkpoint->objects_.push_back({value.str(), {}});
+    } else if (kind == "ctor" && !checkpoint->objects_.empty()) {
+      checkpoint->objects_.back().ctors.push_back(value.str());
+    } else {
+      return makeError("malformed manifest line '" + line + "'");
+    }
+  }
+  return std::move(checkpoint);
+}
+
+llvm::Error InterpreterCheckpoint::restore(IncrementalJIT& jit) const {
+  if (jit.getTargetMachine().getTargetTriple().str() != triple_) {
+    return makeError("saved for '" + triple_ + "', not for '" +
+                     jit.getTargetMachine().getTargetTriple().str() + "'");
+  }
+
+  // 先加入所有目标文件，它们之间的引用在第一次查找时一起解析。
+  for (const ObjectEntry& entry : objects_) {
+    auto obj = llvm::MemoryBuffer::getFile(getPath(dir_, entry.file),
+                                           /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+    if (!obj) {
+      return makeError("cannot map '" + entry.file +
+                       "': " + obj.getError().message());
+    }
+    if (llvm::Error err = jit.addRestoredObject(std::move(*obj))) {
+      return err;
+    }
+  }
+
+  for (const ObjectEntry& entry : objects_) {
+    for (const std::string& ctor : entry.ctors) {
+      void* addr = jit.getSymbolAddress(ctor, /*include_host_symbols=*/false);
+      if (!addr) {
+        return makeError("cannot find static initializer '" + ctor + "'");
+      }
+      (*reinterpret_cast<void (*)()>(addr))();
+    }
+  }
+  return llvm::Error::success();
+}
+
+}  // namespace cppinterp
@@ -0,0 +1,430 @@
+#include "cppinterp/Interpreter/LibraryIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "cppinterp/Interpreter/InvocationOptions.h"
+#include "cppinterp/Utils/Output.h"
+#include "cppinterp/Utils/Paths.h"
+#include "cppinterp/Utils/Platform.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/DJB.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cppinterp {
+
+namespace {
+/// 索引格式的版本，修改键的计算方式或文件格式时需要递增。
+const char* const kIndexVersion = "cppinterp-libindex-1";
+
+const char kIndexMagic[8] = {'C', 'P', 'I', 'L', 'I', 'B', 'X', '1'};
+
+/// 索引文件依次包含：Header，num_dirs个目录的FileStamp，num_libraries个库的
+/// FileStamp，num_buckets + 1个桶的起始下标，num_entries个Entry，
+/// 最后是strings_size字节的字符串表。所有整数使用本机字节序。
+struct Header {
+  char magic[8];
+  uint32_t num_dirs;
+  uint32_t num_libraries;
+  uint32_t num_buckets;
+  uint32_t num_entries;
+  uint64_t strings_size;
+};
+
+struct FileStamp {
+  uint32_t path_offset;
+  uint32_t path_size;
+  uint64_t size;
+  int64_t mtime;
+};
+
+/// 一个符号定义，同一个桶中的条目按库的搜索顺序排列。
+struct Entry {
+  uint32_t hash;
+  uint32_t name_offset;
+  uint32_t name_size;
+  uint32_t library;
+};
+
+bool GetFileStamp(llvm::StringRef path, uint64_t& size, int64_t& mtime,
+                  llvm::sys::fs::file_status* status = nullptr) {
+  llvm::sys::fs::file_status tmp;
+  if (!status) {
+    status = &tmp;
+  }
+  if (llvm::sys::fs::status(path, *status)) {
+    return false;
+  }
+  size = status->getSize();
+  mtime = status->getLastModificationTime().time_since_epoch().count();
+  return true;
+}
+
+bool IsSharedLibraryName(llvm::StringRef name) {
+  return name.endswith(".so") || name.contains(".so.");
+}
+
+/// 映射的索引文件中各部分的位置。
+struct IndexLayout {
+  const Header* header;
+  const FileStamp* dirs;
+  const FileStamp* libraries;
+  const uint32_t* buckets;
+  const Entry* entries;
+  const char* strings;
+
+  /// 检查buffer的大小和魔数，成功时填充各部分的位置。
+  bool parse(const llvm::MemoryBuffer& buffer) {
+    const char* data = buffer.getBufferStart();
+    size_t size = buffer.getBufferSize();
+    if (size < sizeof(Header)) {
+      return false;
+    }
+    header = reinterpret_cast<const Header*>(data);
+    if (std::memcmp(header->magic, kIndexMagic, sizeof(kIndexMagic)) ||
+        !llvm::isPowerOf2_32(header->num_buckets)) {
+      return false;
+    }
+    uint64_t num_stamps = uint64_t(header->num_dirs) + header->num_libraries;
+    uint64_t expected = sizeof(Header) + num_stamps * sizeof(FileStamp) +
+                        (uint64_t(header->num_buckets) + 1) * sizeof(uint32_t) +
+                        uint64_t(header->num_entries) * sizeof(Entry) +
+                        header->strings_size;
+    if (size != expected) {
+      return false;
+    }
+    dirs = reinterpret_cast<const FileStamp*>(header + 1);
+    libraries = dirs + header->num_dirs;
+    buckets = reinterpret_cast<const uint32_t*>(libraries +
+                                                header->num_libraries);
+    entries = reinterpret_cast<const Entry*>(buckets + header->num_buckets + 1);
+    strings = reinterpret_cast<const char*>(entries + header->num_entries);
+    return true;
+  }
+
+  llvm::StringRef getString(uint32_t offset, uint32_t size) const {
+    if (uint64_t(offset) + size > header->strings_size) {
+      return llvm::StringRef();
+    }
+    return llvm::StringRef(strings + offset, size);
+  }
+};
+
+}  // namespace
+
+LibraryIndex::LibraryIndex(llvm::StringRef path,
+                           llvm::ArrayRef<std::string> search_paths)
+    : path_(path.str()), search_paths_(search_paths.vec()) {}
+
+LibraryIndex::~LibraryIndex() {}
+
+std::unique_ptr<LibraryIndex> LibraryIndex::Create(
+    const CompilerOptions& opts, llvm::ArrayRef<std::string> search_paths) {
+  if (opts.CachePath.empty() || !opts.UseLibraryIndex) {
+    return nullptr;
+  }
+
+  llvm::SmallString<256> path(opts.CachePath);
+  llvm::sys::path::append(path, "libraries");
+  if (std::error_code ec = llvm::sys::fs::create_directories(path)) {
+    cppinterp::errs() << "cppinterp: cannot create library index directory '"
+                      << path << "': " << ec.message() << "\n";
+    return nullptr;
+  }
+  llvm::sys::path::append(path, computeKey(search_paths) + ".idx");
+  return std::make_unique<LibraryIndex>(path, search_paths);
+}
+
+std::string LibraryIndex::computeKey(llvm::ArrayRef<std::string> search_paths) {
+  llvm::SHA1 hasher;
+  auto add = [&hasher](llvm::StringRef str) {
+    hasher.update(str);
+    hasher.update(llvm::StringRef("\0", 1));
+  };
+  add(kIndexVersion);
+  add(llvm::sys::getProcessTriple());
+  for (const std::string& dir : search_paths) {
+    add(dir);
+  }
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+bool LibraryIndex::isValid(const llvm::MemoryBuffer& buffer) const {
+  IndexLayout layout;
+  if (!layout.parse(buffer)) {
+    return false;
+  }
+
+  // 目录的修改时间在增删文件时改变；库被原地替换时只有它自己的时间改变。
+  const Header& header = *layout.header;
+  uint64_t num_stamps = uint64_t(header.num_dirs) + header.num_libraries;
+  for (uint64_t i = 0; i < num_stamps; ++i) {
+    const FileStamp& stamp = layout.dirs[i];
+    llvm::StringRef path = layout.getString(stamp.path_offset, stamp.path_size);
+    uint64_t size;
+    int64_t mtime;
+    if (path.empty() || !GetFileStamp(path, size, mtime) ||
+        mtime != stamp.mtime || (i >= header.num_dirs && size != stamp.size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LibraryIndex::open() {
+  buffer_.reset();
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(path_, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer || !isValid(**buffer)) {
+    return false;
+  }
+  buffer_ = std::move(*buffer);
+  return true;
+}
+
+bool LibraryIndex::build() {
+  buffer_.reset();
+
+  std::string strings;
+  llvm::StringMap<uint32_t> string_offsets;
+  auto intern = [&](llvm::StringRef str) {
+    auto it = string_offsets.try_emplace(str, strings.size());
+    if (it.second) {
+      strings.append(str.begin(), str.end());
+    }
+    return it.first->second;
+  };
+
+  std::vector<FileStamp> dirs;
+  std::vector<FileStamp> libraries;
+  std::vector<Entry> entries;
+  llvm::DenseSet<llvm::sys::fs::UniqueID> seen;
+  llvm::Triple::ArchType host_arch =
+      llvm::Triple(llvm::sys::getProcessTriple()).getArch();
+
+  for (const std::string& dir : search_paths_) {
+    FileStamp dir_stamp = {};
+    if (!GetFileStamp(dir, dir_stamp.size, dir_stamp.mtime)) {
+      continue;
+    }
+    dir_stamp.size = 0;
+    dir_stamp.path_offset = intern(dir);
+    dir_stamp.path_size = dir.size();
+    dirs.push_back(dir_stamp);
+
+    // 按名字排序，索引的内容与目录的遍历顺序无关。
+    std::vector<std::string> names;
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(dir, ec), end; it != end && !ec;
+         it.increment(ec)) {
+      llvm::StringRef name = llvm::sys::path::filename(it->path());
+      if (IsSharedLibraryName(name)) {
+        names.push_back(it->path());
+      }
+    }
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& path : names) {
+      llvm::sys::fs::file_status status;
+      FileStamp stamp = {};
+      if (!GetFileStamp(path, stamp.size, stamp.mtime, &status) ||
+          status.type() != llvm::sys::fs::file_type::regular_file ||
+          !seen.insert(status.getUniqueID()).second) {
+        continue;
+      }
+
+      auto binary = llvm::object::ObjectFile::createObjectFile(path);
+      if (!binary) {
+        llvm::consumeError(binary.takeError());
+        continue;
+      }
+      const auto* elf =
+          llvm::dyn_cast<llvm::object::ELFObjectFileBase>(binary->getBinary());
+      if (!elf || elf->getArch() != host_arch) {
+        continue;
+      }
+
+      uint32_t library = libraries.size();
+      stamp.path_offset = intern(path);
+      stamp.path_size = path.size();
+      libraries.push_back(stamp);
+
+      for (const llvm::object::ELFSymbolRef& sym :
+           elf->getDynamicSymbolIterators()) {
+        llvm::Expected<uint32_t> flags = sym.getFlags();
+        if (!flags) {
+          llvm::consumeError(flags.takeError());
+          continue;
+        }
+        if ((*flags & llvm::object::SymbolRef::SF_Undefined) ||
+            (*flags & llvm::object::SymbolRef::SF_Weak) ||
+            !(*flags & llvm::object::SymbolRef::SF_Global)) {
+          continue;
+        }
+        llvm::Expected<llvm::StringRef> name = sym.getName();
+        if (!name) {
+          llvm::consumeError(name.takeError());
+          continue;
+        }
+        if (name->empty()) {
+          continue;
+        }
+        entries.push_back({llvm::djbHash(*name), intern(*name),
+                           static_cast<uint32_t>(name->size()), library});
+      }
+    }
+  }
+
+  // 大约每个桶两个条目。稳定排序保持同一个桶内库的搜索顺序。
+  uint32_t num_buckets =
+      llvm::PowerOf2Ceil(std::max<uint64_t>(entries.size() / 2, 1));
+  std::stable_sort(entries.begin(), entries.end(),
+                   [num_buckets](const Entry& lhs, const Entry& rhs) {
+                     return (lhs.hash & (num_buckets - 1)) <
+                            (rhs.hash & (num_buckets - 1));
+                   });
+  std::vector<uint32_t> buckets(num_buckets + 1, 0);
+  for (const Entry& entry : entries) {
+    ++buckets[(entry.hash & (num_buckets - 1)) + 1];
+  }
+  for (uint32_t i = 0; i < num_buckets; ++i) {
+    buckets[i + 1] += buckets[i];
+  }
+
+  Header header = {};
+  std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+  header.num_dirs = dirs.size();
+  header.num_libraries = libraries.size();
+  header.num_buckets = num_buckets;
+  header.num_entries = entries.size();
+  header.strings_size = strings.size();
+
+  std::string contents;
+  contents.reserve(sizeof(header) +
+                   (dirs.size() + libraries.size()) * sizeof(FileStamp) +
+                   buckets.size() * sizeof(uint32_t) +
+                   entries.size() * sizeof(Entry) + strings.size());
+  auto write = [&contents](const void* data, size_t size) {
+    contents.append(static_cast<const char*>(data), size);
+  };
+  write(&header, sizeof(header));
+  write(dirs.data(), dirs.size() * sizeof(FileStamp));
+  write(libraries.data(), libraries.size() * sizeof(FileStamp));
+  write(buckets.data(), buckets.size() * sizeof(uint32_t));
+  write(entries.data(), entries.size() * sizeof(Entry));
+  contents += strings;
+  // 其他进程永远不会读到写了一半的索引。
+  if (!utils::WriteFileAtomically(path_, contents)) {
+    return false;
+  }
+  return open();
+}
+
+llvm::StringRef LibraryIndex::lookup(llvm::StringRef name) const {
+  IndexLayout layout;
+  if (!buffer_ || !layout.parse(*buffer_)) {
+    return llvm::StringRef();
+  }
+  const Header& header = *layout.header;
+  uint32_t hash = llvm::djbHash(name);
+  uint32_t bucket = hash & (header.num_buckets - 1);
+  uint32_t end = std::min(layout.buckets[bucket + 1], header.num_entries);
+  for (uint32_t i = layout.buckets[bucket]; i < end; ++i) {
+    const Entry& entry = layout.entries[i];
+    if (entry.hash != hash || entry.library >= header.num_libraries ||
+        layout.getString(entry.name_offset, entry.name_size) != name) {
+      continue;
+    }
+    const FileStamp& library = layout.libraries[entry.library];
+    return layout.getString(library.path_offset, library.path_size);
+  }
+  return llvm::StringRef();
+}
+
+size_t LibraryIndex::getNumLibraries() const {
+  IndexLayout layout;
+  if (!buffer_ || !layout.parse(*buffer_)) {
+    return 0;
+  }
+  return layout.header->num_libraries;
+}
+
+size_t LibraryIndex::getNumSymbols() const {
+  IndexLayout layout;
+  if (!buffer_ || !layout.parse(*buffer_)) {
+    return 0;
+  }
+  return layout.header->num_entries;
+}
+
+namespace {
+
+/// 通过LibraryIndex为JIT中未解析的符号加载库。
+class LibraryAutoloadGenerator : public llvm::orc::DefinitionGenerator {
+  std::shared_ptr<const LibraryIndex> index_;
+
+  /// 已经加载过(或者加载失败)的库，不再重复尝试。
+  llvm::StringSet<> attempted_;
+  std::mutex mutex_;
+
+ public:
+  explicit LibraryAutoloadGenerator(std::shared_ptr<const LibraryIndex> index)
+      : index_(std::move(index)) {}
+
+  llvm::Error tryToGenerate(
+      llvm::orc::LookupState&, llvm::orc::LookupKind, llvm::orc::JITDylib& jd,
+      llvm::orc::JITDylibLookupFlags,
+      const llvm::orc::SymbolLookupSet& symbols) override {
+    llvm::orc::SymbolMap found;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& symbol : symbols) {
+      llvm::StringRef name = *symbol.first;
+      llvm::StringRef library = index_->lookup(name);
+      if (library.empty()) {
+        continue;
+      }
+      if (attempted_.insert(library).second) {
+        std::string err;
+        if (!platform::DLOpen(library.str(), &err)) {
+          cppinterp::errs() << "cppinterp: cannot load '" << library
+                            << "' for symbol '" << name << "': " << err
+                            << "\n";
+          continue;
+        }
+      }
+      if (const void* addr = platform::DLSym(name.str())) {
+        found[symbol.first] = llvm::JITEvaluatedSymbol(
+            llvm::pointerToJITTargetAddress(addr),
+            llvm::JITSymbolFlags::Exported);
+      }
+    }
+    if (found.empty()) {
+      return llvm::Error::success();
+    }
+    return jd.define(llvm::orc::absoluteSymbols(std::move(found)));
+  }
+};
+
+}  // namespace
+
+std::unique_ptr<llvm::orc::DefinitionGenerator> LibraryIndex::createGenerator(
+    std::shared_ptr<const LibraryIndex> index) {
+  return std::make_unique<LibraryAutoloadGenerator>(std::move(index));
+}
+
+}  // namespace cppinterp
@@ -0,0 +1,85 @@
+#include "cppinterp/Interpreter/PreparedSnippet.h"
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Type.h"
+
+namespace cppinterp {
+
+static clang::QualType GetComparableType(clang::QualType type) {
+  return type.getCanonicalType().getNonReferenceType().getUnqualifiedType();
+}
+
+/// 与SnippetTypeKind相同地把片段中的类型映射为Value::TypeKind。
+static Value::TypeKind GetTypeKind(clang::QualType type) {
+  type = GetComparableType(type);
+  if (type->isVoidType()) {
+    return Value::kVoid;
+  }
+  if (const auto* et = type->getAs<clang::EnumType>()) {
+    type = et->getDecl()->getIntegerType().getCanonicalType();
+  }
+  const auto* bt = type->getAs<clang::BuiltinType>();
+  if (!bt || bt->isNullPtrType()) {
+    return Value::kPtrOrObjTy;
+  }
+  switch (bt->getKind()) {
+#define X(type, name)            \
+  case clang::BuiltinType::name: \
+    return Value::k##name;
+    CPPINTERP_VALUE_BUILTIN_TYPES
+#undef X
+    default:
+      return Value::kInvalid;
+  }
+}
+
+PreparedSnippet::PreparedSnippet(Interpreter& interpreter, ThunkT thunk,
+                                 std::vector<void*> param_types,
+                                 void* result_type,
+                                 std::vector<std::string> param_type_names,
+                                 std::string result_type_name)
+    : interpreter_(interpreter),
+      thunk_(thunk),
+      param_types_(std::move(param_types)),
+      result_type_(result_type),
+      result_kind_(GetTypeKind(clang::QualType::getFromOpaquePtr(result_type))),
+      param_type_names_(std::move(param_type_names)),
+      result_type_name_(std::move(result_type_name)) {
+  param_kinds_.reserve(param_types_.size());
+  for (void* type : param_types_) {
+    param_kinds_.push_back(GetTypeKind(clang::QualType::getFromOpaquePtr(type)));
+  }
+}
+
+bool PreparedSnippet::invoke(const std::vector<Value>& args,
+                             Value& result) const {
+  if (args.size() != param_types_.size()) {
+    return false;
+  }
+
+  std::vector<void*> arg_ptrs;
+  arg_ptrs.reserve(args.size() + 1);
+  for (size_t i = 0, e = args.size(); i != e; ++i) {
+    if (!args[i].hasValue()) {
+      return false;
+    }
+    clang::QualType param_type =
+        clang::QualType::getFromOpaquePtr(param_types_[i]);
+    if (GetComparableType(args[i].getType()) !=
+        GetComparableType(param_type)) {
+      return false;
+    }
+    // 非const引用参数会修改传入的Value。
+    arg_ptrs.push_back(const_cast<void*>(args[i].getDataAddress()));
+  }
+  arg_ptrs.push_back(nullptr);
+
+  clang::QualType result_type = clang::QualType::getFromOpaquePtr(result_type_);
+  Value value(result_type, interpreter_);
+  thunk_(arg_ptrs.data(),
+         result_type->isVoidType() ? nullptr : value.getDataAddress());
+  result = std::move(value);
+  return true;
+}
+
+}  // namespace cppinterp
@@ -0,0 +1,191 @@
+#include "cppinterp/Interpreter/SessionHost.h"
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Type.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "cppinterp/AST/AST.h"
+#include "cppinterp/Interpreter/CompilationOptions.h"
+#include "cppinterp/Interpreter/LibraryIndex.h"
+#include "cppinterp/Interpreter/Transaction.h"
+#include "cppinterp/Interpreter/Value.h"
+#include "cppinterp/Utils/SourceNormalization.h"
+
+namespace cppinterp {
+
+/// 返回包装函数结果的记录类型，与Value::ManagedAllocate()选择析构函数的
+/// 方式相同；结果不是记录(或记录的数组)时返回nullptr。
+static const clang::RecordDecl* GetResultRecord(
+    const clang::FunctionDecl* wrapper) {
+  const clang::Expr* last = ast::analyze::GetOrCreateLastExpr(
+      const_cast<clang::FunctionDecl*>(wrapper));
+  if (!last) {
+    return nullptr;
+  }
+  clang::QualType type = last->getType();
+  if (const clang::ConstantArrayType* arr_type =
+          llvm::dyn_cast<clang::ConstantArrayType>(type.getTypePtr())) {
+    type = arr_type->getElementType();
+  }
+  const clang::RecordType* record_type = type->getAs<clang::RecordType>();
+  return record_type ? record_type->getDecl() : nullptr;
+}
+
+SessionHost::Session::Session(std::shared_ptr<SharedState> state,
+                              SessionID id,
+                              std::unique_ptr<Interpreter> interpreter)
+    : state_(std::move(state)),
+      id_(id),
+      interpreter_(std::move(interpreter)) {}
+
+SessionHost::Session::~Session() {
+  // 子解释器析构时会卸载事务，可能触发对基础解释器AST的查找。
+  std::lock_guard<std::mutex> compile_lock(state_->compile_mutex);
+  interpreter_.reset();
+}
+
+Interpreter::CompilationResult SessionHost::Session::process(
+    const std::string& input, Value* value) {
+  std::lock_guard<std::mutex> session_lock(mutex_);
+  Interpreter& interpreter = *interpreter_;
+
+  // 与Interpreter::process()相同地选择declare或者包装求值，
+  // 但只编译包装函数，在释放编译锁之后再运行它。
+  const clang::FunctionDecl* wrapper = nullptr;
+  {
+    std::lock_guard<std::mutex> compile_lock(state_->compile_mutex);
+    size_t wrap_point =
+        interpreter.isRawInputEnabled()
+            ? std::string::npos
+            : utils::getWrapPoint(input, interpreter.getCI()->getLangOpts());
+
+    CompilationOptions co = interpreter.makeDefaultCompilationOpts();
+    co.ValuePrinting = CompilationOptions::VPDisabled;
+    if (wrap_point == std::string::npos) {
+      co.DeclarationExtraction = 0;
+      co.ResultEvaluation = 0;
+      return interpreter.DeclareInternal(input, co);
+    }
+
+    co.DeclarationExtraction = 1;
+    co.ResultEvaluation = value != nullptr;
+    co.EnableShadowing = interpreter.getRuntimeOptions().AllowRedefinition;
+    co.IgnorePromptDiags = 1;
+    std::string buffer;
+    const std::string& wrapped =
+        interpreter.WrapInput(input, buffer, wrap_point);
+    Transaction* transaction = nullptr;
+    if (interpreter.DeclareInternal(wrapped, co, &transaction) !=
+        Interpreter::kSuccess) {
+      return Interpreter::kFailure;
+    }
+    wrapper = transaction ? transaction->getWrapperFD() : nullptr;
+
+    // 包装函数在锁外把结果存入Value，需要析构的结果会在那里编译析构函数的
+    // 调用，而编译需要读取基础解释器的AST。在这里预先编译，
+    // Value::ManagedAllocate()随后只会命中缓存。
+    if (wrapper && value) {
+      if (const clang::RecordDecl* record = GetResultRecord(wrapper)) {
+        interpreter.compileDtorCallFor(record);
+      }
+    }
+  }
+
+  if (value) {
+    *value = Value();
+  }
+  if (!wrapper) {
+    return Interpreter::kSuccess;
+  }
+  return interpreter.RunFunction(wrapper, value) == Interpreter::kExeSuccess
+             ? Interpreter::kSuccess
+             : Interpreter::kFailure;
+}
+
+Interpreter::CompilationResult SessionHost::Session::declare(
+    const std::string& input) {
+  return withInterpreter(
+      [&](Interpreter& interpreter) { return interpreter.declare(input); });
+}
+
+void* SessionHost::Session::compileFunction(llvm::StringRef name,
+                                            llvm::StringRef code) {
+  return withInterpreter([&](Interpreter& interpreter) {
+    return interpreter.compileFunction(name, code);
+  });
+}
+
+SessionHost::SessionHost(std::shared_ptr<const Interpreter> base,
+                         std::vector<std::string> args)
+    : state_(std::make_shared<SharedState>()), args_(std::move(args)) {
+  state_->base = std::move(base);
+  if (args_.empty()) {
+    args_.push_back("cppinterp");
+  }
+}
+
+SessionHost::~SessionHost() {
+  // 其他线程仍然持有的会话通过state_保持基础解释器和编译锁，
+  // 它们在最后一个引用释放时销毁。
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  sessions_.clear();
+}
+
+std::shared_ptr<SessionHost::Session> SessionHost::createSession() {
+  std::vector<const char*> argv;
+  argv.reserve(args_.size());
+  for (const std::string& arg : args_) {
+    argv.push_back(arg.c_str());
+  }
+
+  std::unique_ptr<Interpreter> interpreter;
+  {
+    std::lock_guard<std::mutex> compile_lock(state_->compile_mutex);
+    interpreter = std::make_unique<Interpreter>(*state_->base, argv.size(),
+                                                argv.data());
+    if (!interpreter->isValid()) {
+      return nullptr;
+    }
+    // 共享基础解释器的库索引，而不是为每个会话打开一份。
+    if (std::shared_ptr<LibraryIndex> index = state_->base->library_index_) {
+      interpreter->library_index_ = index;
+      interpreter->addGenerator(LibraryIndex::createGenerator(index));
+    }
+  }
+
+  SessionID id = next_id_++;
+  auto session =
+      std::make_shared<Session>(state_, id, std::move(interpreter));
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  sessions_.emplace(id, session);
+  return session;
+}
+
+std::shared_ptr<SessionHost::Session> SessionHost::getSession(
+    SessionID id) const {
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  auto it = sessions_.find(id);
+  return it == sessions_.end() ? nullptr : it->second;
+}
+
+bool SessionHost::closeSession(SessionID id) {
+  std::shared_ptr<Session> session;
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end()) {
+      return false;
+    }
+    session = std::move(it->second);
+    sessions_.erase(it);
+  }
+  // session在这里释放，不持有sessions_mutex_，以免等待编译锁时阻塞其他会话。
+  return true;
+}
+
+size_t SessionHost::getNumSessions() const {
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  return sessions_.size();
+}
+
+}  // namespace cppinterp
@@ -0,0 +1,200 @@
+#include "cppinterp/Interpreter/StartupSnapshot.h"
+
+#include <tuple>
+
+#include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Serialization/ASTWriter.h"
+#include "cppinterp/Interpreter/InvocationOptions.h"
+#include "cppinterp/Utils/Output.h"
+#include "cppinterp/Utils/Paths.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitstream/BitstreamWriter.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cppinterp {
+
+namespace {
+/// 快照格式的版本，修改键的计算方式或deps文件的格式时需要递增。
+const char* const kSnapshotVersion = "cppinterp-startup-1";
+}  // namespace
+
+StartupSnapshot::StartupSnapshot(llvm::StringRef dir, llvm::StringRef key)
+    : dir_(dir.str()), key_(key.str()) {}
+
+std::unique_ptr<StartupSnapshot> StartupSnapshot::Create(
+    const CompilerOptions& opts, const clang::CompilerInvocation& invocation,
+    bool no_runtime) {
+  if (opts.CachePath.empty() || !opts.UseStartupSnapshot) {
+    return nullptr;
+  }
+
+  llvm::SmallString<256> dir(opts.CachePath);
+  llvm::sys::path::append(dir, "startup");
+  if (std::error_code ec = llvm::sys::fs::create_directories(dir)) {
+    cppinterp::errs() << "cppinterp: cannot create startup snapshot "
+                      << "directory '" << dir << "': " << ec.message() << "\n";
+    return nullptr;
+  }
+
+  return std::make_unique<StartupSnapshot>(
+      dir, computeKey(opts, invocation, no_runtime));
+}
+
+std::string StartupSnapshot::computeKey(
+    const CompilerOptions& opts, const clang::CompilerInvocation& invocation,
+    bool no_runtime) {
+  llvm::SHA1 hasher;
+  auto add = [&hasher](llvm::StringRef str) {
+    hasher.update(str);
+    hasher.update(llvm::StringRef("\0", 1));
+  };
+
+  add(kSnapshotVersion);
+  add(clang::getClangFullVersion());
+  add(invocation.getTargetOpts().Triple);
+  add(no_runtime ? "no-runtime" : "runtime");
+
+  // 影响语言方言和头文件查找的标志；Verbose、HasOutput等不影响AST。
+  add(llvm::utostr(opts.Language));
+  add(llvm::utostr(opts.StdVersion));
+  add(llvm::utostr(opts.StdLib));
+  add(llvm::utostr(opts.NoBuiltinInc));
+  add(llvm::utostr(opts.NoCXXInc));
+  add(llvm::utostr(opts.CxxModules));
+  add(llvm::utostr(opts.CUDAHost));
+  add(llvm::utostr(opts.CUDADevice));
+  add(opts.CUDAGpuArch);
+  for (const char* arg : opts.Remaining) {
+    add(arg);
+  }
+
+  const clang::HeaderSearchOptions& hs_opts = invocation.getHeaderSearchOpts();
+  add(hs_opts.Sysroot);
+  add(hs_opts.ResourceDir);
+  for (const auto& entry : hs_opts.UserEntries) {
+    add(entry.Path);
+    add(llvm::utostr(entry.Group));
+    add(llvm::utostr(entry.IsFramework));
+    add(llvm::utostr(entry.IgnoreSysRoot));
+  }
+  for (const auto& prefix : hs_opts.SystemHeaderPrefixes) {
+    add(prefix.Prefix);
+    add(llvm::utostr(prefix.IsSystemHeader));
+  }
+
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+std::string StartupSnapshot::getPCHPath() const {
+  llvm::SmallString<256> path(dir_);
+  llvm::sys::path::append(path, key_ + ".pch");
+  return path.str().str();
+}
+
+std::string StartupSnapshot::getDepsPath() const {
+  llvm::SmallString<256> path(dir_);
+  llvm::sys::path::append(path, key_ + ".deps");
+  return path.str().str();
+}
+
+bool StartupSnapshot::isUsable() const {
+  if (!llvm::sys::fs::exists(getPCHPath())) {
+    return false;
+  }
+
+  auto deps = llvm::MemoryBuffer::getFile(getDepsPath());
+  if (!deps) {
+    return false;
+  }
+
+  // 第一行是键，之后每行是"<大小> <修改时间> <路径>"。
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  (*deps)->getBuffer().split(lines, '\n', /*MaxSplit=*/-1,
+                             /*KeepEmpty=*/false);
+  if (lines.empty() || lines.front() != key_) {
+    return false;
+  }
+
+  for (llvm::StringRef line : llvm::makeArrayRef(lines).drop_front()) {
+    llvm::StringRef size_str, mtime_str, path;
+    std::tie(size_str, line) = line.split(' ');
+    std::tie(mtime_str, path) = line.split(' ');
+
+    uint64_t size;
+    int64_t mtime;
+    if (size_str.getAsInteger(10, size) || mtime_str.getAsInteger(10, mtime)) {
+      return false;
+    }
+
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(path, status) || status.getSize() != size ||
+        llvm::sys::toTimeT(status.getLastModificationTime()) != mtime) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void StartupSnapshot::applyTo(clang::CompilerInvocation& invocation) const {
+  clang::PreprocessorOptions& pp_opts = invocation.getPreprocessorOpts();
+  pp_opts.ImplicitPCHInclude = getPCHPath();
+  // deps文件已经检查过输入文件，clang仍然会校验PCH与当前选项是否兼容。
+  pp_opts.AllowPCHWithCompilerErrors = false;
+}
+
+bool StartupSnapshot::write(clang::CompilerInstance& CI) const {
+  if (CI.getDiagnostics().hasErrorOccurred()) {
+    return false;
+  }
+
+  // 必须在没有未完成事务的时候调用，否则会写入一半的声明。
+  llvm::SmallVector<char, 0> buffer;
+  {
+    llvm::BitstreamWriter stream(buffer);
+    clang::ASTWriter writer(stream, buffer, CI.getModuleCache(),
+                            /*Extensions=*/{});
+    writer.WriteAST(CI.getSema(), getPCHPath(), /*WritingModule=*/nullptr,
+                    CI.getHeaderSearchOpts().Sysroot);
+  }
+  if (CI.getDiagnostics().hasErrorOccurred()) {
+    return false;
+  }
+
+  std::string deps;
+  llvm::raw_string_ostream deps_os(deps);
+  deps_os << key_ << "\n";
+  const clang::SourceManager& SM = CI.getSourceManager();
+  for (auto it = SM.fileinfo_begin(), end = SM.fileinfo_end(); it != end;
+       ++it) {
+    const clang::FileEntry* file = it->first;
+    deps_os << file->getSize() << " " << file->getModificationTime() << " "
+            << file->getName() << "\n";
+  }
+  deps_os.flush();
+
+  // 先写PCH再写deps：只有deps存在时isUsable()才为真。
+  llvm::sys::fs::remove(getDepsPath());
+  if (!utils::WriteFileAtomically(
+          getPCHPath(), llvm::StringRef(buffer.data(), buffer.size())) ||
+      !utils::WriteFileAtomically(getDepsPath(), deps)) {
+    invalidate();
+    return false;
+  }
+  return true;
+}
+
+void StartupSnapshot::invalidate() const {
+  llvm::sys::fs::remove(getDepsPath());
+  llvm::sys::fs::remove(getPCHPath());
+}
+
+}  // namespace cppinterp
@@ -1,5 +1,7 @@
 #include "cppinterp/Interpreter/Transaction.h"
 
+#include <atomic>
+
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/DeclBase.h"
 #include "clang/AST/PrettyPrinter.h"
@@ -91,10 +93,15 @@ void Transaction::Initialize() {
   opts_ = CompilationOptions();
   definition_shadow_ns_ = 0;
   module_ = 0;
+  module_context_ = llvm::orc::ThreadSafeContext();
+  compiled_module_ = nullptr;
   wrapper_fd_ = 0;
   next_ = 0;
   buffer_fid_ = clang::FileID();  // sets it to invalid.
   exe_ = 0;
+  // 可能有多个解释器在不同的线程上创建事务。
+  static std::atomic<unsigned> next_unique_id(1);
+  unique_id_ = next_unique_id.fetch_add(1, std::memory_order_relaxed);
 }
 
 Transaction::~Transaction() {
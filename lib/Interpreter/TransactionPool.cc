@@ -0,0 +1,114 @@
+#include "cppinterp/Interpreter/TransactionPool.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "cppinterp/Interpreter/Transaction.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cppinterp {
+
+TransactionPool::~TransactionPool() {
+  assert(!stats_.live && "Transactions must be released before their pool");
+  for (Transaction* transaction : free_) {
+    transaction->~Transaction();
+  }
+}
+
+void TransactionPool::refill() {
+  size_t count = std::min<size_t>(
+      std::max<size_t>(stats_.peak_live, kMinSlabTransactions),
+      kMaxSlabTransactions);
+  char* slab = static_cast<char*>(slabs_.Allocate(
+      count * sizeof(Transaction), llvm::Align(alignof(Transaction))));
+  for (size_t i = count; i-- > 0;) {
+    storage_.push_back(slab + i * sizeof(Transaction));
+  }
+  ++stats_.slabs;
+  stats_.slab_transactions += count;
+}
+
+size_t TransactionPool::getTypicalQueueSize() const {
+  uint64_t seen = 0;
+  for (unsigned i = 0; i != kNumBuckets; ++i) {
+    seen += queue_histogram_[i];
+    if (seen * 10 >= queue_samples_ * 9) {
+      return size_t(1) << i;
+    }
+  }
+  return size_t(1) << (kNumBuckets - 1);
+}
+
+Transaction* TransactionPool::takeTransaction(const CompilationOptions& opts) {
+  ++stats_.requests;
+  stats_.peak_live = std::max(stats_.peak_live, ++stats_.live);
+
+  if (!free_.empty()) {
+    ++stats_.hits;
+    Transaction* transaction = free_.pop_back_val();
+    transaction->opts_ = opts;
+    return transaction;
+  }
+
+  if (storage_.empty()) {
+    refill();
+  }
+  return new (storage_.pop_back_val()) Transaction(opts, sema_);
+}
+
+void TransactionPool::releaseTransaction(Transaction* transaction,
+                                         bool reuse) {
+  // 嵌套事务也来自池，不能让~Transaction delete它们。
+  if (transaction->nested_transactions_) {
+    for (Transaction* nested : *transaction->nested_transactions_) {
+      releaseTransaction(nested, reuse);
+    }
+    transaction->nested_transactions_.reset();
+  }
+
+  assert(stats_.live && "Releasing a transaction that was not taken");
+  --stats_.live;
+
+  size_t queue_size = transaction->decl_queue_.size();
+  unsigned bucket = queue_size ? llvm::Log2_64(queue_size) + 1 : 0;
+  ++queue_histogram_[std::min(bucket, kNumBuckets - 1)];
+  ++queue_samples_;
+
+  size_t max_free = std::max<size_t>(stats_.peak_live, kMinSlabTransactions);
+  if (!reuse || free_.size() >= max_free) {
+    transaction->~Transaction();
+    storage_.push_back(transaction);
+    return;
+  }
+
+  // 保留与通常的输入相称的缓冲区，释放远大于它的缓冲区。
+  size_t max_capacity = std::max(Transaction::DeclQueue().capacity(),
+                                 4 * getTypicalQueueSize());
+  for (Transaction::DeclQueue* queue :
+       {&transaction->decl_queue_, &transaction->deserialized_decl_queue_}) {
+    if (queue->capacity() > max_capacity) {
+      Transaction::DeclQueue().swap(*queue);
+      ++stats_.trimmed_buffers;
+    } else {
+      queue->clear();
+    }
+  }
+  transaction->macro_directive_info_queue_.clear();
+  transaction->Initialize();
+  free_.push_back(transaction);
+}
+
+void TransactionPool::dump(llvm::raw_ostream& out) const {
+  out << "Transaction pool: " << stats_.requests << " requests, "
+      << stats_.hits << " hits ("
+      << llvm::format("%.1f", stats_.getHitRate() * 100) << "%), "
+      << stats_.slabs << " slabs (" << stats_.slab_transactions
+      << " transactions), " << stats_.trimmed_buffers
+      << " trimmed buffers, " << stats_.live << " live (peak "
+      << stats_.peak_live << "), typical queue size "
+      << getTypicalQueueSize() << "\n";
+}
+
+}  // namespace cppinterp
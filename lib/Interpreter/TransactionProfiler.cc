@@ -0,0 +1,207 @@
+#include "cppinterp/Interpreter/TransactionProfiler.h"
+
+#include <algorithm>
+
+#include "cppinterp/Interpreter/Transaction.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cppinterp {
+
+namespace {
+/// 保存在记录中的输入的最大长度。
+const size_t kMaxInputLength = 64;
+
+/// 当前线程正在收集的记录。
+thread_local TransactionProfiler::Record* current_record = nullptr;
+/// 当前阶段在current_record->nodes中的下标，-1表示不在任何阶段中。
+thread_local int current_node = -1;
+/// 当前阶段最近一次开始计时的时刻。
+thread_local std::chrono::steady_clock::time_point phase_start;
+
+uint64_t elapsedNs(std::chrono::steady_clock::time_point from,
+                   std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from)
+      .count();
+}
+
+void addSelfTime(TransactionProfiler::Record& record, int node, uint64_t ns) {
+  record.nodes[node].self_ns += ns;
+  record.phase_ns[record.nodes[node].phase] += ns;
+}
+
+/// 返回parent下phase的节点，不存在时创建它。
+int getChildNode(TransactionProfiler::Record& record, int parent,
+                 TransactionProfiler::Phase phase) {
+  for (size_t i = 0, e = record.nodes.size(); i != e; ++i) {
+    if (record.nodes[i].parent == parent && record.nodes[i].phase == phase) {
+      return i;
+    }
+  }
+  TransactionProfiler::PhaseNode node;
+  node.phase = phase;
+  node.parent = parent;
+  record.nodes.push_back(node);
+  return record.nodes.size() - 1;
+}
+
+void dumpNode(llvm::raw_ostream& out,
+              const TransactionProfiler::Record& record, int node,
+              unsigned depth) {
+  const TransactionProfiler::PhaseNode& n = record.nodes[node];
+  out.indent(11 + 2 * depth)
+      << TransactionProfiler::getPhaseName(n.phase)
+      << llvm::format(": %.3f ms (self %.3f ms) x%u\n", n.total_ns / 1e6,
+                      n.self_ns / 1e6, n.count);
+  for (size_t i = node + 1, e = record.nodes.size(); i != e; ++i) {
+    if (record.nodes[i].parent == node) {
+      dumpNode(out, record, i, depth + 1);
+    }
+  }
+}
+}  // namespace
+
+const char* TransactionProfiler::getPhaseName(Phase phase) {
+  static const char* const phase_names[kNumPhases] = {
+      "compile",        "parse",    "sema",        "codegen", "transformers",
+      "backend-passes", "jit-link", "static-init", "execution"};
+  return phase_names[phase];
+}
+
+uint64_t TransactionProfiler::Record::getUnaccountedNs() const {
+  uint64_t accounted = 0;
+  for (uint64_t ns : phase_ns) {
+    accounted += ns;
+  }
+  return total_ns > accounted ? total_ns - accounted : 0;
+}
+
+TransactionProfiler::ScopedRecord::ScopedRecord(TransactionProfiler* profiler,
+                                                llvm::StringRef input)
+    : profiler_(profiler),
+      parent_record_(current_record),
+      parent_node_(current_node) {
+  if (!profiler_) {
+    return;
+  }
+  record_.input = input.take_front(kMaxInputLength).str();
+  std::replace(record_.input.begin(), record_.input.end(), '\n', ' ');
+
+  // 嵌套的process()调用(例如在用户代码中调用解释器)拥有自己的记录，
+  // 它的时间不计入外层记录的当前阶段。
+  start_ = std::chrono::steady_clock::now();
+  if (parent_record_ && parent_node_ >= 0) {
+    addSelfTime(*parent_record_, parent_node_, elapsedNs(phase_start, start_));
+  }
+  current_record = &record_;
+  current_node = -1;
+}
+
+TransactionProfiler::ScopedRecord::~ScopedRecord() {
+  if (!profiler_) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  record_.total_ns = elapsedNs(start_, now);
+  current_record = parent_record_;
+  current_node = parent_node_;
+  phase_start = now;
+
+  std::lock_guard<std::mutex> lock(profiler_->mutex_);
+  profiler_->records_.push_back(std::move(record_));
+}
+
+TransactionProfiler::PhaseRAII::PhaseRAII(Phase phase)
+    : active_(current_record), parent_node_(current_node) {
+  if (!active_) {
+    return;
+  }
+  start_ = std::chrono::steady_clock::now();
+  if (parent_node_ >= 0) {
+    addSelfTime(*current_record, parent_node_, elapsedNs(phase_start, start_));
+  }
+  current_node = getChildNode(*current_record, parent_node_, phase);
+  ++current_record->nodes[current_node].count;
+  phase_start = start_;
+}
+
+TransactionProfiler::PhaseRAII::~PhaseRAII() {
+  if (!active_ || !current_record) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  addSelfTime(*current_record, current_node, elapsedNs(phase_start, now));
+  current_record->nodes[current_node].total_ns += elapsedNs(start_, now);
+  current_node = parent_node_;
+  phase_start = now;
+}
+
+void TransactionProfiler::setTransaction(const Transaction& transaction) {
+  if (current_record) {
+    current_record->transaction_id = transaction.getUniqueID();
+  }
+}
+
+void TransactionProfiler::addInstructionCount(uint64_t count) {
+  if (current_record) {
+    current_record->instruction_count += count;
+  }
+}
+
+void TransactionProfiler::addObjectSize(uint64_t size) {
+  if (current_record) {
+    current_record->object_size += size;
+  }
+}
+
+std::vector<TransactionProfiler::Record> TransactionProfiler::getRecords()
+    const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return records_;
+}
+
+void TransactionProfiler::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  records_.clear();
+}
+
+void TransactionProfiler::dump(llvm::raw_ostream& out, size_t limit,
+                               bool tree) const {
+  std::vector<Record> records = getRecords();
+  std::stable_sort(records.begin(), records.end(),
+                   [](const Record& lhs, const Record& rhs) {
+                     return lhs.total_ns > rhs.total_ns;
+                   });
+  if (limit && records.size() > limit) {
+    records.resize(limit);
+  }
+
+  auto ms = [](uint64_t ns) { return llvm::format("%10.3f", ns / 1e6); };
+
+  out << "  trans     total(ms)";
+  for (int phase = 0; phase < kNumPhases; ++phase) {
+    out << llvm::format("%15s", getPhaseName(static_cast<Phase>(phase)));
+  }
+  out << "      other     insts   obj(B)  input\n";
+  for (const Record& record : records) {
+    out << llvm::format("%7u", record.transaction_id) << "    "
+        << ms(record.total_ns);
+    for (uint64_t ns : record.phase_ns) {
+      out << "     " << ms(ns);
+    }
+    out << " " << ms(record.getUnaccountedNs())
+        << llvm::format("%10llu", (unsigned long long)record.instruction_count)
+        << llvm::format("%9llu", (unsigned long long)record.object_size)
+        << "  " << record.input << "\n";
+    if (!tree) {
+      continue;
+    }
+    for (size_t i = 0, e = record.nodes.size(); i != e; ++i) {
+      if (record.nodes[i].parent < 0) {
+        dumpNode(out, record, i, 0);
+      }
+    }
+  }
+}
+
+}  // namespace cppinterp
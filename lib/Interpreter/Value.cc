@@ -1,9 +1,14 @@
 #include "cppinterp/Interpreter/Value.h"
 
+#include <atomic>
+#include <cstddef>
 #include <cstring>
+#include <thread>
+#include <type_traits>
 
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/CanonicalType.h"
+#include "clang/AST/DeclTemplate.h"
 #include "clang/AST/ExprCXX.h"
 #include "clang/AST/Type.h"
 #include "clang/Frontend/CompilerInstance.h"
@@ -11,9 +16,13 @@
 #include "clang/Sema/Overload.h"
 #include "clang/Sema/Sema.h"
 #include "cppinterp/Interpreter/Interpreter.h"
+#include "cppinterp/Interpreter/ValueAllocator.h"
+#include "cppinterp/Interpreter/ValuePrinterCache.h"
 #include "cppinterp/Utils/Casting.h"
+#include "cppinterp/Utils/Output.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_os_ostream.h"
 
 namespace {
@@ -24,11 +33,21 @@ class AllocatedValue {
   using DtorFunc_t = void (*)(void*);
 
  private:
-  mutable unsigned ref_cnt_;
+  /// 引用计数。只有shared_为true时才使用原子的读-改-写操作，否则使用
+  /// 宽松的读和写，开销与普通整数相同。
+  mutable std::atomic<unsigned> ref_cnt_;
+  /// 是否可以在多个线程中持有引用，由Value::makeThreadShareable()设置。
+  /// 放在ref_cnt_之后填充它的对齐空隙，头部因此保持在48字节。
+  bool shared_ = false;
   DtorFunc_t dtor_func_;
+  cppinterp::ValueAllocator* allocator_;
+  /// 设置shared_的线程，析构函数只在这个线程上运行。
+  std::thread::id owner_;
   unsigned long alloc_size_;
   unsigned long elems_num_;
-  char payload_[1];  // 分配的开始。
+  /// 分配的开始。块本身按std::max_align_t对齐，负载也必须如此：
+  /// long double、__int128和SSE类型的成员要求16字节对齐。
+  alignas(alignof(std::max_align_t)) char payload_[1];
 
   static const unsigned char kCanaryUnconstructedObject[8];
 
@@ -39,23 +58,28 @@ class AllocatedValue {
                         sizeof(kCanaryUnconstructedObject)) != 0);
   }
 
-  AllocatedValue(void* dtor_func, size_t alloc_size, size_t elems_num)
+  AllocatedValue(void* dtor_func, cppinterp::ValueAllocator* allocator,
+                 size_t alloc_size, size_t elems_num)
       : ref_cnt_(1),
         dtor_func_(cppinterp::utils::VoidToFunctionPtr<DtorFunc_t>(dtor_func)),
+        allocator_(allocator),
         alloc_size_(alloc_size),
         elems_num_(elems_num) {}
 
  public:
-  /// 分配管理payload_size字节的对象的AllocatedValue所需的内存，并返回负载对象的地址。
-  static char* CreatePayload(unsigned payload_size, void* dtor_func,
+  /// 从allocator分配管理payload_size字节的对象的AllocatedValue所需的内存，
+  /// 并返回负载对象的地址。
+  static char* CreatePayload(cppinterp::ValueAllocator& allocator,
+                             unsigned payload_size, void* dtor_func,
                              size_t elems_num) {
     if (payload_size < sizeof(kCanaryUnconstructedObject)) {
       payload_size = sizeof(kCanaryUnconstructedObject);
     }
 
-    char* alloc = new char[AllocatedValue::getPayloadOffset() + payload_size];
-    AllocatedValue* alloc_val =
-        new (alloc) AllocatedValue(dtor_func, payload_size, elems_num);
+    void* alloc = allocator.allocate(
+        AllocatedValue::getPayloadOffset() + payload_size, payload_size);
+    AllocatedValue* alloc_val = new (alloc)
+        AllocatedValue(dtor_func, &allocator, payload_size, elems_num);
     std::memcpy(alloc_val->getPayload(), kCanaryUnconstructedObject,
                 sizeof(kCanaryUnconstructedObject));
     return alloc_val->getPayload();
@@ -64,9 +88,8 @@ class AllocatedValue {
   const char* getPayload() const { return payload_; }
   char* getPayload() { return payload_; }
 
-  static unsigned getPayloadOffset() {
-    static const AllocatedValue Dummy(0, 0, 0);
-    return Dummy.payload_ - (const char*)&Dummy;
+  static constexpr unsigned getPayloadOffset() {
+    return offsetof(AllocatedValue, payload_);
   }
 
   static AllocatedValue* getFromPayload(void* payload) {
@@ -74,23 +97,70 @@ class AllocatedValue {
                                              getPayloadOffset());
   }
 
-  void Retain() { ++ref_cnt_; }
+  bool isShared() const { return shared_; }
+
+  /// 在唯一持有引用的线程上调用，之后引用计数使用原子操作。
+  void MakeShared() {
+    shared_ = true;
+    owner_ = std::this_thread::get_id();
+  }
+
+  void Retain() {
+    if (shared_) {
+      ref_cnt_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      ref_cnt_.store(ref_cnt_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+    }
+  }
 
   void Release() {
-    assert(ref_cnt_ > 0 && "Reference count is already zero.");
-    if (--ref_cnt_ == 0) {
-      if (dtor_func_ && IsAlive()) {
-        assert(elems_num_ && "No elements!");
-        char* payload = getPayload();
-        const auto skip = alloc_size_ / elems_num_;
-        while (elems_num_-- != 0)
-          (*dtor_func_)(payload + elems_num_ * skip);
+    assert(ref_cnt_.load(std::memory_order_relaxed) > 0 &&
+           "Reference count is already zero.");
+    if (shared_) {
+      if (ref_cnt_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+      }
+    } else {
+      unsigned count = ref_cnt_.load(std::memory_order_relaxed) - 1;
+      ref_cnt_.store(count, std::memory_order_relaxed);
+      if (count) {
+        return;
       }
-      delete[] (char*)this;
     }
+
+    // 析构函数是JIT代码，不能与解释器的编译和卸载并发运行，
+    // 交给所有者线程在ValueAllocator::reclaimDeferred()中运行。
+    if (shared_ && dtor_func_ && IsAlive() &&
+        std::this_thread::get_id() != owner_) {
+      allocator_->deferDestruction(this, &AllocatedValue::Destroy, owner_);
+      return;
+    }
+    Destroy(this);
+  }
+
+  /// 析构负载中的对象并释放内存。
+  static void Destroy(void* self) {
+    AllocatedValue* alloc_val = static_cast<AllocatedValue*>(self);
+    if (alloc_val->dtor_func_ && alloc_val->IsAlive()) {
+      assert(alloc_val->elems_num_ && "No elements!");
+      char* payload = alloc_val->getPayload();
+      const auto skip = alloc_val->alloc_size_ / alloc_val->elems_num_;
+      while (alloc_val->elems_num_-- != 0)
+        (*alloc_val->dtor_func_)(payload + alloc_val->elems_num_ * skip);
+    }
+    const unsigned long alloc_size = alloc_val->alloc_size_;
+    cppinterp::ValueAllocator* allocator = alloc_val->allocator_;
+    alloc_val->~AllocatedValue();
+    allocator->deallocate(self, getPayloadOffset() + alloc_size, alloc_size);
   }
 };
 
+static_assert(AllocatedValue::getPayloadOffset() %
+                      alignof(std::max_align_t) ==
+                  0,
+              "Value payloads must be aligned like the allocator's blocks");
+
 /// random
 const unsigned char AllocatedValue::kCanaryUnconstructedObject[8] = {
     0x4c, 0x37, 0xad, 0x8f, 0x2d, 0x23, 0x95, 0x91};
@@ -102,6 +172,7 @@ namespace cppinterp {
 Value::Value(const Value& other)
     : storage_(other.storage_),
       needs_managed_alloc_(other.needs_managed_alloc_),
+      stored_inline_(other.stored_inline_),
       type_kind_(other.type_kind_),
       type_(other.type_),
       interpreter_(other.interpreter_) {
@@ -139,6 +210,20 @@ static Value::TypeKind getCorrespondingTypeKind(clang::QualType qt) {
   }
 }
 
+/// 类型是否是可以直接存放在Value::Storage中的平凡记录：复制只需要复制
+/// 字节，也不需要调用析构函数。
+static bool CanStoreInline(const clang::ASTContext& ctx, clang::QualType qt) {
+  if (!qt->isRecordType() || qt->isIncompleteType()) {
+    return false;
+  }
+  if (!qt.isTriviallyCopyableType(ctx) || qt.isDestructedType()) {
+    return false;
+  }
+  clang::TypeInfoChars info = ctx.getTypeInfoInChars(qt);
+  return info.Width.getQuantity() <= sizeof(Value::Storage) &&
+         info.Align.getQuantity() <= alignof(Value::Storage);
+}
+
 Value::Value(clang::QualType clang_type, Interpreter& interp)
     : type_kind_(getCorrespondingTypeKind(clang_type)),
       type_(clang_type.getAsOpaquePtr()),
@@ -151,6 +236,11 @@ Value::Value(clang::QualType clang_type, Interpreter& interp)
          canon->isMemberPointerType())) {
       needs_managed_alloc_ = true;
     }
+    if (CanStoreInline(getASTContext(), canon)) {
+      needs_managed_alloc_ = false;
+      stored_inline_ = true;
+      std::memset(&storage_, 0, sizeof(storage_));
+    }
   }
   if (needsManagedAllocation()) {
     ManagedAllocate();
@@ -166,6 +256,7 @@ Value& Value::operator=(const Value& other) {
   type_ = other.type_;
   storage_ = other.storage_;
   needs_managed_alloc_ = other.needs_managed_alloc_;
+  stored_inline_ = other.stored_inline_;
   type_kind_ = other.type_kind_;
   interpreter_ = other.interpreter_;
   if (needsManagedAllocation()) {
@@ -184,9 +275,11 @@ Value& Value::operator=(Value&& other) {
   type_ = other.type_;
   storage_ = other.storage_;
   needs_managed_alloc_ = other.needs_managed_alloc_;
+  stored_inline_ = other.stored_inline_;
   type_kind_ = other.type_kind_;
   interpreter_ = other.interpreter_;
   other.needs_managed_alloc_ = false;
+  other.stored_inline_ = false;
   other.type_kind_ = Value::kInvalid;
 
   return *this;
@@ -234,10 +327,146 @@ void Value::ManagedAllocate() {
     dtor_func = interpreter_->compileDtorCallFor(record_type->getDecl());
   }
 
+  // 顺便回收当前线程拥有、在其他线程上释放的共享值，它们的析构函数在这里
+  // 运行；其他线程拥有的值留给它们自己的所有者线程。
+  ValueAllocator& allocator = interpreter_->getValueAllocator();
+  allocator.reclaimDeferred();
+
   const clang::ASTContext& ctx = getASTContext();
   unsigned payload_size = ctx.getTypeSizeInChars(getType()).getQuantity();
-  storage_.ptr_ = AllocatedValue::CreatePayload(payload_size, dtor_func,
-                                                GetNumberOfElements(getType()));
+  storage_.ptr_ = AllocatedValue::CreatePayload(
+      allocator, payload_size, dtor_func, GetNumberOfElements(getType()));
+}
+
+void Value::makeThreadShareable() {
+  if (needsManagedAllocation()) {
+    AllocatedValue::getFromPayload(storage_.ptr_)->MakeShared();
+  }
+}
+
+bool Value::isThreadShareable() const {
+  return !needsManagedAllocation() ||
+         AllocatedValue::getFromPayload(storage_.ptr_)->isShared();
+}
+
+clang::QualType Value::ArrayView::getElementType() const {
+  return clang::QualType::getFromOpaquePtr(element_type);
+}
+
+/// 分配器是否不占用std::vector对象开始的空间：std::allocator或者空类。
+/// 有状态的分配器(例如std::pmr::polymorphic_allocator)在一些实现中
+/// 位于指针之前。
+static bool IsEmptyAllocator(const clang::TemplateArgument& arg) {
+  if (arg.getKind() != clang::TemplateArgument::Type) {
+    return false;
+  }
+  const clang::CXXRecordDecl* alloc = arg.getAsType()->getAsCXXRecordDecl();
+  if (!alloc) {
+    return false;
+  }
+  if (alloc->isInStdNamespace() && alloc->getName() == "allocator") {
+    return true;
+  }
+  return alloc->hasDefinition() && alloc->isEmpty();
+}
+
+/// 元素类型是否有对应的Value::TypeKind：类类型和指针之外，
+/// 只支持CPPINTERP_VALUE_BUILTIN_TYPES中的内置类型(以及以它们为底层类型的
+/// 枚举)，例如__int128和_Float16不被支持。
+static bool IsSupportedElementType(clang::QualType type) {
+  if (const auto* et = llvm::dyn_cast<clang::EnumType>(type.getTypePtr())) {
+    type = et->getDecl()->getIntegerType();
+  }
+  const auto* bt = type->getAs<clang::BuiltinType>();
+  if (!bt || bt->isNullPtrType()) {
+    return true;
+  }
+  switch (bt->getKind()) {
+#define X(type, name)            \
+  case clang::BuiltinType::name: \
+    return true;
+    CPPINTERP_VALUE_BUILTIN_TYPES
+#undef X
+    default:
+      return false;
+  }
+}
+
+/// 识别元素连续存放的标准容器。data传入容器对象的地址，返回首元素的地址。
+static bool GetContainerElements(const clang::ASTContext& ctx,
+                                 clang::QualType type, const void*& data,
+                                 clang::QualType& elem_type, size_t& count) {
+  const auto* spec =
+      llvm::dyn_cast_or_null<clang::ClassTemplateSpecializationDecl>(
+          type->getAsCXXRecordDecl());
+  if (!spec || !spec->isInStdNamespace()) {
+    return false;
+  }
+  const clang::TemplateArgumentList& args = spec->getTemplateArgs();
+  if (args.size() < 1 || args[0].getKind() != clang::TemplateArgument::Type) {
+    return false;
+  }
+  elem_type = args[0].getAsType().getCanonicalType();
+
+  llvm::StringRef name = spec->getName();
+  if (name == "array") {
+    if (args.size() < 2 ||
+        args[1].getKind() != clang::TemplateArgument::Integral) {
+      return false;
+    }
+    // 元素数组是std::array唯一的成员，位于对象的开始。
+    count = args[1].getAsIntegral().getZExtValue();
+    return true;
+  }
+  if (name == "vector" && !elem_type->isBooleanType() && args.size() == 2 &&
+      IsEmptyAllocator(args[1])) {
+    size_t elem_size = ctx.getTypeSizeInChars(elem_type).getQuantity();
+    if (!elem_size) {
+      return false;
+    }
+    // libstdc++、libc++和MSVC STL的std::vector都以指向首元素和尾后元素的
+    // 两个指针开始。
+    const char* const* range = static_cast<const char* const*>(data);
+    data = range[0];
+    count = (range[1] - range[0]) / elem_size;
+    return true;
+  }
+  return false;
+}
+
+bool Value::getArrayView(ArrayView& view) const {
+  if (!isPointerOrObjectType()) {
+    return false;
+  }
+  clang::QualType type = getType().getCanonicalType();
+  if (!type->isConstantArrayType() && !type->isRecordType()) {
+    return false;
+  }
+
+  const clang::ASTContext& ctx = getASTContext();
+  const void* data = getPtr();
+  clang::QualType elem_type;
+  size_t count = 0;
+  if (type->isConstantArrayType()) {
+    count = GetNumberOfElements(type);
+    elem_type = type;
+    while (const clang::ConstantArrayType* arr_type =
+               ctx.getAsConstantArrayType(elem_type)) {
+      elem_type = arr_type->getElementType().getCanonicalType();
+    }
+  } else if (!GetContainerElements(ctx, type, data, elem_type, count)) {
+    return false;
+  }
+  if (!IsSupportedElementType(elem_type)) {
+    return false;
+  }
+
+  view.data = data;
+  view.count = count;
+  view.stride = ctx.getTypeSizeInChars(elem_type).getQuantity();
+  view.element_type = elem_type.getAsOpaquePtr();
+  view.element_kind = getCorrespondingTypeKind(elem_type);
+  return true;
 }
 
 void Value::AssertTypeMismatch(const char* type) const {
@@ -280,4 +509,84 @@ void Value::AssertOnUnsupportedTypeCast() const {
   assert("unsupported type in Value, cannot cast!" && 0);
 }
 
+template <typename T>
+static void PrintBuiltin(llvm::raw_ostream& out, T value, bool) {
+  if (std::is_signed<T>::value) {
+    out << static_cast<long long>(value);
+  } else {
+    out << static_cast<unsigned long long>(value);
+  }
+}
+
+static void PrintBuiltin(llvm::raw_ostream& out, bool value, bool) {
+  out << (value ? "true" : "false");
+}
+
+static void PrintBuiltin(llvm::raw_ostream& out, char value, bool escape) {
+  out << '\'';
+  if (escape) {
+    llvm::printEscapedString(llvm::StringRef(&value, 1), out);
+  } else {
+    out << value;
+  }
+  out << '\'';
+}
+
+static void PrintBuiltin(llvm::raw_ostream& out, float value, bool) {
+  out << llvm::format("%.9gf", value);
+}
+
+static void PrintBuiltin(llvm::raw_ostream& out, double value, bool) {
+  out << llvm::format("%.17g", value);
+}
+
+static void PrintBuiltin(llvm::raw_ostream& out, long double value, bool) {
+  out << llvm::format("%.21LgL", value);
+}
+
+void Value::print(llvm::raw_ostream& out, bool escape) const {
+  if (isInvalid()) {
+    out << "<<<invalid>>>";
+    return;
+  }
+  if (isVoid()) {
+    out << "(void)";
+    return;
+  }
+
+  clang::QualType type = getType();
+  out << '(' << type.getAsString(getASTContext().getPrintingPolicy())
+      << ") ";
+
+  // 内置类型直接在这里打印，不需要编译打印函数。
+  switch (type_kind_) {
+#define X(type, name)                           \
+  case Value::k##name:                          \
+    PrintBuiltin(out, storage_.name##_, escape); \
+    return;
+    CPPINTERP_VALUE_BUILTIN_TYPES
+#undef X
+    default:
+      break;
+  }
+
+  clang::QualType canon = type.getCanonicalType();
+  if (canon->isNullPtrType()) {
+    out << "nullptr";
+  } else if (canon->isRecordType() || canon->isConstantArrayType()) {
+    // 对象和数组由按类型缓存的打印函数打印，无法打印时只打印地址。
+    if (!interpreter_->getValuePrinterCache().print(out, type, getPtr(),
+                                                    escape)) {
+      out << '@' << getPtr();
+    }
+  } else {
+    out << getPtr();
+  }
+}
+
+void Value::dump(bool escape) const {
+  print(cppinterp::outs(), escape);
+  cppinterp::outs() << '\n';
+}
+
 }  // namespace cppinterp
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "cppinterp/Interpreter/ValueAllocator.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cppinterp {
+
+static_assert(ValueAllocator::kMinBlockSize
+                  << (ValueAllocator::kNumSizeClasses - 1) ==
+              ValueAllocator::kMaxBlockSize,
+              "size classes must cover [kMinBlockSize, kMaxBlockSize]");
+
+unsigned ValueAllocator::getSizeClass(size_t block_size) {
+  block_size = std::max(block_size, kMinBlockSize);
+  return llvm::Log2_64_Ceil(block_size) - llvm::Log2_64(kMinBlockSize);
+}
+
+ValueAllocator::~ValueAllocator() {
+  // 解释器析构时不会再有并发的编译和卸载，JIT代码也还在(value_allocator_
+  // 在executor_之后声明，先被销毁)，因此在这里运行所有线程剩下的析构函数，
+  // 同时归还超过最大大小类、不在slab中的块。
+  decltype(deferred_) deferred;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    deferred.swap(deferred_);
+  }
+  for (const auto& owner : deferred) {
+    for (const auto& entry : owner.second) {
+      entry.second(entry.first);
+    }
+  }
+}
+
+void* ValueAllocator::allocate(size_t block_size, size_t payload_size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.allocations;
+  ++stats_.live_values;
+  stats_.live_bytes += payload_size;
+  stats_.peak_live_bytes = std::max(stats_.peak_live_bytes, stats_.live_bytes);
+
+  if (block_size > kMaxBlockSize) {
+    ++stats_.large_allocations;
+    return ::operator new(block_size);
+  }
+
+  unsigned size_class = getSizeClass(block_size);
+  if (FreeBlock* block = free_lists_[size_class]) {
+    free_lists_[size_class] = block->next;
+    ++stats_.reused;
+    return block;
+  }
+  return slabs_.Allocate(kMinBlockSize << size_class,
+                         llvm::Align(alignof(std::max_align_t)));
+}
+
+void ValueAllocator::deallocate(void* block, size_t block_size,
+                                size_t payload_size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  assert(stats_.live_values && "Deallocating more values than allocated");
+  --stats_.live_values;
+  stats_.live_bytes -= payload_size;
+
+  if (block_size > kMaxBlockSize) {
+    ::operator delete(block);
+    return;
+  }
+
+  unsigned size_class = getSizeClass(block_size);
+  FreeBlock* free_block = static_cast<FreeBlock*>(block);
+  free_block->next = free_lists_[size_class];
+  free_lists_[size_class] = free_block;
+}
+
+void ValueAllocator::deferDestruction(void* block, DestroyFn destroy,
+                                      std::thread::id owner) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  deferred_[owner].emplace_back(block, destroy);
+}
+
+size_t ValueAllocator::reclaimDeferred() {
+  std::vector<std::pair<void*, DestroyFn>> deferred;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = deferred_.find(std::this_thread::get_id());
+    if (it == deferred_.end()) {
+      return 0;
+    }
+    deferred.swap(it->second);
+    deferred_.erase(it);
+  }
+  // destroy会调用deallocate()，不能持有锁。
+  for (const auto& entry : deferred) {
+    entry.second(entry.first);
+  }
+  return deferred.size();
+}
+
+ValueAllocator::Statistics ValueAllocator::getStatistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Statistics stats = stats_;
+  for (const auto& owner : deferred_) {
+    stats.deferred += owner.second.size();
+  }
+  stats.slabs = slabs_.GetNumSlabs();
+  stats.pooled_bytes = slabs_.getTotalMemory();
+  return stats;
+}
+
+void ValueAllocator::dump(llvm::raw_ostream& out) const {
+  Statistics stats = getStatistics();
+  out << "Value allocator: " << stats.live_values << " live values, "
+      << stats.live_bytes << " live bytes (peak " << stats.peak_live_bytes
+      << "), " << stats.allocations << " allocations (" << stats.reused
+      << " reused, " << stats.large_allocations << " large), "
+      << stats.slabs << " slabs, " << stats.pooled_bytes << " pooled bytes, "
+      << stats.deferred << " deferred\n";
+}
+
+}  // namespace cppinterp
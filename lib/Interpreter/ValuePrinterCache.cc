@@ -0,0 +1,228 @@
+#include "cppinterp/Interpreter/ValuePrinterCache.h"
+
+#include <string>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/QualTypeNames.h"
+#include "clang/AST/Type.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "cppinterp/AST/AST.h"
+#include "cppinterp/Interpreter/Interpreter.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace cppinterp {
+
+namespace {
+
+/// 打印函数的输出目标，布局必须与kValuePrinterRuntime中的sink相同。
+struct PrinterSink {
+  void (*write)(void* stream, const char* data, size_t size);
+  void* stream;
+  size_t max_elements;
+  unsigned max_depth;
+  int escape;
+};
+
+void WriteToStream(void* stream, const char* data, size_t size) {
+  static_cast<llvm::raw_ostream*>(stream)->write(data, size);
+}
+
+}  // namespace
+
+/// 打印函数共用的模板。compilePrinter()在AST中找不到__cppinterp_print
+/// 命名空间时才声明它，所以它所在的事务被卸载之后会被重新声明。
+/// 按优先级依次尝试：标量和枚举、字符串、pair、可迭代的范围，
+/// 其他对象只打印地址。
+static const char* const kValuePrinterRuntime = R"code(
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <utility>
+namespace __cppinterp_print {
+struct sink {
+  void (*write)(void* stream, const char* data, std::size_t size);
+  void* stream;
+  std::size_t max_elements;
+  unsigned max_depth;
+  int escape;
+  void put(const char* s, std::size_t n) { write(stream, s, n); }
+  void put(const char* s) { put(s, std::char_traits<char>::length(s)); }
+};
+template <unsigned N> struct rank : rank<N - 1> {};
+template <> struct rank<0> {};
+inline void put_char(sink& s, char c, char quote) {
+  if (s.escape && (c == quote || c == '\\')) {
+    char b[2] = {'\\', c};
+    s.put(b, 2);
+  } else if (s.escape && (static_cast<unsigned char>(c) < 0x20 || c == 0x7f)) {
+    char b[8];
+    unsigned u = static_cast<unsigned char>(c);
+    s.put(b, std::snprintf(b, sizeof(b), "\\x%02x", u));
+  } else {
+    s.put(&c, 1);
+  }
+}
+inline void put_number(sink& s, long long v) {
+  char b[32];
+  s.put(b, std::snprintf(b, sizeof(b), "%lld", v));
+}
+inline void put_number(sink& s, unsigned long long v) {
+  char b[32];
+  s.put(b, std::snprintf(b, sizeof(b), "%llu", v));
+}
+inline void put_number(sink& s, float v) {
+  char b[48];
+  s.put(b, std::snprintf(b, sizeof(b), "%.9gf", v));
+}
+inline void put_number(sink& s, double v) {
+  char b[48];
+  s.put(b, std::snprintf(b, sizeof(b), "%.17g", v));
+}
+inline void put_number(sink& s, long double v) {
+  char b[64];
+  s.put(b, std::snprintf(b, sizeof(b), "%.21LgL", v));
+}
+inline void scalar(sink& s, bool v) { s.put(v ? "true" : "false"); }
+inline void scalar(sink& s, char v) {
+  s.put("'");
+  put_char(s, v, '\'');
+  s.put("'");
+}
+template <class T> void scalar(sink& s, T v) {
+  typedef typename std::conditional<
+      std::is_floating_point<T>::value, T,
+      typename std::conditional<std::is_signed<T>::value, long long,
+                                unsigned long long>::type>::type U;
+  put_number(s, static_cast<U>(v));
+}
+template <class T> void scalar(sink& s, T* p) {
+  char b[32];
+  s.put(b, std::snprintf(b, sizeof(b), "%p", (const volatile void*)p));
+}
+template <class T> void print(sink& s, const T& v, unsigned depth);
+template <class T> void print_any(sink& s, const T& v, unsigned, rank<0>) {
+  char b[32];
+  s.put(b, std::snprintf(b, sizeof(b), "@%p", (const volatile void*)&v));
+}
+template <class T>
+auto print_any(sink& s, const T& v, unsigned depth, rank<1>)
+    -> decltype(void(std::begin(v)), void(std::end(v))) {
+  if (depth >= s.max_depth) {
+    s.put("{ ... }");
+    return;
+  }
+  s.put("{ ");
+  std::size_t n = 0;
+  for (auto it = std::begin(v), e = std::end(v); it != e; ++it, ++n) {
+    if (n) {
+      s.put(", ");
+    }
+    if (n == s.max_elements) {
+      s.put("...");
+      break;
+    }
+    print(s, *it, depth + 1);
+  }
+  s.put(" }");
+}
+template <class A, class B>
+void print_any(sink& s, const std::pair<A, B>& v, unsigned depth, rank<2>) {
+  s.put("{ ");
+  print(s, v.first, depth + 1);
+  s.put(", ");
+  print(s, v.second, depth + 1);
+  s.put(" }");
+}
+template <class T>
+auto print_any(sink& s, const T& v, unsigned, rank<3>)
+    -> typename std::enable_if<sizeof(typename T::value_type) == 1 &&
+                                   sizeof(typename T::traits_type) != 0,
+                               decltype(void(v.data()), void(v.size()))>::type {
+  std::size_t n = v.size();
+  s.put("\"");
+  for (std::size_t i = 0; i != n && i != s.max_elements; ++i) {
+    put_char(s, static_cast<char>(v.data()[i]), '"');
+  }
+  s.put(n > s.max_elements ? "\"..." : "\"");
+}
+template <class T>
+auto print_any(sink& s, const T& v, unsigned, rank<3>) ->
+    typename std::enable_if<std::is_arithmetic<T>::value ||
+                            std::is_pointer<T>::value>::type {
+  scalar(s, v);
+}
+template <class T>
+auto print_any(sink& s, const T& v, unsigned, rank<3>) ->
+    typename std::enable_if<std::is_enum<T>::value>::type {
+  scalar(s, static_cast<typename std::underlying_type<T>::type>(v));
+}
+template <class T> void print(sink& s, const T& v, unsigned depth) {
+  print_any(s, v, depth, rank<3>());
+}
+}
+)code";
+
+ValuePrinterCache::PrinterFn ValuePrinterCache::compilePrinter(
+    clang::QualType type) {
+  clang::ASTContext& ctx = interpreter_.getCI()->getASTContext();
+  clang::PrintingPolicy policy(ctx.getPrintingPolicy());
+  policy.SuppressScope = false;
+  policy.AnonymousTagLocations = false;
+  std::string type_name = clang::TypeName::getFullyQualifiedName(
+      type, ctx, policy, /*WithGlobalNsPrefix=*/true);
+
+  std::string name = "__cppinterp_printer";
+  interpreter_.createUniqueName(name);
+  // 别名声明可以拼写数组等不能直接写在*前面的类型。
+  std::string code;
+  if (!ast::lookup::Namespace(&interpreter_.getSema(), "__cppinterp_print")) {
+    code = kValuePrinterRuntime;
+  }
+  code += "extern \"C\" void " + name +
+          "(void* s, const void* obj) {\n"
+          "  using printed_t = " +
+          type_name +
+          ";\n"
+          "  __cppinterp_print::print(\n"
+          "      *static_cast<__cppinterp_print::sink*>(s),\n"
+          "      *static_cast<const printed_t*>(obj), 0);\n"
+          "}\n";
+  void* addr = interpreter_.compileFunction(name, code, /*if_uniq=*/false,
+                                            /*with_access_control=*/false);
+  return reinterpret_cast<PrinterFn>(addr);
+}
+
+ValuePrinterCache::PrinterFn ValuePrinterCache::getPrinter(
+    clang::QualType type) {
+  type = type.getCanonicalType().getUnqualifiedType();
+  auto it = printers_.find(type.getAsOpaquePtr());
+  if (it != printers_.end()) {
+    ++stats_.hits;
+    return it->second;
+  }
+
+  PrinterFn printer = compilePrinter(type);
+  if (printer) {
+    ++stats_.compilations;
+  } else {
+    ++stats_.failures;
+  }
+  printers_[type.getAsOpaquePtr()] = printer;
+  return printer;
+}
+
+bool ValuePrinterCache::print(llvm::raw_ostream& out, clang::QualType type,
+                              const void* object, bool escape) {
+  PrinterFn printer = getPrinter(type);
+  if (!printer) {
+    return false;
+  }
+  PrinterSink sink = {&WriteToStream, &out, limits_.max_elements,
+                      limits_.max_depth, escape};
+  printer(&sink, object);
+  return true;
+}
+
+}  // namespace cppinterp
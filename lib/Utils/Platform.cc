@@ -4,16 +4,29 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <glob.h>
 #include <limits.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include "cppinterp/Utils/Paths.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 
 #define PATH_MAXC (PATH_MAX + 1)
 
@@ -22,60 +35,150 @@ namespace utils {
 namespace platform {
 
 namespace {
-struct PointerCheck {
- private:
-  // A simple round-robin cache: what enters first, leaves first.
-  // MRU cache wasn't worth the extra CPU cycles.
-  static thread_local std::array<const void*, 8> lines;
-  static thread_local unsigned mostRecent;
-  size_t page_size;
-  size_t page_mask;
-
-  // Concurrent writes to the same cache element can result in invalid cache
-  // elements, causing pointer address not being available in the cache even
-  // though they should be, i.e. false cache misses. While can cause a
-  // slow-down, the cost for keeping the cache thread-local or atomic is
-  // much higher (yes, this was measured).
-  void push(const void* P) {
-    mostRecent = (mostRecent + 1) % lines.size();
-    lines[mostRecent] = P;
-  }
+/// 检查指针是否指向可读的内存。
+///
+/// /proc/self/maps中可读映射的快照保存为按地址排序、合并了相邻区间的
+/// 区间表，查询是一次二分查找。每个线程还有一个按页直接映射的缓存，
+/// 同时缓存有效和无效的页，刷新快照时通过代数(generation)让所有线程的
+/// 缓存失效。
+///
+/// 表中查到的页直接被认为有效，不调用系统调用。表中查不到的页用一次msync
+/// 区分新的映射和无效的页：已经映射的页触发快照的刷新，因此新的映射不会
+/// 被误报为无效。
+///
+/// 这比每次调用msync的旧实现弱：快照之后的munmap和mprotect只由定期刷新
+/// 发现，每个线程每检查kRefreshChecks次才刷新一次快照。在此之前，已经
+/// 被munmap的页仍然被报告为有效，解引用这样的指针会崩溃。
+///
+/// 无法读取/proc/self/maps时(例如没有挂载/proc)退回到每次调用msync，
+/// 只在定期刷新时重新尝试读取。
+class PointerCheck {
+  struct Region {
+    uintptr_t Start;
+    uintptr_t End;
+  };
 
- public:
-  PointerCheck()
-      : page_size(::sysconf(_SC_PAGESIZE)), page_mask(~(page_size - 1)) {
-    assert(IsPowerOfTwo(page_size));
+  struct CacheLine {
+    uintptr_t Page = 0;
+    unsigned Generation = 0;
+    bool Valid = false;
+  };
+
+  static constexpr unsigned kCacheLines = 256;
+  static constexpr unsigned kRefreshChecks = 1 << 16;
+
+  static thread_local std::array<CacheLine, kCacheLines> Cache;
+  /// 当前线程下一次定期刷新快照之前还能检查的次数。
+  static thread_local unsigned ChecksLeft;
+
+  size_t PageSize;
+  unsigned PageShift;
+
+  std::vector<Region> Regions;
+  /// 每次刷新快照时递增，从1开始，因此空的缓存行永远不会命中。
+  std::atomic<unsigned> Generation{1};
+  /// 是否成功读取过/proc/self/maps。
+  std::atomic<bool> HaveSnapshot{false};
+  std::shared_mutex Mutex;
+
+  bool findRegion(uintptr_t Addr) {
+    std::shared_lock<std::shared_mutex> Lock(Mutex);
+    auto It = std::upper_bound(
+        Regions.begin(), Regions.end(), Addr,
+        [](uintptr_t A, const Region& R) { return A < R.End; });
+    return It != Regions.end() && It->Start <= Addr;
   }
 
-  bool operator()(const void* P) {
-    // std::find is considerably slower, do manual search instead.
-    if (P == lines[0] || P == lines[1] || P == lines[2] || P == lines[3] ||
-        P == lines[4] || P == lines[5] || P == lines[6] || P == lines[7])
-      return true;
+  /// 重新读取/proc/self/maps。Expected是调用者看到的代数，
+  /// 其他线程已经刷新过时不再重复读取。
+  void refresh(unsigned Expected) {
+    std::string Maps;
+    int FD = ::open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (FD < 0)
+      return;
+    char Buf[16384];
+    ssize_t N;
+    while ((N = ::read(FD, Buf, sizeof(Buf))) > 0)
+      Maps.append(Buf, N);
+    ::close(FD);
+
+    std::vector<Region> NewRegions;
+    llvm::StringRef Rest(Maps);
+    while (!Rest.empty()) {
+      llvm::StringRef Line;
+      std::tie(Line, Rest) = Rest.split('\n');
+      // 格式："start-end perms offset dev inode path"，地址是十六进制。
+      llvm::StringRef Range, Perms;
+      std::tie(Range, Line) = Line.split(' ');
+      Perms = Line.take_until([](char C) { return C == ' '; });
+      uint64_t Start, End;
+      llvm::StringRef StartStr, EndStr;
+      std::tie(StartStr, EndStr) = Range.split('-');
+      if (StartStr.getAsInteger(16, Start) || EndStr.getAsInteger(16, End) ||
+          !Perms.startswith("r"))
+        continue;
+      if (!NewRegions.empty() && NewRegions.back().End == Start)
+        NewRegions.back().End = End;
+      else
+        NewRegions.push_back({uintptr_t(Start), uintptr_t(End)});
+    }
 
-    // Address of page containing P, assuming page_size is a power of 2
-    void* base = (void*)(((size_t)P) & page_mask);
+    std::unique_lock<std::shared_mutex> Lock(Mutex);
+    if (Generation.load(std::memory_order_relaxed) != Expected)
+      return;
+    Regions.swap(NewRegions);
+    HaveSnapshot.store(true, std::memory_order_relaxed);
+    Generation.store(Expected + 1, std::memory_order_release);
+  }
 
+  /// 页是否已经映射(不论权限)。
+  bool isMapped(uintptr_t Page) {
+    void* Base = reinterpret_cast<void*>(Page << PageShift);
     // P is invalid only when msync returns -1 and sets errno to ENOMEM
-    if (::msync(base, page_size, MS_ASYNC) != 0) {
+    if (::msync(Base, PageSize, MS_ASYNC) != 0) {
       assert(errno == ENOMEM && "Unexpected error in call to msync()");
       return false;
     }
-
-    push(P);
     return true;
   }
 
- private:
-  bool IsPowerOfTwo(size_t n) {
-    /* While n is even and larger than 1, divide by 2 */
-    while (((n & 1) == 0) && n > 1)
-      n >>= 1;
-    return n == 1;
+ public:
+  PointerCheck()
+      : PageSize(::sysconf(_SC_PAGESIZE)),
+        PageShift(llvm::Log2_64(PageSize)) {
+    assert(llvm::isPowerOf2_64(PageSize));
+    refresh(1);
+  }
+
+  bool operator()(const void* P) {
+    const uintptr_t Addr = reinterpret_cast<uintptr_t>(P);
+    const uintptr_t Page = Addr >> PageShift;
+    unsigned Gen = Generation.load(std::memory_order_acquire);
+    if (--ChecksLeft == 0) {
+      ChecksLeft = kRefreshChecks;
+      refresh(Gen);
+      Gen = Generation.load(std::memory_order_acquire);
+    }
+    if (!HaveSnapshot.load(std::memory_order_relaxed))
+      return isMapped(Page);
+    CacheLine& Line = Cache[Page % kCacheLines];
+    if (Line.Page == Page && Line.Generation == Gen)
+      return Line.Valid;
+
+    bool Valid = findRegion(Addr);
+    if (!Valid && isMapped(Page)) {
+      // 快照之后新映射的页，或者已经映射但是不可读的页，例如保护页。
+      refresh(Gen);
+      Gen = Generation.load(std::memory_order_acquire);
+      Valid = findRegion(Addr);
+    }
+    Line = {Page, Gen, Valid};
+    return Valid;
   }
 };
-thread_local std::array<const void*, 8> PointerCheck::lines = {{}};
-thread_local unsigned PointerCheck::mostRecent = 0;
+thread_local std::array<PointerCheck::CacheLine, PointerCheck::kCacheLines>
+    PointerCheck::Cache = {};
+thread_local unsigned PointerCheck::ChecksLeft = PointerCheck::kRefreshChecks;
 }  // namespace
 
 bool IsMemoryValid(const void* P) {
@@ -153,31 +256,187 @@ bool Popen(const std::string& Cmd, llvm::SmallVectorImpl<char>& Buf, bool RdE) {
   return false;
 }
 
-bool GetSystemLibraryPaths(llvm::SmallVectorImpl<std::string>& Paths) {
-  llvm::SmallString<1024> Buf;
-  platform::Popen("LD_DEBUG=libs LD_PRELOAD=DOESNOTEXIST ls", Buf, true);
-  const llvm::StringRef Result = Buf.str();
-
-  const std::size_t NPos = std::string::npos;
-  const std::size_t LD = Result.find("(LD_LIBRARY_PATH)");
-  std::size_t From = Result.find("search path=", LD == NPos ? 0 : LD);
-  if (From != NPos) {
-    std::size_t To = Result.find("(system search path)", From);
-    if (To != NPos) {
-      From += 12;
-      while (To > From && isspace(Result[To - 1]))
-        --To;
-      std::string SysPath = Result.substr(From, To - From).str();
-      SysPath.erase(std::remove_if(SysPath.begin(), SysPath.end(), isspace),
-                    SysPath.end());
-
-      llvm::SmallVector<llvm::StringRef, 10> CurPaths;
-      SplitPaths(SysPath, CurPaths);
-      for (const auto& Path : CurPaths)
-        Paths.push_back(Path.str());
+namespace {
+
+/// ld.so.cache中与宿主架构对应的条目标志(FLAG_ELF_LIBC6加上架构位)，
+/// -1表示不按架构过滤。
+#if defined(__x86_64__) && defined(__LP64__)
+const int32_t kLDCacheFlags = 0x0303;
+#elif defined(__aarch64__)
+const int32_t kLDCacheFlags = 0x0a03;
+#elif defined(__i386__)
+const int32_t kLDCacheFlags = 0x0003;
+#else
+const int32_t kLDCacheFlags = -1;
+#endif
+
+/// 动态链接器配置描述的系统库，每个进程只读取一次。
+struct SystemLibraries {
+  std::vector<std::string> Dirs;
+  llvm::StringMap<std::string> Libs;
+  llvm::StringSet<> SeenDirs;
+
+  void addDir(llvm::StringRef Dir) {
+    while (Dir.size() > 1 && Dir.endswith("/"))
+      Dir = Dir.drop_back();
+    if (!Dir.empty() && SeenDirs.insert(Dir).second)
+      Dirs.push_back(Dir.str());
+  }
+
+  void parseConf(const std::string& File, unsigned Depth);
+  void parseCache(const char* File);
+};
+
+void SystemLibraries::parseConf(const std::string& File, unsigned Depth) {
+  // 防止include循环。
+  if (Depth > 16)
+    return;
+  auto Buf = llvm::MemoryBuffer::getFile(File, /*IsText=*/true);
+  if (!Buf)
+    return;
+
+  llvm::SmallVector<llvm::StringRef, 32> Lines;
+  (*Buf)->getBuffer().split(Lines, '\n');
+  for (llvm::StringRef Line : Lines) {
+    Line = Line.split('#').first.trim();
+    if (Line.empty())
+      continue;
+
+    llvm::StringRef Directive = Line.take_until(isspace);
+    if (Directive == "hwcap")
+      continue;
+    if (Directive == "include") {
+      // 相对路径的模式相对于当前文件所在的目录。glob按名字排序。
+      llvm::SmallVector<llvm::StringRef, 4> Patterns;
+      Line.drop_front(Directive.size())
+          .split(Patterns, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+      for (llvm::StringRef Pattern : Patterns) {
+        Pattern = Pattern.trim();
+        llvm::SmallString<256> Path;
+        if (!llvm::sys::path::is_absolute(Pattern))
+          Path = llvm::sys::path::parent_path(File);
+        llvm::sys::path::append(Path, Pattern);
+        glob_t Matches;
+        if (::glob(Path.c_str(), 0, nullptr, &Matches) == 0) {
+          for (size_t I = 0; I < Matches.gl_pathc; ++I)
+            parseConf(Matches.gl_pathv[I], Depth + 1);
+        }
+        ::globfree(&Matches);
+      }
+      continue;
+    }
+
+    // 目录之间可以用空白、逗号或冒号分隔，旧格式允许"dir=type"。
+    llvm::SmallVector<llvm::StringRef, 4> Dirs;
+    Line.split(Dirs, ' ', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+    for (llvm::StringRef Item : Dirs) {
+      llvm::SmallVector<llvm::StringRef, 4> Parts;
+      Item.trim().split(Parts, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+      for (llvm::StringRef Part : Parts) {
+        llvm::SmallVector<llvm::StringRef, 4> Subparts;
+        Part.split(Subparts, ':', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+        for (llvm::StringRef Dir : Subparts)
+          addDir(Dir.split('=').first.trim());
+      }
     }
   }
-  return true;
+}
+
+void SystemLibraries::parseCache(const char* File) {
+  auto Buf = llvm::MemoryBuffer::getFile(File, /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  if (!Buf)
+    return;
+  llvm::StringRef Data = (*Buf)->getBuffer();
+
+  auto Read32 = [](const char* P) {
+    uint32_t V;
+    ::memcpy(&V, P, sizeof(V));
+    return V;
+  };
+  auto Read64 = [](const char* P) {
+    uint64_t V;
+    ::memcpy(&V, P, sizeof(V));
+    return V;
+  };
+
+  // 旧格式："ld.so-1.7.0"，条目数和每个12字节的条目，之后按8字节对齐
+  // 跟着新格式。glibc 2.32之后只写新格式。
+  static const char OldMagic[] = "ld.so-1.7.0";
+  size_t Offset = 0;
+  if (Data.startswith(OldMagic)) {
+    if (Data.size() < 16)
+      return;
+    Offset = llvm::alignTo(16 + uint64_t(Read32(Data.data() + 12)) * 12, 8);
+  }
+
+  // 新格式：48字节的头部，之后是每个24字节的条目
+  // {int32 flags; uint32 key, value, osversion; uint64 hwcap}，
+  // key和value是相对于头部起始位置的字符串偏移。条目按优先级排列。
+  static const char NewMagic[] = "glibc-ld.so.cache1.1";
+  llvm::StringRef New = Data.substr(Offset);
+  if (!New.startswith(NewMagic) || New.size() < 48)
+    return;
+  const uint64_t NumLibs = Read32(New.data() + 20);
+  if (48 + NumLibs * 24 > New.size())
+    return;
+
+  auto GetString = [&New](uint32_t Off) {
+    if (Off >= New.size())
+      return llvm::StringRef();
+    const char* S = New.data() + Off;
+    return llvm::StringRef(S, ::strnlen(S, New.size() - Off));
+  };
+  for (uint64_t I = 0; I < NumLibs; ++I) {
+    const char* Entry = New.data() + 48 + I * 24;
+    const int32_t Flags = static_cast<int32_t>(Read32(Entry));
+    if (kLDCacheFlags != -1 && Flags != kLDCacheFlags)
+      continue;
+    // hwcap非零的条目(glibc-hwcaps/x86-64-v3之类的子目录和旧式的hwcap
+    // 子目录)只适用于具有相应特性的CPU，动态链接器会在运行时选择它们。
+    // 跳过它们，使用每个库都有的基线条目，也不把这些子目录加入搜索路径。
+    if (Read64(Entry + 16) != 0)
+      continue;
+    llvm::StringRef Name = GetString(Read32(Entry + 4));
+    llvm::StringRef Path = GetString(Read32(Entry + 8));
+    if (Name.empty() || Path.empty() || Path.contains("/glibc-hwcaps/"))
+      continue;
+    Libs.try_emplace(Name, Path.str());
+    addDir(llvm::sys::path::parent_path(Path));
+  }
+}
+
+const SystemLibraries& GetSystemLibraries() {
+  static const SystemLibraries Libraries = [] {
+    SystemLibraries Result;
+    Result.parseConf("/etc/ld.so.conf", 0);
+    Result.parseCache("/etc/ld.so.cache");
+    // 动态链接器总是搜索的可信目录。
+    for (const char* Dir : {"/lib64", "/usr/lib64", "/lib", "/usr/lib"}) {
+      if (llvm::sys::fs::is_directory(Dir))
+        Result.addDir(Dir);
+    }
+    return Result;
+  }();
+  return Libraries;
+}
+
+}  // namespace
+
+bool GetSystemLibraryPaths(llvm::SmallVectorImpl<std::string>& Paths) {
+  const SystemLibraries& Libraries = GetSystemLibraries();
+  Paths.append(Libraries.Dirs.begin(), Libraries.Dirs.end());
+  return !Libraries.Dirs.empty();
+}
+
+const llvm::StringMap<std::string>& GetSystemLibraryMap() {
+  return GetSystemLibraries().Libs;
+}
+
+llvm::StringRef FindSystemLibrary(llvm::StringRef Name) {
+  const llvm::StringMap<std::string>& Libs = GetSystemLibraryMap();
+  auto It = Libs.find(Name);
+  return It == Libs.end() ? llvm::StringRef() : llvm::StringRef(It->second);
 }
 
 std::string Demangle(const std::string& Symbol) {
@@ -0,0 +1,186 @@
+#include "cppinterp/Utils/SourceNormalization.h"
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/Token.h"
+#include "llvm/ADT/StringSwitch.h"
+
+namespace cppinterp {
+namespace utils {
+
+namespace {
+
+/// 以原始模式读取token并跳过预处理指令，注释在原始模式下本来就被跳过。
+/// 原始模式不识别关键字，关键字以raw_identifier返回。
+class DirectiveSkippingLexer {
+  clang::Lexer lexer_;
+
+ public:
+  /// source必须以'\0'结尾，std::string满足这个要求。
+  DirectiveSkippingLexer(const std::string& source,
+                         const clang::LangOptions& lang_opts)
+      : lexer_(clang::SourceLocation(), lang_opts, source.data(),
+               source.data(), source.data() + source.size()) {}
+
+  void lex(clang::Token& tok) {
+    lexer_.LexFromRawLexer(tok);
+    // 续行已经被词法分析器拼接，指令在下一个位于行首的token处结束。
+    while (tok.is(clang::tok::hash) && tok.isAtStartOfLine()) {
+      do {
+        lexer_.LexFromRawLexer(tok);
+      } while (tok.isNot(clang::tok::eof) && !tok.isAtStartOfLine());
+    }
+  }
+};
+
+/// 词法分析器以空的文件位置开始，token位置的编码就是它在输入中的偏移。
+size_t getOffset(const clang::Token& tok) {
+  return tok.getLocation().getRawEncoding();
+}
+
+enum DeclarationKind {
+  kNotDeclaration,
+  /// 在匹配的右花括号处结束，例如namespace。
+  kEndsWithBlock,
+  /// 在分号处结束，花括号之后还可以有声明符，例如struct S {} s;。
+  kEndsWithSemi
+};
+
+DeclarationKind getDeclarationKind(const clang::Token& tok) {
+  if (tok.isNot(clang::tok::raw_identifier)) {
+    return kNotDeclaration;
+  }
+  return llvm::StringSwitch<DeclarationKind>(tok.getRawIdentifier())
+      .Cases("namespace", "extern", "template", kEndsWithBlock)
+      .Cases("using", "typedef", "static_assert", kEndsWithSemi)
+      .Cases("class", "struct", "union", "enum", kEndsWithSemi)
+      .Default(kNotDeclaration);
+}
+
+/// tok是左括号open，跳到与之匹配的右括号之后的token。
+///\returns 没有找到匹配的右括号时返回false。
+bool skipBalanced(DirectiveSkippingLexer& lexer, clang::Token& tok,
+                  clang::tok::TokenKind open, clang::tok::TokenKind close) {
+  unsigned depth = 0;
+  do {
+    if (tok.is(clang::tok::eof)) {
+      return false;
+    }
+    if (tok.is(open)) {
+      ++depth;
+    } else if (tok.is(close)) {
+      --depth;
+    }
+    lexer.lex(tok);
+  } while (depth);
+  return true;
+}
+
+/// 跳过从tok开始的一个声明。
+///\returns 输入在声明结束之前结束时返回false。
+bool skipDeclaration(DirectiveSkippingLexer& lexer, clang::Token& tok,
+                     DeclarationKind kind) {
+  while (tok.isNot(clang::tok::eof)) {
+    if (tok.is(clang::tok::semi)) {
+      lexer.lex(tok);
+      return true;
+    }
+    if (tok.is(clang::tok::l_paren)) {
+      if (!skipBalanced(lexer, tok, clang::tok::l_paren, clang::tok::r_paren)) {
+        return false;
+      }
+      continue;
+    }
+    if (tok.is(clang::tok::l_brace)) {
+      if (!skipBalanced(lexer, tok, clang::tok::l_brace, clang::tok::r_brace)) {
+        return false;
+      }
+      if (tok.is(clang::tok::semi)) {
+        lexer.lex(tok);
+        return true;
+      }
+      if (kind == kEndsWithBlock) {
+        return true;
+      }
+      continue;
+    }
+    lexer.lex(tok);
+  }
+  return false;
+}
+
+/// 可以出现在函数声明符中参数列表之前的token，例如const std::string& f。
+bool isDeclaratorToken(const clang::Token& tok) {
+  return tok.isOneOf(clang::tok::raw_identifier, clang::tok::coloncolon,
+                     clang::tok::star, clang::tok::amp, clang::tok::ampamp,
+                     clang::tok::less, clang::tok::greater,
+                     clang::tok::greatergreater, clang::tok::comma,
+                     clang::tok::tilde);
+}
+
+/// 如果从tok开始的是一个函数定义就跳过它。
+///\returns 不是函数定义时返回false，此时tok停在任意位置。
+bool skipFunctionDefinition(DirectiveSkippingLexer& lexer, clang::Token& tok) {
+  // 返回类型和函数名：至少两个token，参数列表之前是一个标识符。
+  unsigned num_tokens = 0;
+  bool last_is_identifier = false;
+  while (isDeclaratorToken(tok)) {
+    ++num_tokens;
+    last_is_identifier = tok.is(clang::tok::raw_identifier);
+    lexer.lex(tok);
+  }
+  if (tok.isNot(clang::tok::l_paren) || num_tokens < 2 || !last_is_identifier) {
+    return false;
+  }
+  if (!skipBalanced(lexer, tok, clang::tok::l_paren, clang::tok::r_paren)) {
+    return false;
+  }
+
+  // cv限定符、noexcept(...)、override和尾置返回类型。
+  while (tok.isNot(clang::tok::l_brace)) {
+    if (tok.is(clang::tok::l_paren)) {
+      if (!skipBalanced(lexer, tok, clang::tok::l_paren, clang::tok::r_paren)) {
+        return false;
+      }
+      continue;
+    }
+    if (!isDeclaratorToken(tok) && tok.isNot(clang::tok::arrow)) {
+      return false;
+    }
+    lexer.lex(tok);
+  }
+  return skipBalanced(lexer, tok, clang::tok::l_brace, clang::tok::r_brace);
+}
+
+}  // namespace
+
+size_t getWrapPoint(const std::string& source,
+                    const clang::LangOptions& lang_opts) {
+  DirectiveSkippingLexer lexer(source, lang_opts);
+  clang::Token tok;
+  lexer.lex(tok);
+  while (tok.isNot(clang::tok::eof)) {
+    size_t offset = getOffset(tok);
+    if (tok.is(clang::tok::semi)) {
+      lexer.lex(tok);
+      continue;
+    }
+    if (DeclarationKind kind = getDeclarationKind(tok)) {
+      // 不完整的声明交给declare()报告错误。
+      if (!skipDeclaration(lexer, tok, kind)) {
+        return std::string::npos;
+      }
+      continue;
+    }
+    if (tok.isOneOf(clang::tok::raw_identifier, clang::tok::coloncolon) &&
+        skipFunctionDefinition(lexer, tok)) {
+      continue;
+    }
+    return offset;
+  }
+  return std::string::npos;
+}
+
+}  // namespace utils
+}  // namespace cppinterp
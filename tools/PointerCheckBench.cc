@@ -0,0 +1,147 @@
+/// 比较IsMemoryValid()与之前只用msync的实现(8项的指针环形缓存，
+/// 未命中时对每个页调用msync)的开销。
+///
+/// 用法：pointer-check-bench [检查次数]
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cppinterp/Utils/Platform.h"
+
+namespace {
+
+/// 之前的实现。
+class MsyncCheck {
+  std::array<const void*, 8> lines_ = {};
+  unsigned most_recent_ = 0;
+  uintptr_t page_mask_;
+
+ public:
+  MsyncCheck() : page_mask_(~uintptr_t(::sysconf(_SC_PAGESIZE) - 1)) {}
+
+  bool operator()(const void* ptr) {
+    for (const void* line : lines_) {
+      if (line == ptr) {
+        return true;
+      }
+    }
+    void* base = reinterpret_cast<void*>(uintptr_t(ptr) & page_mask_);
+    if (::msync(base, ~page_mask_ + 1, MS_ASYNC) != 0) {
+      return false;
+    }
+    most_recent_ = (most_recent_ + 1) % lines_.size();
+    lines_[most_recent_] = ptr;
+    return true;
+  }
+};
+
+template <typename CheckT>
+double measure(const std::vector<const void*>& ptrs, CheckT&& check,
+               size_t& valid) {
+  auto start = std::chrono::steady_clock::now();
+  for (const void* ptr : ptrs) {
+    valid += check(ptr);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void run(const char* name, const std::vector<const void*>& ptrs) {
+  MsyncCheck msync_check;
+  size_t valid = 0, expected = 0;
+  double current = measure(
+      ptrs, cppinterp::utils::platform::IsMemoryValid, valid);
+  double previous = measure(ptrs, msync_check, expected);
+  std::printf("%-8s IsMemoryValid %8.1f ms   msync %8.1f ms%s\n", name,
+              current, previous, valid == expected ? "" : "   MISMATCH");
+}
+
+/// 被munmap或者mprotect的页在下一次定期刷新快照之后被认为无效，
+/// 即当前线程最多再检查1 << 16次。
+bool checkStaleness(size_t page_size) {
+  using cppinterp::utils::platform::IsMemoryValid;
+  const int kMaxChecks = 1 << 17;
+  auto map_page = [page_size] {
+    return static_cast<char*>(::mmap(nullptr, page_size,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  };
+  char* unmapped = map_page();
+  char* protected_page = map_page();
+  if (unmapped == MAP_FAILED || protected_page == MAP_FAILED ||
+      !IsMemoryValid(unmapped) || !IsMemoryValid(protected_page)) {
+    return false;
+  }
+
+  ::munmap(unmapped, page_size);
+  bool unmapped_seen = false;
+  for (int i = 0; i < kMaxChecks && !unmapped_seen; ++i) {
+    unmapped_seen = !IsMemoryValid(unmapped);
+  }
+
+  ::mprotect(protected_page, page_size, PROT_NONE);
+  bool protected_seen = false;
+  for (int i = 0; i < kMaxChecks && !protected_seen; ++i) {
+    protected_seen = !IsMemoryValid(protected_page);
+  }
+  ::munmap(protected_page, page_size);
+
+  if (!unmapped_seen) {
+    std::printf("FAIL: an unmapped page stays valid\n");
+  }
+  if (!protected_seen) {
+    std::printf("FAIL: a PROT_NONE page stays valid\n");
+  }
+  return unmapped_seen && protected_seen;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t num_checks = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                     : 1000000;
+  const size_t page_size = ::sysconf(_SC_PAGESIZE);
+  const size_t num_pages = 16384;
+  auto* buffer = static_cast<char*>(::mmap(nullptr, num_pages * page_size,
+                                           PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                                           0));
+  if (buffer == MAP_FAILED) {
+    std::perror("mmap");
+    return 1;
+  }
+
+  // 分散在很多页上的指针。
+  std::vector<const void*> spread(num_checks);
+  for (size_t i = 0; i < num_checks; ++i) {
+    spread[i] = buffer + (i * 7919 % num_pages) * page_size + i % page_size;
+  }
+  // 集中在一个页上的不同指针。
+  std::vector<const void*> hot(num_checks);
+  for (size_t i = 0; i < num_checks; ++i) {
+    hot[i] = buffer + i % page_size;
+  }
+  // 无效的指针。跳过空指针：之前的实现的缓存初始为空指针，认为它有效。
+  std::vector<const void*> invalid(num_checks);
+  for (size_t i = 0; i < num_checks; ++i) {
+    invalid[i] = reinterpret_cast<const void*>((i % 64 + 1) * page_size);
+  }
+
+  run("spread", spread);
+  run("hot", hot);
+  run("invalid", invalid);
+  bool fresh = checkStaleness(page_size);
+  ::munmap(buffer, num_pages * page_size);
+  if (!fresh) {
+    return 1;
+  }
+  return 0;
+}